@@ -15,6 +15,7 @@
 #include <linux/sched.h>
 #include <linux/tick.h>
 #include <linux/clockchips.h>
+#include <linux/pm_qos_params.h>
 
 #include <plat/gpio.h>
 
@@ -50,6 +51,14 @@
 
 #define UL_PLL_START_UP_LATENCY 8000 /* us */
 
+/*
+ * Number of idle periods per cpu that the wake up predictor looks at,
+ * and the longest period it records. Periodic wake ups (audio dma,
+ * modem) show up as a run of similar periods well below the next timer.
+ */
+#define IDLE_HISTORY_LEN 8
+#define IDLE_HISTORY_MAX_US USEC_PER_SEC
+
 static struct cstate cstates[] = {
 	{
 		.enter_latency = 0,
@@ -163,8 +172,13 @@ static struct cstate cstates[] = {
 struct cpu_state {
 	int gov_cstate;
 	ktime_t sched_wake_up;
+	ktime_t pred_wake_up;
 	struct cpuidle_device dev;
 	bool restore_arm_core;
+	bool pred_limited;
+
+	u32 idle_history[IDLE_HISTORY_LEN];
+	int idle_history_idx;
 };
 
 static DEFINE_PER_CPU(struct cpu_state, *cpu_state);
@@ -298,6 +312,121 @@ static u32 get_remaining_sleep_time(ktime_t *next, int *on_cpu)
 	return remaining_sleep_time;
 }
 
+static void idle_history_add(struct cpu_state *state, s64 idle_us)
+{
+	if (idle_us > IDLE_HISTORY_MAX_US)
+		idle_us = IDLE_HISTORY_MAX_US;
+	if (idle_us < 0)
+		idle_us = 0;
+
+	state->idle_history[state->idle_history_idx] = (u32)idle_us;
+	state->idle_history_idx = (state->idle_history_idx + 1) %
+		IDLE_HISTORY_LEN;
+}
+
+/*
+ * Returns the length of the coming idle period in us if the recent
+ * ones are regular enough to predict it, otherwise UINT_MAX. The
+ * longest periods are dropped one by one as outliers as long as at
+ * least three quarters of the history is left.
+ */
+static u32 idle_history_predict(struct cpu_state *state)
+{
+	u32 dropped = 0;
+	u32 avg, max;
+	u64 variance;
+	s64 diff;
+	int max_idx;
+	int count;
+	int i;
+
+	while (1) {
+		u32 sum = 0;
+
+		count = 0;
+		max = 0;
+		max_idx = 0;
+		for (i = 0; i < IDLE_HISTORY_LEN; i++) {
+			u32 v = state->idle_history[i];
+
+			if (dropped & BIT(i))
+				continue;
+			sum += v;
+			count++;
+			if (v >= max) {
+				max = v;
+				max_idx = i;
+			}
+		}
+
+		if (count * 4 < IDLE_HISTORY_LEN * 3)
+			return UINT_MAX;
+
+		avg = sum / count;
+
+		variance = 0;
+		for (i = 0; i < IDLE_HISTORY_LEN; i++) {
+			u32 v = state->idle_history[i];
+
+			if (dropped & BIT(i))
+				continue;
+			diff = (s64)v - avg;
+			variance += diff * diff;
+		}
+		do_div(variance, count);
+
+		/* standard deviation below 20 us or below a sixth of avg */
+		if (variance <= 400 || (u64)avg * avg > 36 * variance)
+			return avg;
+
+		dropped |= BIT(max_idx);
+	}
+}
+
+/*
+ * Same as get_remaining_sleep_time() but for the wake ups predicted
+ * from the idle history of each cpu.
+ */
+static u32 get_predicted_sleep_time(void)
+{
+	ktime_t now;
+	int cpu;
+	s64 delta;
+	u32 predicted = UINT_MAX;
+
+	now = ktime_get();
+
+	spin_lock(&cpuidle_lock);
+	for_each_online_cpu(cpu) {
+		delta = ktime_us_delta(per_cpu(cpu_state, cpu)->pred_wake_up,
+				       now);
+		/* A prediction already passed says nothing */
+		if (delta > 0 && delta < predicted)
+			predicted = (u32)delta;
+	}
+	spin_unlock(&cpuidle_lock);
+
+	return predicted;
+}
+
+static bool is_state_allowed(int i, u32 sleep_time, bool power_state_req,
+			     s32 latency_req)
+{
+	/* Not worth entering unless we stay beyond the break even time */
+	if (sleep_time <= cstates[i].threshold)
+		return false;
+
+	if (cstates[i].exit_latency > latency_req)
+		return false;
+
+	/* This state says APE should be off */
+	if (cstates[i].APE == APE_OFF &&
+	    (power_state_req || ux500_ci_dbg_force_ape_on()))
+		return false;
+
+	return true;
+}
+
 static bool is_last_cpu_running(void)
 {
 	smp_rmb();
@@ -314,6 +443,9 @@ static int determine_sleep_state(u32 *sleep_time, int loc_idle_counter,
 	bool power_state_req;
 	ktime_t entry_time;
 	s64 delta_us;
+	u32 expected_time;
+	s32 latency_req;
+	struct cpu_state *state = per_cpu(cpu_state, smp_processor_id());
 
 	/* If first cpu to sleep, go to most shallow sleep state */
 	if (loc_idle_counter != num_online_cpus())
@@ -353,6 +485,10 @@ static int determine_sleep_state(u32 *sleep_time, int loc_idle_counter,
 
 	if ((*sleep_time) == UINT_MAX)
 		return CI_WFI;
+
+	/* Wake up expected from the timers or the idle history */
+	expected_time = min((*sleep_time), get_predicted_sleep_time());
+	latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
 	/*
 	 * Never go deeper than the governor recommends even though it might be
 	 * possible from a scheduled wake up point of view
@@ -365,21 +501,17 @@ static int determine_sleep_state(u32 *sleep_time, int loc_idle_counter,
 	}
 
 	for (i = max_depth; i > 0; i--) {
-
-		if ((*sleep_time) <= cstates[i].threshold)
-			continue;
-
-		if (cstates[i].APE == APE_OFF) {
-			/* This state says APE should be off */
-			if (power_state_req ||
-			    ux500_ci_dbg_force_ape_on())
-				continue;
-		}
-
-		/* OK state */
-		break;
+		if (is_state_allowed(i, expected_time, power_state_req,
+				     latency_req))
+			break;
 	}
 
+	/* Note if the timers alone would have allowed a deeper state */
+	state->pred_limited = i > 0 && i < max_depth &&
+		expected_time < (*sleep_time) &&
+		is_state_allowed(i + 1, (*sleep_time), power_state_req,
+				 latency_req);
+
 	ux500_ci_dbg_register_reason(i, power_state_req,
 				     (*sleep_time),
 				     max_depth);
@@ -391,7 +523,8 @@ static int enter_sleep(struct cpuidle_device *dev,
 		       struct cpuidle_state *ci_state)
 {
 	ktime_t time_enter, time_exit, time_wake;
-	ktime_t wake_up;
+	ktime_t wake_up, pred_wake_up;
+	u32 predicted;
 	int sleep_time = 0;
 	s64 diff;
 	int ret;
@@ -411,10 +544,18 @@ static int enter_sleep(struct cpuidle_device *dev,
 
 	wake_up = ktime_add(time_enter, tick_nohz_get_sleep_length());
 
+	predicted = idle_history_predict(state);
+	if (predicted != UINT_MAX)
+		pred_wake_up = ktime_add_us(time_enter, predicted);
+	else
+		pred_wake_up = wake_up;
+
 	spin_lock(&cpuidle_lock);
 
-	/* Save scheduled wake up for this cpu */
+	/* Save scheduled and predicted wake up for this cpu */
 	state->sched_wake_up = wake_up;
+	state->pred_wake_up = pred_wake_up;
+	state->pred_limited = false;
 
 	/* Retrive the cstate that the governor recommends for this CPU */
 	state->gov_cstate = (int) cpuidle_get_statedata(ci_state);
@@ -601,6 +742,8 @@ static int enter_sleep(struct cpuidle_device *dev,
 
 	slept_well = true;
 
+	idle_history_add(state, ktime_us_delta(time_wake, time_enter));
+
 	restore_sequence(state, time_wake);
 
 exit:
@@ -626,6 +769,7 @@ exit_fast:
 	spin_lock(&cpuidle_lock);
 	/* Remove wake up time i.e. set wake up far ahead */
 	state->sched_wake_up = wake_up;
+	state->pred_wake_up = wake_up;
 	spin_unlock(&cpuidle_lock);
 
 	/*
@@ -644,11 +788,15 @@ exit_fast:
 	ret = (int)diff;
 
 	ux500_ci_dbg_console_check_uart();
-	if (slept_well)
+	if (slept_well) {
+		ux500_ci_dbg_residency(target,
+				       ktime_us_delta(time_wake, time_enter),
+				       state->pred_limited);
 		ux500_ci_dbg_exit_latency(target,
 					  time_exit, /* now */
 					  time_wake, /* exit from wfi */
 					  time_enter); /* enter cpuidle */
+	}
 
 	ux500_ci_dbg_log(CI_RUNNING, time_exit);
 
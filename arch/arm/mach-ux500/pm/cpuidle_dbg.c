@@ -51,6 +51,12 @@ struct state_history_state {
 	u32 prcmu_int;
 	u32 pending_int;
 
+	/* left before the break even time of the state */
+	u32 mispredict;
+	u64 mispredict_us;
+	/* kept out of a deeper state by the wake up predictor */
+	u32 pred_limited;
+
 	u32 latency_count[NUM_LATENCY];
 	ktime_t latency_sum[NUM_LATENCY];
 	ktime_t latency_min[NUM_LATENCY];
@@ -315,6 +321,26 @@ void ux500_ci_dbg_wake_latency(int ctarget, int sleep_time)
 			      true);
 }
 
+void ux500_ci_dbg_residency(int ctarget, s64 residency, bool pred_limited)
+{
+	struct state_history *sh;
+	unsigned long flags;
+
+	if (cstates[ctarget].state < CI_IDLE)
+		return;
+
+	sh = per_cpu(state_history, smp_processor_id());
+
+	spin_lock_irqsave(&dbg_lock, flags);
+	if (residency < cstates[ctarget].threshold) {
+		sh->states[ctarget].mispredict++;
+		sh->states[ctarget].mispredict_us += residency;
+	}
+	if (pred_limited)
+		sh->states[ctarget].pred_limited++;
+	spin_unlock_irqrestore(&dbg_lock, flags);
+}
+
 static void state_record_time(struct state_history *sh, int ctarget,
 			      ktime_t now, ktime_t start, bool latency)
 {
@@ -440,6 +466,9 @@ static void state_history_reset(void)
 			sh->states[i].state_error = 0;
 			sh->states[i].prcmu_int = 0;
 			sh->states[i].pending_int = 0;
+			sh->states[i].mispredict = 0;
+			sh->states[i].mispredict_us = 0;
+			sh->states[i].pred_limited = 0;
 
 			sh->states[i].time = ktime_set(0, 0);
 
@@ -605,6 +634,16 @@ static void stats_disp_one(struct seq_file *s, struct state_history *sh,
 	seq_printf(s, " in %d ms %d%%",
 		   (u32) t_us, (u32)perc);
 
+	if (i > CI_WFI) {
+		u64 lost_ms = sh->states[i].mispredict_us;
+
+		do_div(lost_ms, 1000);
+		seq_printf(s, ", below break even: %u (%u ms)"
+			   " predictor limited: %u",
+			   sh->states[i].mispredict, (u32)lost_ms,
+			   sh->states[i].pred_limited);
+	}
+
 	if (cstates[i].state == CI_IDLE && verbose)
 		seq_printf(s, ", reg:%d time:%d both:%d gov:%d",
 			   sh->ape_blocked, sh->time_blocked,
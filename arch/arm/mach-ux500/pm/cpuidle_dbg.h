@@ -17,6 +17,7 @@ void ux500_ci_dbg_remove(void);
 
 void ux500_ci_dbg_log(int ctarget, ktime_t enter_time);
 void ux500_ci_dbg_wake_latency(int ctarget, int sleep_time);
+void ux500_ci_dbg_residency(int ctarget, s64 residency, bool pred_limited);
 void ux500_ci_dbg_exit_latency(int ctarget, ktime_t now, ktime_t exit,
 			       ktime_t enter);
 
@@ -43,6 +44,8 @@ static inline void ux500_ci_dbg_exit_latency(int ctarget,
 					     ktime_t now, ktime_t exit,
 					     ktime_t enter) { }
 static inline void ux500_ci_dbg_wake_latency(int ctarget, int sleep_time) { }
+static inline void ux500_ci_dbg_residency(int ctarget, s64 residency,
+					  bool pred_limited) { }
 
 
 static inline void ux500_ci_dbg_register_reason(int idx, bool power_state_req,
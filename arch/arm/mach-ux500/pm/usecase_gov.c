@@ -18,10 +18,15 @@
 #include <linux/kernel_stat.h>
 #include <linux/ktime.h>
 #include <linux/cpufreq.h>
+#include <linux/hrtimer.h>
+#include <trace/events/sched.h>
 #include <mach/prcmu.h>
 #include "cpuidle.h"
 
 #define CPULOAD_MEAS_DELAY	3000 /* 3 secondes of delta */
+#define HP_SAMPLE_DELAY		20 /* ms between runqueue samples */
+#define HP_KICK_DELAY_NS	50000 /* shortest wake up to cpu up delay */
+#define HP_LAT_BUCKETS		10
 #define PRCMU_TCDM_VOICE_CALL_FLAG (U8500_PRCMU_TCDM_BASE + 0xDD4)
 
 /* debug */
@@ -65,6 +70,46 @@ static unsigned long min_trend = 5;
 /* instant load */
 static unsigned long max_instant = 85;
 
+/*
+ * Event driven hotplug. While the current use case keeps the second cpu
+ * offline, a wake up that leaves hp_up_runnable threads runnable brings
+ * it online if there are still that many hp_up_delay ms later. It goes
+ * offline again when the average number of runnable threads over
+ * hp_down_delay ms is at most hp_down_runnable (in hundredths), and then
+ * stays offline for at least hp_min_off ms. Off by default: the use cases
+ * that keep the second cpu offline do so to save power.
+ */
+static unsigned long event_hotplug;
+static unsigned long hp_up_runnable = 2;
+static unsigned long hp_up_delay = 10;
+static unsigned long hp_down_runnable = 110;
+static unsigned long hp_down_delay = 200;
+static unsigned long hp_min_off = 500;
+
+/* Set when the current use case lets the events drive the hotplug */
+static bool hp_event_allowed;
+static atomic_t hp_kick_pending = ATOMIC_INIT(0);
+static ktime_t hp_kick_time;
+static struct hrtimer hp_kick_timer;
+static struct work_struct work_hp_up;
+static struct delayed_work work_hp_down;
+/* jiffies of the last event driven cpu down */
+static unsigned long hp_down_jiffies;
+
+/* runqueue samples of the current down window, under usecase_mutex */
+static ktime_t hp_window_start;
+static unsigned long hp_window_sum;
+static unsigned long hp_window_samples;
+
+/*
+ * wake up to second cpu online latency, hp_up_delay included, bucket i
+ * is below 256 << i us
+ */
+static DEFINE_SPINLOCK(hp_stats_lock);
+static u32 hp_lat_hist[HP_LAT_BUCKETS];
+static u32 hp_num_up;
+static u32 hp_num_down;
+
 /* Number of interrupts per second before exiting auto mode */
 static u32 exit_irq_per_s = 1000;
 static u64 old_num_irqs;
@@ -346,6 +391,8 @@ static void set_cpu_config(enum ux500_uc new_uc)
 		 (num_online_cpus() < 2))
 		cpu_up(1);
 
+	hp_event_allowed = !usecase_conf[new_uc].second_cpu_online;
+
 	prcmu_qos_update_requirement(PRCMU_QOS_ARM_OPP,
 			    "usecase", usecase_conf[new_uc].min_arm_opp);
 
@@ -371,6 +418,133 @@ exit:
 	user_config_updated = false;
 }
 
+static bool hp_event_active(void)
+{
+	return event_hotplug && hp_event_allowed;
+}
+
+static void hp_record_latency(ktime_t kick)
+{
+	s64 us = ktime_us_delta(ktime_get(), kick);
+	unsigned long flags;
+	int i;
+
+	i = (us < 0) ? 0 : fls((u32)min_t(s64, us, INT_MAX) >> 8);
+	if (i >= HP_LAT_BUCKETS)
+		i = HP_LAT_BUCKETS - 1;
+
+	spin_lock_irqsave(&hp_stats_lock, flags);
+	hp_lat_hist[i]++;
+	hp_num_up++;
+	spin_unlock_irqrestore(&hp_stats_lock, flags);
+}
+
+/*
+ * Called from try_to_wake_up() with the runqueue lock held, so nothing
+ * here may wake a task. The hotplug work is kicked from an hrtimer
+ * started without softirq wakeup, the same way the scheduler arms
+ * hrtick.
+ */
+static void hp_sched_wakeup(void *data, struct task_struct *p, int success)
+{
+	ktime_t delay;
+
+	if (!success || !hp_event_active() || num_online_cpus() > 1)
+		return;
+
+	if (time_before(jiffies, hp_down_jiffies +
+			msecs_to_jiffies(hp_min_off)))
+		return;
+
+	/* includes the waker, hp_up_work() checks again without it */
+	if (nr_running() < hp_up_runnable)
+		return;
+
+	if (atomic_xchg(&hp_kick_pending, 1))
+		return;
+
+	hp_kick_time = ktime_get();
+	delay = ktime_set(hp_up_delay / MSEC_PER_SEC,
+			  (hp_up_delay % MSEC_PER_SEC) * NSEC_PER_MSEC);
+	if (ktime_to_ns(delay) < HP_KICK_DELAY_NS)
+		delay = ktime_set(0, HP_KICK_DELAY_NS);
+	__hrtimer_start_range_ns(&hp_kick_timer, delay, 0,
+				 HRTIMER_MODE_REL, 0);
+}
+
+static enum hrtimer_restart hp_kick_timer_func(struct hrtimer *timer)
+{
+	schedule_work_on(0, &work_hp_up);
+	return HRTIMER_NORESTART;
+}
+
+static void hp_window_reset(void)
+{
+	hp_window_start = ktime_get();
+	hp_window_sum = 0;
+	hp_window_samples = 0;
+}
+
+static void hp_up_work(struct work_struct *work)
+{
+	mutex_lock(&usecase_mutex);
+
+	/* the runqueue count includes this worker */
+	if (hp_event_active() && num_online_cpus() < 2 &&
+	    nr_running() - 1 >= hp_up_runnable && !cpu_up(1)) {
+		hp_record_latency(hp_kick_time);
+
+		hp_window_reset();
+		schedule_delayed_work_on(0, &work_hp_down,
+					 msecs_to_jiffies(HP_SAMPLE_DELAY));
+	}
+
+	mutex_unlock(&usecase_mutex);
+
+	atomic_set(&hp_kick_pending, 0);
+}
+
+static void hp_down_work(struct work_struct *work)
+{
+	mutex_lock(&usecase_mutex);
+
+	if (num_online_cpus() < 2)
+		goto out;
+
+	if (!hp_event_active()) {
+		/* Give the hotplug back to the use case */
+		if (hp_event_allowed)
+			cpu_down(1);
+		goto out;
+	}
+
+	/* the runqueue count includes this worker */
+	hp_window_sum += nr_running() - 1;
+	hp_window_samples++;
+
+	if (ktime_to_ms(ktime_sub(ktime_get(), hp_window_start)) <
+	    hp_down_delay)
+		goto resched;
+
+	if (100 * hp_window_sum <= hp_down_runnable * hp_window_samples &&
+	    !cpu_down(1)) {
+		unsigned long flags;
+
+		hp_down_jiffies = jiffies;
+
+		spin_lock_irqsave(&hp_stats_lock, flags);
+		hp_num_down++;
+		spin_unlock_irqrestore(&hp_stats_lock, flags);
+		goto out;
+	}
+	hp_window_reset();
+resched:
+	schedule_delayed_work_on(0, &work_hp_down,
+				 msecs_to_jiffies(HP_SAMPLE_DELAY));
+out:
+	mutex_unlock(&usecase_mutex);
+}
+
 void usecase_update_governor_state(void)
 {
 	bool cancel_work = false;
@@ -550,6 +724,12 @@ define_set(trend_unbalance);
 define_set(min_trend);
 define_set(max_instant);
 define_set(debug);
+define_set(event_hotplug);
+define_set(hp_up_runnable);
+define_set(hp_up_delay);
+define_set(hp_down_runnable);
+define_set(hp_down_delay);
+define_set(hp_min_off);
 
 #define define_print(_name) \
 static ssize_t print_##_name(struct seq_file *s, void *p) \
@@ -564,6 +744,12 @@ define_print(trend_unbalance);
 define_print(min_trend);
 define_print(max_instant);
 define_print(debug);
+define_print(event_hotplug);
+define_print(hp_up_runnable);
+define_print(hp_up_delay);
+define_print(hp_down_runnable);
+define_print(hp_down_delay);
+define_print(hp_min_off);
 
 #define define_open(_name) \
 static ssize_t open_##_name(struct inode *inode, struct file *file) \
@@ -578,6 +764,12 @@ define_open(trend_unbalance);
 define_open(min_trend);
 define_open(max_instant);
 define_open(debug);
+define_open(event_hotplug);
+define_open(hp_up_runnable);
+define_open(hp_up_delay);
+define_open(hp_down_runnable);
+define_open(hp_down_delay);
+define_open(hp_min_off);
 
 #define define_dbg_file(_name) \
 static const struct file_operations fops_##_name = { \
@@ -597,6 +789,12 @@ define_dbg_file(trend_unbalance);
 define_dbg_file(min_trend);
 define_dbg_file(max_instant);
 define_dbg_file(debug);
+define_dbg_file(event_hotplug);
+define_dbg_file(hp_up_runnable);
+define_dbg_file(hp_up_delay);
+define_dbg_file(hp_down_runnable);
+define_dbg_file(hp_down_delay);
+define_dbg_file(hp_min_off);
 
 struct dbg_file {
 	struct dentry **file;
@@ -619,6 +817,63 @@ static struct dbg_file debug_entry[] = {
 	define_dbg_entry(min_trend),
 	define_dbg_entry(max_instant),
 	define_dbg_entry(debug),
+	define_dbg_entry(event_hotplug),
+	define_dbg_entry(hp_up_runnable),
+	define_dbg_entry(hp_up_delay),
+	define_dbg_entry(hp_down_runnable),
+	define_dbg_entry(hp_down_delay),
+	define_dbg_entry(hp_min_off),
+};
+
+static int hp_latency_print(struct seq_file *s, void *p)
+{
+	unsigned long flags;
+	u32 hist[HP_LAT_BUCKETS];
+	u32 ups, downs;
+	int i;
+
+	spin_lock_irqsave(&hp_stats_lock, flags);
+	memcpy(hist, hp_lat_hist, sizeof(hist));
+	ups = hp_num_up;
+	downs = hp_num_down;
+	spin_unlock_irqrestore(&hp_stats_lock, flags);
+
+	seq_printf(s, "cpu up: %u cpu down: %u\n", ups, downs);
+	for (i = 0; i < HP_LAT_BUCKETS - 1; i++)
+		seq_printf(s, "< %6u us: %u\n", 256 << i, hist[i]);
+	seq_printf(s, ">= %5u us: %u\n", 256 << (HP_LAT_BUCKETS - 2),
+		   hist[HP_LAT_BUCKETS - 1]);
+
+	return 0;
+}
+
+static ssize_t hp_latency_reset(struct file *file,
+				const char __user *user_buf,
+				size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&hp_stats_lock, flags);
+	memset(hp_lat_hist, 0, sizeof(hp_lat_hist));
+	hp_num_up = 0;
+	hp_num_down = 0;
+	spin_unlock_irqrestore(&hp_stats_lock, flags);
+
+	return count;
+}
+
+static int hp_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hp_latency_print, inode->i_private);
+}
+
+static const struct file_operations fops_hp_latency = {
+	.open = hp_latency_open,
+	.write = hp_latency_reset,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+	.owner = THIS_MODULE,
 };
 
 static int setup_debugfs(void)
@@ -642,6 +897,11 @@ static int setup_debugfs(void)
 					      S_IWUGO | S_IRUGO, usecase_dir,
 					      &exit_irq_per_s)))
 		goto fail;
+
+	if (IS_ERR_OR_NULL(debugfs_create_file("hotplug_latency",
+					       S_IWUGO | S_IRUGO, usecase_dir,
+					       NULL, &fops_hp_latency)))
+		goto fail;
 	return 0;
 fail:
 	debugfs_remove_recursive(usecase_dir);
@@ -905,6 +1165,17 @@ static int __init init_usecase_devices(void)
 
 	init_cpu_load_trend();
 
+	/* event driven hotplug */
+	INIT_WORK(&work_hp_up, hp_up_work);
+	INIT_DELAYED_WORK_DEFERRABLE(&work_hp_down, hp_down_work);
+	hp_down_jiffies = jiffies - msecs_to_jiffies(hp_min_off);
+	hrtimer_init(&hp_kick_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hp_kick_timer.function = hp_kick_timer_func;
+	if (register_trace_sched_wakeup(hp_sched_wakeup, NULL) ||
+	    register_trace_sched_wakeup_new(hp_sched_wakeup, NULL))
+		pr_warning("usecase-gov: no scheduler events, event driven "
+			   "hotplug disabled\n");
+
 	err = setup_debugfs();
 	if (err)
 		goto error;
@@ -920,6 +1191,8 @@ static int __init init_usecase_devices(void)
 error2:
 	debugfs_remove_recursive(usecase_dir);
 error:
+	unregister_trace_sched_wakeup_new(hp_sched_wakeup, NULL);
+	unregister_trace_sched_wakeup(hp_sched_wakeup, NULL);
 	unregister_early_suspend(&usecase_early_suspend);
 	return err;
 }
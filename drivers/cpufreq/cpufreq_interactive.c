@@ -25,9 +25,14 @@
 #include <linux/timer.h>
 #include <linux/workqueue.h>
 #include <linux/kthread.h>
+#include <linux/input.h>
+#include <linux/slab.h>
 
 #include <asm/cputime.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_interactive.h>
+
 static void (*pm_idle_old)(void);
 static atomic_t active_count = ATOMIC_INIT(0);
 
@@ -67,6 +72,21 @@ static unsigned long go_maxspeed_load;
 #define DEFAULT_MIN_SAMPLE_TIME 60000;
 static unsigned long min_sample_time;
 
+/*
+ * Frequency to raise all CPUs to on a boost pulse, 0 meaning policy max,
+ * and how long (us) the timer may not go below it afterwards.
+ */
+static unsigned long boost_freq;
+#define DEFAULT_BOOSTPULSE_DURATION 80000
+static unsigned long boostpulse_duration;
+
+/* Boost on touchscreen and key input. */
+static unsigned long input_boost = 1;
+
+/* Time (us, ktime base) until which a boost pulse is in effect. */
+static u64 boost_end_time;
+static spinlock_t boost_lock;
+
 #define DEBUG 0
 #define BUFSZ 128
 
@@ -167,6 +187,33 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
+static unsigned int cpufreq_interactive_boost_target(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	unsigned int freq = boost_freq;
+	unsigned int index;
+
+	if (!freq || freq > pcpu->policy->max)
+		freq = pcpu->policy->max;
+
+	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+					   freq, CPUFREQ_RELATION_H, &index))
+		return freq;
+
+	return pcpu->freq_table[index].frequency;
+}
+
+static int cpufreq_interactive_boosted(u64 now)
+{
+	unsigned long flags;
+	int boosted;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	boosted = now < boost_end_time;
+	spin_unlock_irqrestore(&boost_lock, flags);
+	return boosted;
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
@@ -264,9 +311,20 @@ static void cpufreq_interactive_timer(unsigned long data)
 
 	new_freq = pcpu->freq_table[index].frequency;
 
+	/* Hold the boost frequency until the last boost pulse expires. */
+	if (cpufreq_interactive_boosted(pcpu->timer_run_time)) {
+		unsigned int boost_target =
+			cpufreq_interactive_boost_target(pcpu);
+
+		if (new_freq < boost_target)
+			new_freq = boost_target;
+	}
+
 	if (pcpu->target_freq == new_freq)
 	{
 		dbgpr("timer %d: load=%d, already at %d\n", (int) data, cpu_load, new_freq);
+		trace_cpufreq_interactive_already(data, cpu_load,
+						  pcpu->target_freq, new_freq);
 		goto rearm_if_notmax;
 	}
 
@@ -278,11 +336,16 @@ static void cpufreq_interactive_timer(unsigned long data)
 		if (cputime64_sub(pcpu->timer_run_time, pcpu->freq_change_time) <
 		    min_sample_time) {
 			dbgpr("timer %d: load=%d cur=%d tgt=%d not yet\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
+			trace_cpufreq_interactive_notyet(data, cpu_load,
+							 pcpu->target_freq,
+							 new_freq);
 			goto rearm;
 		}
 	}
 
 	dbgpr("timer %d: load=%d cur=%d tgt=%d queue\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
+	trace_cpufreq_interactive_target(data, cpu_load, pcpu->target_freq,
+					 new_freq);
 
 	if (new_freq < pcpu->target_freq) {
 		pcpu->target_freq = new_freq;
@@ -491,6 +554,8 @@ static int cpufreq_interactive_up_task(void *data)
 				get_cpu_idle_time_us(cpu,
 						     &pcpu->freq_change_time);
 			dbgpr("up %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
+			trace_cpufreq_interactive_up(cpu, pcpu->target_freq,
+						     pcpu->policy->cur);
 		}
 	}
 
@@ -524,9 +589,140 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 			get_cpu_idle_time_us(cpu,
 					     &pcpu->freq_change_time);
 		dbgpr("down %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
+		trace_cpufreq_interactive_down(cpu, pcpu->target_freq,
+					       pcpu->policy->cur);
+	}
+}
+
+/*
+ * Raise every CPU running this governor to the boost frequency through
+ * the up task and keep the timer from ramping below it for the pulse
+ * duration.  Called from input event context, so must not sleep.
+ */
+static void cpufreq_interactive_boost(const char *reason)
+{
+	unsigned int cpu;
+	unsigned int freq;
+	unsigned long flags;
+	int anyboost = 0;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
+	trace_cpufreq_interactive_boost(reason);
+
+	spin_lock_irqsave(&boost_lock, flags);
+	boost_end_time = ktime_to_us(ktime_get()) + boostpulse_duration;
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		smp_rmb();
+
+		if (!pcpu->governor_enabled)
+			continue;
+
+		freq = cpufreq_interactive_boost_target(pcpu);
+
+		if (pcpu->target_freq < freq) {
+			pcpu->target_freq = freq;
+			cpumask_set_cpu(cpu, &up_cpumask);
+			anyboost = 1;
+		}
 	}
+
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	if (anyboost) {
+#if DEBUG
+		up_request_time = ktime_to_us(ktime_get());
+#endif
+		wake_up_process(up_task);
+	}
+}
+
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	/* One boost per input report rather than per axis update. */
+	if (input_boost && type == EV_SYN && code == SYN_REPORT)
+		cpufreq_interactive_boost("input");
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
 }
 
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	/* multi-touch touchscreens */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	/* single-touch touchscreens */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	/* keypads */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
 static ssize_t show_go_maxspeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
@@ -557,9 +753,79 @@ static ssize_t store_min_sample_time(struct kobject *kobj,
 static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
 		show_min_sample_time, store_min_sample_time);
 
+static ssize_t show_boost_freq(struct kobject *kobj,
+			       struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boost_freq);
+}
+
+static ssize_t store_boost_freq(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+
+	ret = strict_strtoul(buf, 0, &boost_freq);
+	return ret ? ret : count;
+}
+
+static struct global_attr boost_freq_attr = __ATTR(boost_freq, 0644,
+		show_boost_freq, store_boost_freq);
+
+static ssize_t show_boostpulse_duration(struct kobject *kobj,
+					struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boostpulse_duration);
+}
+
+static ssize_t store_boostpulse_duration(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+
+	ret = strict_strtoul(buf, 0, &boostpulse_duration);
+	return ret ? ret : count;
+}
+
+static struct global_attr boostpulse_duration_attr =
+	__ATTR(boostpulse_duration, 0644,
+	       show_boostpulse_duration, store_boostpulse_duration);
+
+static ssize_t show_input_boost(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost);
+}
+
+static ssize_t store_input_boost(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+
+	ret = strict_strtoul(buf, 0, &input_boost);
+	return ret ? ret : count;
+}
+
+static struct global_attr input_boost_attr = __ATTR(input_boost, 0644,
+		show_input_boost, store_input_boost);
+
+/* Any write starts a boost pulse, e.g. from the framework on app launch. */
+static ssize_t store_boostpulse(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	cpufreq_interactive_boost("pulse");
+	return count;
+}
+
+static struct global_attr boostpulse_attr = __ATTR(boostpulse, 0200,
+		NULL, store_boostpulse);
+
 static struct attribute *interactive_attributes[] = {
 	&go_maxspeed_load_attr.attr,
 	&min_sample_time_attr.attr,
+	&boost_freq_attr.attr,
+	&boostpulse_duration_attr.attr,
+	&input_boost_attr.attr,
+	&boostpulse_attr.attr,
 	NULL,
 };
 
@@ -600,6 +866,11 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		if (rc)
 			return rc;
 
+		rc = input_register_handler(&cpufreq_interactive_input_handler);
+		if (rc)
+			pr_warning("%s: failed to register input handler %d\n",
+				   __func__, rc);
+
 		pm_idle_old = pm_idle;
 		pm_idle = cpufreq_interactive_idle;
 		break;
@@ -620,6 +891,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		input_unregister_handler(&cpufreq_interactive_input_handler);
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
 
@@ -646,6 +918,7 @@ static int __init cpufreq_interactive_init(void)
 
 	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	boostpulse_duration = DEFAULT_BOOSTPULSE_DURATION;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -675,6 +948,7 @@ static int __init cpufreq_interactive_init(void)
 
 	spin_lock_init(&up_cpumask_lock);
 	spin_lock_init(&down_cpumask_lock);
+	spin_lock_init(&boost_lock);
 
 #if DEBUG
 	spin_lock_init(&dbgpr_lock);
@@ -10,6 +10,7 @@
  */
 
 #include <linux/hwmem.h>
+#include <linux/string.h>
 
 #include <asm/pgtable.h>
 
@@ -30,11 +31,23 @@ static void sync_buf_post_cpu(struct cach_buf *buf,
 	enum hwmem_access next_access, struct hwmem_region *next_region);
 
 static void invalidate_cpu_cache(struct cach_buf *buf,
-					struct cach_range *range_2b_used);
+	struct cach_range *range_2b_used, struct hwmem_region *region);
 static void clean_cpu_cache(struct cach_buf *buf,
-					struct cach_range *range_2b_used);
+	struct cach_range *range_2b_used, struct hwmem_region *region);
 static void flush_cpu_cache(struct cach_buf *buf,
-					struct cach_range *range_2b_used);
+	struct cach_range *range_2b_used, struct hwmem_region *region);
+
+typedef void (*cach_op)(void *vaddr, u32 paddr, u32 length, bool inner_only,
+							bool *did_everything);
+/*
+ * Applies op to the parts of region's blocks that are inside limit. Returns
+ * the number of bytes op was applied to.
+ */
+static u32 region_op(struct cach_buf *buf, struct hwmem_region *region,
+		struct cach_range *limit, cach_op op, bool *did_everything);
+static bool is_sparse_region(struct hwmem_region *region);
+static void add_dirty_region(struct cach_buf *buf,
+						struct hwmem_region *region);
 
 static void null_range(struct cach_range *range);
 static void expand_range(struct cach_range *range,
@@ -76,6 +89,9 @@ void cach_init_buf(struct cach_buf *buf, enum hwmem_alloc_flags cache_settings,
 	buf->pstart = 0;
 	buf->size = size;
 
+	buf->bytes_cleaned = 0;
+	buf->bytes_invalidated = 0;
+
 	buf->cache_settings = cachi_get_cache_settings(cache_settings);
 }
 
@@ -99,6 +115,7 @@ void cach_set_buf_addrs(struct cach_buf *buf, void* vaddr, u32 paddr)
 		buf->range_dirty_in_cpu_cache.end = buf->size;
 		align_range_up(&buf->range_dirty_in_cpu_cache,
 						get_dcache_granularity());
+		buf->num_dirty_regions = CACH_DIRTY_REGIONS_UNKNOWN;
 	} else {
 		flush_cpu_dcache(buf->vstart, buf->pstart, buf->size, false,
 									&tmp);
@@ -106,6 +123,7 @@ void cach_set_buf_addrs(struct cach_buf *buf, void* vaddr, u32 paddr)
 
 		null_range(&buf->range_in_cpu_cache);
 		null_range(&buf->range_dirty_in_cpu_cache);
+		buf->num_dirty_regions = 0;
 	}
 	null_range(&buf->range_invalid_in_cpu_cache);
 }
@@ -146,6 +164,21 @@ void cach_set_domain(struct cach_buf *buf, enum hwmem_access access,
 	}
 }
 
+void cach_set_domain_regions(struct cach_buf *buf, enum hwmem_access access,
+		enum hwmem_domain domain, struct hwmem_region *regions,
+							u32 num_regions)
+{
+	u32 i;
+
+	if (num_regions == 0) {
+		cach_set_domain(buf, access, domain, NULL);
+		return;
+	}
+
+	for (i = 0; i < num_regions; i++)
+		cach_set_domain(buf, access, domain, &regions[i]);
+}
+
 /*
  * Local functions
  */
@@ -214,7 +247,7 @@ static void sync_buf_pre_cpu(struct cach_buf *buf, enum hwmem_access access,
 		if (read || (write && buf->cache_settings &
 						HWMEM_ALLOC_HINT_CACHE_WB))
 			/* Perform defered invalidates */
-			invalidate_cpu_cache(buf, &region_range);
+			invalidate_cpu_cache(buf, &region_range, region);
 		if (read || (write && buf->cache_settings &
 						HWMEM_ALLOC_HINT_CACHE_AOW))
 			expand_range(&buf->range_in_cpu_cache, &region_range);
@@ -227,8 +260,15 @@ static void sync_buf_pre_cpu(struct cach_buf *buf, enum hwmem_access access,
 				intersect_range(&buf->range_in_cpu_cache,
 					&region_range, &dirty_range_addition);
 
-			expand_range(&buf->range_dirty_in_cpu_cache,
+			if (is_non_empty_range(&dirty_range_addition)) {
+				if (!is_non_empty_range(
+					&buf->range_dirty_in_cpu_cache))
+					buf->num_dirty_regions = 0;
+
+				expand_range(&buf->range_dirty_in_cpu_cache,
 							&dirty_range_addition);
+				add_dirty_region(buf, region);
+			}
 		}
 	}
 	if (buf->cache_settings & HWMEM_ALLOC_HINT_WRITE_COMBINE) {
@@ -260,13 +300,13 @@ static void sync_buf_post_cpu(struct cach_buf *buf,
 			expand_range(&buf->range_invalid_in_cpu_cache,
 								&intersection);
 
-			clean_cpu_cache(buf, &region_range);
+			clean_cpu_cache(buf, &region_range, next_region);
 		} else {
-			flush_cpu_cache(buf, &region_range);
+			flush_cpu_cache(buf, &region_range, next_region);
 		}
 	}
 	if (read)
-		clean_cpu_cache(buf, &region_range);
+		clean_cpu_cache(buf, &region_range, next_region);
 
 	if (buf->in_cpu_write_buf) {
 		drain_cpu_write_buf();
@@ -275,13 +315,27 @@ static void sync_buf_post_cpu(struct cach_buf *buf,
 	}
 }
 
-static void invalidate_cpu_cache(struct cach_buf *buf, struct cach_range *range)
+static void invalidate_cpu_cache(struct cach_buf *buf, struct cach_range *range,
+						struct hwmem_region *region)
 {
 	struct cach_range intersection;
 
 	intersect_range(&buf->range_invalid_in_cpu_cache, range,
 								&intersection);
-	if (is_non_empty_range(&intersection)) {
+	if (is_non_empty_range(&intersection) && is_sparse_region(region)) {
+		bool flushed_everything;
+
+		/*
+		 * Only the blocks are made valid, the gaps between them stay
+		 * in range_invalid_in_cpu_cache.
+		 */
+		buf->bytes_invalidated += region_op(buf, region, &intersection,
+					flush_cpu_dcache, &flushed_everything);
+		if (flushed_everything) {
+			null_range(&buf->range_invalid_in_cpu_cache);
+			null_range(&buf->range_dirty_in_cpu_cache);
+		}
+	} else if (is_non_empty_range(&intersection)) {
 		bool flushed_everything;
 
 		expand_range_2_edge(&intersection,
@@ -299,6 +353,7 @@ static void invalidate_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 				buf->cache_settings &
 					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
 							&flushed_everything);
+		buf->bytes_invalidated += range_length(&intersection);
 
 		if (flushed_everything) {
 			null_range(&buf->range_invalid_in_cpu_cache);
@@ -315,14 +370,42 @@ static void invalidate_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 	}
 }
 
-static void clean_cpu_cache(struct cach_buf *buf, struct cach_range *range)
+static void clean_cpu_cache(struct cach_buf *buf, struct cach_range *range,
+						struct hwmem_region *region)
 {
 	struct cach_range intersection;
+	bool cleaned_everything;
 
 	intersect_range(&buf->range_dirty_in_cpu_cache, range, &intersection);
-	if (is_non_empty_range(&intersection)) {
-		bool cleaned_everything;
+	if (!is_non_empty_range(&intersection))
+		return;
 
+	if (is_sparse_region(region)) {
+		/* Only the blocks are clean, keep the dirty range as it is */
+		buf->bytes_cleaned += region_op(buf, region, &intersection,
+					clean_cpu_dcache, &cleaned_everything);
+		if (cleaned_everything)
+			null_range(&buf->range_dirty_in_cpu_cache);
+	} else if (buf->num_dirty_regions != CACH_DIRTY_REGIONS_UNKNOWN) {
+		/*
+		 * The CPU only wrote to the blocks of the dirty regions, skip
+		 * the gaps between them.
+		 */
+		bool covers_dirty_range = intersection.start ==
+				buf->range_dirty_in_cpu_cache.start &&
+			intersection.end == buf->range_dirty_in_cpu_cache.end;
+		u32 i;
+
+		cleaned_everything = false;
+		for (i = 0; i < buf->num_dirty_regions && !cleaned_everything;
+									i++)
+			buf->bytes_cleaned += region_op(buf,
+					&buf->dirty_regions[i], &intersection,
+					clean_cpu_dcache, &cleaned_everything);
+
+		if (cleaned_everything || covers_dirty_range)
+			null_range(&buf->range_dirty_in_cpu_cache);
+	} else {
 		expand_range_2_edge(&intersection,
 					&buf->range_dirty_in_cpu_cache);
 
@@ -333,6 +416,7 @@ static void clean_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 				buf->cache_settings &
 					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
 							&cleaned_everything);
+		buf->bytes_cleaned += range_length(&intersection);
 
 		if (cleaned_everything)
 			null_range(&buf->range_dirty_in_cpu_cache);
@@ -342,12 +426,29 @@ static void clean_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 	}
 }
 
-static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range)
+static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range,
+						struct hwmem_region *region)
 {
 	struct cach_range intersection;
 
 	intersect_range(&buf->range_in_cpu_cache, range, &intersection);
-	if (is_non_empty_range(&intersection)) {
+	if (is_non_empty_range(&intersection) && is_sparse_region(region)) {
+		bool flushed_everything;
+		u32 length;
+
+		/* The ranges still cover the gaps so they are left as is */
+		length = region_op(buf, region, &intersection,
+					flush_cpu_dcache, &flushed_everything);
+		buf->bytes_cleaned += length;
+		buf->bytes_invalidated += length;
+
+		if (flushed_everything) {
+			if (!speculative_data_prefetch())
+				null_range(&buf->range_in_cpu_cache);
+			null_range(&buf->range_dirty_in_cpu_cache);
+			null_range(&buf->range_invalid_in_cpu_cache);
+		}
+	} else if (is_non_empty_range(&intersection)) {
 		bool flushed_everything;
 
 		expand_range_2_edge(&intersection, &buf->range_in_cpu_cache);
@@ -359,6 +460,8 @@ static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 				buf->cache_settings &
 					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
 							&flushed_everything);
+		buf->bytes_cleaned += range_length(&intersection);
+		buf->bytes_invalidated += range_length(&intersection);
 
 		if (flushed_everything) {
 			if (!speculative_data_prefetch())
@@ -377,6 +480,87 @@ static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 	}
 }
 
+static u32 region_op(struct cach_buf *buf, struct hwmem_region *region,
+		struct cach_range *limit, cach_op op, bool *did_everything)
+{
+	u32 length = 0;
+	u32 i = 0;
+
+	*did_everything = false;
+
+	/* Skip the blocks in front of limit */
+	if (limit->start > region->offset)
+		i = (limit->start - region->offset) / region->size;
+
+	for (; i < region->count; i++) {
+		u64 block_start = (u64)region->offset +
+				(u64)i * region->size + region->start;
+		struct cach_range block;
+		struct cach_range intersection;
+
+		if (block_start >= limit->end)
+			break;
+
+		block.start = (u32)block_start;
+		block.end = min_t(u64, block_start + region->end -
+						region->start, limit->end);
+		align_range_up(&block, get_dcache_granularity());
+
+		intersect_range(&block, limit, &intersection);
+		if (!is_non_empty_range(&intersection))
+			continue;
+
+		op(offset_2_vaddr(buf, intersection.start),
+				offset_2_paddr(buf, intersection.start),
+				range_length(&intersection),
+				buf->cache_settings &
+					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
+							did_everything);
+		length += range_length(&intersection);
+
+		if (*did_everything)
+			break;
+	}
+
+	return length;
+}
+
+/*
+ * A region is worth handling block by block if at least half of every block
+ * is outside of it, otherwise the per block overhead eats the gain.
+ */
+static bool is_sparse_region(struct hwmem_region *region)
+{
+	u32 granularity = get_dcache_granularity();
+
+	if (region->count < 2 || region->start >= region->end ||
+						region->end > region->size)
+		return false;
+
+	return align_up(region->end - region->start, granularity) +
+				granularity <= region->size / 2;
+}
+
+static void add_dirty_region(struct cach_buf *buf,
+						struct hwmem_region *region)
+{
+	u32 i;
+
+	if (buf->num_dirty_regions == CACH_DIRTY_REGIONS_UNKNOWN)
+		return;
+
+	for (i = 0; i < buf->num_dirty_regions; i++) {
+		if (!memcmp(&buf->dirty_regions[i], region, sizeof(*region)))
+			return;
+	}
+
+	if (!is_sparse_region(region) ||
+			buf->num_dirty_regions == CACH_MAX_DIRTY_REGIONS)
+		buf->num_dirty_regions = CACH_DIRTY_REGIONS_UNKNOWN;
+	else
+		buf->dirty_regions[buf->num_dirty_regions++] = *region;
+}
+
 static void null_range(struct cach_range *range)
 {
 	range->start = U32_MAX;
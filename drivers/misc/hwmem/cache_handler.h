@@ -31,6 +31,13 @@ struct cach_range {
 	u32 end; /* Exclusive */
 };
 
+/*
+ * Number of 2D regions the CPU can write before we stop tracking their
+ * shapes and fall back to range_dirty_in_cpu_cache alone.
+ */
+#define CACH_MAX_DIRTY_REGIONS 4
+#define CACH_DIRTY_REGIONS_UNKNOWN (~(u32)0)
+
 /*
  * Internal, do not touch!
  */
@@ -46,6 +53,18 @@ struct cach_buf {
 	struct cach_range range_in_cpu_cache;
 	struct cach_range range_dirty_in_cpu_cache;
 	struct cach_range range_invalid_in_cpu_cache;
+
+	/*
+	 * Shapes of what's in range_dirty_in_cpu_cache, lets clean skip the
+	 * gaps between the blocks of a 2D region. Set to
+	 * CACH_DIRTY_REGIONS_UNKNOWN when the shapes are not known.
+	 */
+	u32 num_dirty_regions;
+	struct hwmem_region dirty_regions[CACH_MAX_DIRTY_REGIONS];
+
+	/* Statistics, flushes count as both */
+	u64 bytes_cleaned;
+	u64 bytes_invalidated;
 };
 
 void cach_init_buf(struct cach_buf *buf,
@@ -58,4 +77,8 @@ void cach_set_pgprot_cache_options(struct cach_buf *buf, pgprot_t *pgprot);
 void cach_set_domain(struct cach_buf *buf, enum hwmem_access access,
 			enum hwmem_domain domain, struct hwmem_region *region);
 
+void cach_set_domain_regions(struct cach_buf *buf, enum hwmem_access access,
+		enum hwmem_domain domain, struct hwmem_region *regions,
+							u32 num_regions);
+
 #endif /* _CACHE_HANDLER_H_ */
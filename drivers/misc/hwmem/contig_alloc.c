@@ -12,7 +12,9 @@
 #include <linux/kernel.h>
 #include <linux/err.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
+#include <linux/hrtimer.h>
 #include <linux/mm.h>
 #include <linux/debugfs.h>
 #include <linux/uaccess.h>
@@ -24,6 +26,8 @@
 
 struct alloc {
 	struct list_head list;
+	/* Entry in instance->free_tree while not in use */
+	struct rb_node free_node;
 
 	bool in_use;
 	phys_addr_t paddr;
@@ -39,7 +43,10 @@ struct instance {
 	void *region_kaddr;
 	size_t region_size;
 
+	/* All allocs, free or not, sorted on address */
 	struct list_head alloc_list;
+	/* Free allocs sorted on size, then address, for best fit lookup */
+	struct rb_root free_tree;
 
 #ifdef CONFIG_DEBUG_FS
 	struct inode *debugfs_inode;
@@ -48,7 +55,15 @@ struct instance {
 	int cona_status_max_cont;
 	int cona_status_max_check;
 	int cona_status_biggest_free;
+	int cona_status_free_blocks;
 	int cona_status_printed;
+	u32 cona_status_alloc_cnt;
+	u32 cona_status_alloc_failed;
+	u64 cona_status_alloc_ns;
+	u32 cona_status_alloc_max_ns;
+	u32 cona_status_free_cnt;
+	u64 cona_status_free_ns;
+	u32 cona_status_free_max_ns;
 #endif /* #ifdef CONFIG_DEBUG_FS */
 };
 
@@ -72,6 +87,12 @@ static struct alloc *split_allocation(struct alloc *alloc,
 							size_t new_alloc_size);
 static phys_addr_t get_alloc_offset(struct instance *instance,
 							struct alloc *alloc);
+static void free_tree_insert(struct instance *instance, struct alloc *alloc);
+static void free_tree_remove(struct instance *instance, struct alloc *alloc);
+#ifdef CONFIG_DEBUG_FS
+static void update_latency_stats(ktime_t start, u32 *cnt, u64 *total_ns,
+								u32 *max_ns);
+#endif /* #ifdef CONFIG_DEBUG_FS */
 
 void *cona_create(const char *name, phys_addr_t region_paddr,
 							size_t region_size)
@@ -103,6 +124,7 @@ void *cona_create(const char *name, phys_addr_t region_paddr,
 	instance->region_kaddr = vm_area->addr;
 
 	INIT_LIST_HEAD(&instance->alloc_list);
+	instance->free_tree = RB_ROOT;
 	ret = init_alloc_list(instance);
 	if (ret < 0)
 		goto init_alloc_list_failed;
@@ -130,6 +152,9 @@ void *cona_alloc(void *instance, size_t size)
 {
 	struct instance *instance_l = (struct instance *)instance;
 	struct alloc *alloc;
+#ifdef CONFIG_DEBUG_FS
+	ktime_t start = ktime_get();
+#endif /* #ifdef CONFIG_DEBUG_FS */
 
 	if (size == 0)
 		return ERR_PTR(-EINVAL);
@@ -139,8 +164,12 @@ void *cona_alloc(void *instance, size_t size)
 	alloc = find_free_alloc_bestfit(instance_l, size);
 	if (IS_ERR(alloc))
 		goto out;
+	free_tree_remove(instance_l, alloc);
 	if (size < alloc->size) {
-		alloc = split_allocation(alloc, size);
+		struct alloc *free_part = alloc;
+
+		alloc = split_allocation(free_part, size);
+		free_tree_insert(instance_l, free_part);
 		if (IS_ERR(alloc))
 			goto out;
 	} else {
@@ -154,6 +183,13 @@ void *cona_alloc(void *instance, size_t size)
 #endif /* #ifdef CONFIG_DEBUG_FS */
 
 out:
+#ifdef CONFIG_DEBUG_FS
+	if (IS_ERR(alloc))
+		instance_l->cona_status_alloc_failed++;
+	update_latency_stats(start, &instance_l->cona_status_alloc_cnt,
+				&instance_l->cona_status_alloc_ns,
+				&instance_l->cona_status_alloc_max_ns);
+#endif /* #ifdef CONFIG_DEBUG_FS */
 	mutex_unlock(&lock);
 
 	return alloc;
@@ -164,6 +200,9 @@ void cona_free(void *instance, void *alloc)
 	struct instance *instance_l = (struct instance *)instance;
 	struct alloc *alloc_l = (struct alloc *)alloc;
 	struct alloc *other;
+#ifdef CONFIG_DEBUG_FS
+	ktime_t start = ktime_get();
+#endif /* #ifdef CONFIG_DEBUG_FS */
 
 	mutex_lock(&lock);
 
@@ -173,9 +212,11 @@ void cona_free(void *instance, void *alloc)
 	instance_l->cona_status_max_cont -= alloc_l->size;
 #endif /* #ifdef CONFIG_DEBUG_FS */
 
+	/* Coalesce with free neighbours, which leave the free tree */
 	other = list_entry(alloc_l->list.prev, struct alloc, list);
 	if ((alloc_l->list.prev != &instance_l->alloc_list) &&
 							!other->in_use) {
+		free_tree_remove(instance_l, other);
 		other->size += alloc_l->size;
 		list_del(&alloc_l->list);
 		kfree(alloc_l);
@@ -184,10 +225,18 @@ void cona_free(void *instance, void *alloc)
 	other = list_entry(alloc_l->list.next, struct alloc, list);
 	if ((alloc_l->list.next != &instance_l->alloc_list) &&
 							!other->in_use) {
+		free_tree_remove(instance_l, other);
 		alloc_l->size += other->size;
 		list_del(&other->list);
 		kfree(other);
 	}
+	free_tree_insert(instance_l, alloc_l);
+
+#ifdef CONFIG_DEBUG_FS
+	update_latency_stats(start, &instance_l->cona_status_free_cnt,
+				&instance_l->cona_status_free_ns,
+				&instance_l->cona_status_free_max_ns);
+#endif /* #ifdef CONFIG_DEBUG_FS */
 
 	mutex_unlock(&lock);
 }
@@ -239,6 +288,7 @@ static int init_alloc_list(struct instance *instance)
 								PAGE_SIZE;
 			alloc->in_use = false;
 			list_add_tail(&alloc->list, &instance->alloc_list);
+			free_tree_insert(instance, alloc);
 			curr_pos = alloc->paddr + alloc->size;
 		}
 
@@ -269,6 +319,7 @@ static int init_alloc_list(struct instance *instance)
 	alloc->size = region_end - curr_pos;
 	alloc->in_use = false;
 	list_add_tail(&alloc->list, &instance->alloc_list);
+	free_tree_insert(instance, alloc);
 
 	return 0;
 
@@ -288,27 +339,59 @@ static void clean_alloc_list(struct instance *instance)
 
 		kfree(i);
 	}
+
+	instance->free_tree = RB_ROOT;
 }
 
+/*
+ * The smallest free alloc that fits, the lowest addressed one of those if
+ * there are several.
+ */
 static struct alloc *find_free_alloc_bestfit(struct instance *instance,
 								size_t size)
 {
-	size_t best_diff = ~(size_t)0;
-	struct alloc *alloc = NULL, *i;
+	struct rb_node *node = instance->free_tree.rb_node;
+	struct alloc *alloc = NULL;
 
-	list_for_each_entry(i, &instance->alloc_list, list) {
-		size_t diff = i->size - size;
-		if (i->in_use || i->size < size)
-			continue;
-		if (diff < best_diff) {
+	while (node != NULL) {
+		struct alloc *i = rb_entry(node, struct alloc, free_node);
+
+		if (i->size >= size) {
 			alloc = i;
-			best_diff = diff;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
 		}
 	}
 
 	return alloc != NULL ? alloc : ERR_PTR(-ENOMEM);
 }
 
+static void free_tree_insert(struct instance *instance, struct alloc *alloc)
+{
+	struct rb_node **link = &instance->free_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*link != NULL) {
+		struct alloc *i = rb_entry(*link, struct alloc, free_node);
+
+		parent = *link;
+		if (alloc->size < i->size || (alloc->size == i->size &&
+						alloc->paddr < i->paddr))
+			link = &(*link)->rb_left;
+		else
+			link = &(*link)->rb_right;
+	}
+
+	rb_link_node(&alloc->free_node, parent, link);
+	rb_insert_color(&alloc->free_node, &instance->free_tree);
+}
+
+static void free_tree_remove(struct instance *instance, struct alloc *alloc)
+{
+	rb_erase(&alloc->free_node, &instance->free_tree);
+}
+
 static struct alloc *split_allocation(struct alloc *alloc,
 							size_t new_alloc_size)
 {
@@ -373,6 +456,9 @@ static int print_alloc(struct instance *instance, struct alloc *alloc,
 			}
 		}
 
+		if (i == 1 && !alloc->in_use)
+			instance->cona_status_free_blocks++;
+
 		if (!alloc->in_use) {
 			instance->cona_status_biggest_free =
 				max((size_t)alloc->size,
@@ -406,6 +492,13 @@ static int print_alloc_status(struct instance *instance, char **buf,
 {
 	int ret;
 	int i;
+	u64 alloc_avg_ns = instance->cona_status_alloc_ns;
+	u64 free_avg_ns = instance->cona_status_free_ns;
+
+	if (instance->cona_status_alloc_cnt)
+		do_div(alloc_avg_ns, instance->cona_status_alloc_cnt);
+	if (instance->cona_status_free_cnt)
+		do_div(free_avg_ns, instance->cona_status_free_cnt);
 
 	for (i = 0; i < 2; i++) {
 		size_t buf_size_l;
@@ -416,13 +509,26 @@ static int print_alloc_status(struct instance *instance, char **buf,
 
 		ret = snprintf(*buf, buf_size_l, "Overall peak usage:\t%10u "
 				"(%dMB)\nCurrent max usage:\t%10u (%dMB)\n"
-				"Current biggest free:\t%10d (%dMB)\n",
+				"Current biggest free:\t%10d (%dMB)\n"
+				"Free blocks:\t\t%10d\n"
+				"Allocs:\t\t\t%10u (%u failed)\n"
+				"Alloc latency:\t\tavg %llu ns, max %u ns\n"
+				"Frees:\t\t\t%10u\n"
+				"Free latency:\t\tavg %llu ns, max %u ns\n",
 				instance->cona_status_max_check,
 				instance->cona_status_max_check/1024/1024,
 				instance->cona_status_max_cont,
 				instance->cona_status_max_cont/1024/1024,
 				instance->cona_status_biggest_free,
-				instance->cona_status_biggest_free/1024/1024);
+				instance->cona_status_biggest_free/1024/1024,
+				instance->cona_status_free_blocks,
+				instance->cona_status_alloc_cnt,
+				instance->cona_status_alloc_failed,
+				alloc_avg_ns,
+				instance->cona_status_alloc_max_ns,
+				instance->cona_status_free_cnt,
+				free_avg_ns,
+				instance->cona_status_free_max_ns);
 
 		if (ret < 0)
 			return -ENOMSG;
@@ -435,6 +541,17 @@ static int print_alloc_status(struct instance *instance, char **buf,
 	return 0;
 }
 
+/* Caller must hold lock */
+static void update_latency_stats(ktime_t start, u32 *cnt, u64 *total_ns,
+								u32 *max_ns)
+{
+	u32 ns = (u32)ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	(*cnt)++;
+	*total_ns += ns;
+	*max_ns = max(*max_ns, ns);
+}
+
 static struct instance *get_instance_from_file(struct file *file)
 {
 	struct instance *curr_instance;
@@ -523,6 +640,7 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 		instance->cona_status_free = 0;
 		instance->cona_status_used = 0;
 		instance->cona_status_biggest_free = 0;
+		instance->cona_status_free_blocks = 0;
 	}
 
 	bytes_read = (size_t)(local_buf_pos - local_buf);
@@ -172,6 +172,44 @@ static int set_sync_domain(struct hwmem_file *hwfile,
 					(struct hwmem_region *)&req->region);
 }
 
+static int set_cpu_domain_regions(struct hwmem_file *hwfile,
+				struct hwmem_set_domain_regions_request *req)
+{
+	int ret;
+	struct hwmem_alloc *alloc;
+	struct hwmem_region *regions = NULL;
+
+	alloc = resolve_id(hwfile, req->id);
+	if (IS_ERR(alloc))
+		return PTR_ERR(alloc);
+
+	if (req->num_regions > HWMEM_MAX_DOMAIN_REGIONS)
+		return -EINVAL;
+
+	if (req->num_regions != 0) {
+		size_t regions_size = req->num_regions *
+					sizeof(struct hwmem_region_us);
+
+		regions = kmalloc(regions_size, GFP_KERNEL);
+		if (regions == NULL)
+			return -ENOMEM;
+
+		if (copy_from_user(regions, (void __user *)req->regions,
+							regions_size)) {
+			ret = -EFAULT;
+			goto out;
+		}
+	}
+
+	ret = hwmem_set_domain_regions(alloc, req->access, HWMEM_DOMAIN_CPU,
+						regions, req->num_regions);
+
+out:
+	kfree(regions);
+
+	return ret;
+}
+
 static int pin(struct hwmem_file *hwfile, struct hwmem_pin_request *req)
 {
 	int ret;
@@ -438,6 +476,16 @@ static long hwmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				ret = set_sync_domain(hwfile, &req);
 		}
 		break;
+	case HWMEM_SET_CPU_DOMAIN_REGIONS_IOC:
+		{
+			struct hwmem_set_domain_regions_request req;
+			if (copy_from_user(&req, (void __user *)arg,
+			sizeof(struct hwmem_set_domain_regions_request)))
+				ret = -EFAULT;
+			else
+				ret = set_cpu_domain_regions(hwfile, &req);
+		}
+		break;
 	case HWMEM_PIN_IOC:
 		{
 			struct hwmem_pin_request req;
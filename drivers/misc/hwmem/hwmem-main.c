@@ -312,6 +312,21 @@ int hwmem_set_domain(struct hwmem_alloc *alloc, enum hwmem_access access,
 }
 EXPORT_SYMBOL(hwmem_set_domain);
 
+int hwmem_set_domain_regions(struct hwmem_alloc *alloc,
+		enum hwmem_access access, enum hwmem_domain domain,
+		struct hwmem_region *regions, size_t num_regions)
+{
+	mutex_lock(&lock);
+
+	cach_set_domain_regions(&alloc->cach_buf, access, domain, regions,
+								num_regions);
+
+	mutex_unlock(&lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(hwmem_set_domain_regions);
+
 int hwmem_pin(struct hwmem_alloc *alloc, struct hwmem_mem_chunk *mem_chunks,
 							u32 *mem_chunks_length)
 {
@@ -589,13 +604,17 @@ static int print_alloc(struct hwmem_alloc *alloc, char **buf, size_t buf_size)
 				"\tPhysical address: %#x\n"
 				"\tKernel virtual address: %#x\n"
 				"\tCreator: %s\n"
-				"\tCreator thread group id: %u\n",
+				"\tCreator thread group id: %u\n"
+				"\t$ bytes cleaned: %llu\n"
+				"\t$ bytes invalidated: %llu\n",
 			(unsigned int)alloc, alloc->size, alloc->mem_type->id,
 			alloc->name, atomic_read(&alloc->ref_cnt),
 			alloc->flags, alloc->cach_buf.cache_settings,
 			alloc->default_access, alloc->paddr,
 			(unsigned int)alloc->kaddr, creator,
-			alloc->creator_tgid);
+			alloc->creator_tgid,
+			alloc->cach_buf.bytes_cleaned,
+			alloc->cach_buf.bytes_invalidated);
 		if (ret < 0)
 			return -ENOMSG;
 		else if (ret + 1 > buf_size)
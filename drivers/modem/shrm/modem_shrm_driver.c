@@ -185,6 +185,19 @@ static void rx_common_l2msg_handler(u8 l2_header,
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
 }
 
+/**
+ * rx_isi_skb_handler() - ISI receive handler for the net interface
+ * @skb:		socket buffer holding the message
+ * @shrm:		pointer to shrm device information structure
+ *
+ * Called instead of rx_common_l2msg_handler() for ISI messages while the
+ * net interface is up. The message was read from the FIFO into @skb.
+ */
+static void rx_isi_skb_handler(struct sk_buff *skb, struct shrm_dev *shrm)
+{
+	shrm_net_receive_skb(shrm->ndev, skb);
+}
+
 /**
  * rx_audio_l2msg_handler() - audio channel receive handler
  * @l2_header:		L2 header
@@ -212,6 +225,7 @@ static int __init shm_initialise_irq(struct shrm_dev *shrm)
 {
 	int err = 0;
 
+	shrm_protocol_set_skb_handler(rx_isi_skb_handler);
 	err  = shrm_protocol_init(shrm,
 			rx_common_l2msg_handler, rx_audio_l2msg_handler);
 	if (err < 0) {
@@ -151,40 +151,29 @@ void write_boot_info_resp(struct shrm_dev *shrm, u32 config,
 	spin_unlock_bh(&fifo->fifo_update_lock);
 }
 
-/**
- * shm_write_msg_to_fifo() - write message to FIFO
- * @shrm:	pointer to shrm device information structure
- * @channel:	audio or common channel
- * @l2header:	L2 header or device ID
- * @addr:	pointer to write buffer address
- * @length:	length of mst to write
- *
- * Function Which Writes the data into Fifo in IPC zone
- * It is called from shm_write_msg. This function will copy the msg
- * from the kernel buffer to FIFO. There are 4 kernel buffers from where
- * the data is to copied to FIFO one for each of the messages ISI, RPC,
- * AUDIO and SECURITY. ISI, RPC and SECURITY messages are pushed to FIFO
- * in commmon channel and AUDIO message is pushed onto audio channel FIFO.
- */
-int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
-				u8 l2header, void *addr, u32 length)
+static struct fifo_write_params *get_write_fifo(struct shrm_dev *shrm,
+								u8 channel)
+{
+	if (channel == COMMON_CHANNEL)
+		return &ape_shm_fifo_0;
+	else if (channel == AUDIO_CHANNEL)
+		return &ape_shm_fifo_1;
+
+	dev_err(shrm->dev, "invalid channel\n");
+	return NULL;
+}
+
+/* Writes one message, called with fifo->fifo_update_lock held */
+static int write_msg_to_fifo(struct shrm_dev *shrm,
+		struct fifo_write_params *fifo, u8 channel,
+		u8 l2header, void *addr, u32 length)
 {
-	struct fifo_write_params *fifo = NULL;
 	u32 l1_header = 0, l2_header = 0;
 	u32 requiredsize;
 	u32 size = 0;
 	u32 *msg;
 	u8 *src;
 
-	if (channel == COMMON_CHANNEL)
-		fifo = &ape_shm_fifo_0;
-	else if (channel == AUDIO_CHANNEL)
-		fifo = &ape_shm_fifo_1;
-	else {
-		dev_err(shrm->dev, "invalid channel\n");
-		return -EINVAL;
-	}
-
 	/* L2 size in 32b */
 	requiredsize = ((length + 3) / 4);
 	/* Add size of L1 & L2 header */
@@ -241,7 +230,6 @@ int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
 	 */
 	l2_header = ((l2header << L2_HEADER_OFFSET) |
 					((length) & MASK_0_39_BIT));
-	spin_lock_bh(&fifo->fifo_update_lock);
 	/* Check Local Rptr is less than or equal to Local WPtr */
 	if (fifo->writer_local_rptr <= fifo->writer_local_wptr) {
 		msg = (u32 *)
@@ -369,10 +357,75 @@ int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
 		fifo->availablesize -= requiredsize;
 
 	}
-	spin_unlock_bh(&fifo->fifo_update_lock);
 	return length;
 }
 
+/**
+ * shm_write_msg_to_fifo() - write message to FIFO
+ * @shrm:	pointer to shrm device information structure
+ * @channel:	audio or common channel
+ * @l2header:	L2 header or device ID
+ * @addr:	pointer to write buffer address
+ * @length:	length of mst to write
+ *
+ * Function Which Writes the data into Fifo in IPC zone
+ * It is called from shm_write_msg. This function will copy the msg
+ * from the kernel buffer to FIFO. There are 4 kernel buffers from where
+ * the data is to copied to FIFO one for each of the messages ISI, RPC,
+ * AUDIO and SECURITY. ISI, RPC and SECURITY messages are pushed to FIFO
+ * in commmon channel and AUDIO message is pushed onto audio channel FIFO.
+ */
+int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
+				u8 l2header, void *addr, u32 length)
+{
+	struct fifo_write_params *fifo = get_write_fifo(shrm, channel);
+	int ret;
+
+	if (!fifo)
+		return -EINVAL;
+
+	spin_lock_bh(&fifo->fifo_update_lock);
+	ret = write_msg_to_fifo(shrm, fifo, channel, l2header, addr, length);
+	spin_unlock_bh(&fifo->fifo_update_lock);
+	return ret;
+}
+
+/**
+ * shm_write_msgv_to_fifo() - write several messages to FIFO
+ * @shrm:	pointer to shrm device information structure
+ * @channel:	audio or common channel
+ * @l2header:	L2 header or device ID
+ * @vec:	messages to write
+ * @count:	number of messages in @vec
+ * @was_empty:	set if the modem had read all earlier messages
+ *
+ * Writes as many of the messages as fit in the FIFO while holding the
+ * FIFO lock once. Each message keeps its own L1 and L2 header. Returns
+ * the number of messages written or -EAGAIN if the FIFO is full.
+ */
+int shm_write_msgv_to_fifo(struct shrm_dev *shrm, u8 channel,
+		u8 l2header, struct kvec *vec, int count, bool *was_empty)
+{
+	struct fifo_write_params *fifo = get_write_fifo(shrm, channel);
+	int ret = 0;
+	int i;
+
+	if (!fifo)
+		return -EINVAL;
+
+	spin_lock_bh(&fifo->fifo_update_lock);
+	*was_empty = fifo->writer_local_rptr == fifo->writer_local_wptr;
+	for (i = 0; i < count; i++) {
+		ret = write_msg_to_fifo(shrm, fifo, channel, l2header,
+					vec[i].iov_base, vec[i].iov_len);
+		if (ret < 0)
+			break;
+	}
+	spin_unlock_bh(&fifo->fifo_update_lock);
+
+	return i ? i : ret;
+}
+
 /**
  * read_one_l2msg_common() - read message from common channel
  * @shrm:	pointer to shrm device information structure
@@ -476,6 +529,30 @@ u8 read_one_l2msg_common(struct shrm_dev *shrm,
 	return (l2_header>>L2_HEADER_OFFSET) & MASK_0_15_BIT;
  }
 
+/**
+ * peek_one_l2msg_common() - look at the next common channel message
+ * @shrm:	pointer to shrm device information structure
+ * @len:	returns the length of the message
+ *
+ * Returns the L2 header of the message at reader_local_rptr without
+ * consuming it, so that the caller can size its buffer before calling
+ * read_one_l2msg_common().
+ */
+u8 peek_one_l2msg_common(struct shrm_dev *shrm, u32 *len)
+{
+	struct fifo_read_params *fifo = &cmt_shm_fifo_0;
+	u32 l2_header;
+
+	if (fifo->reader_local_rptr == (fifo->end_addr_fifo-1))
+		l2_header = *((u32 *)fifo->fifo_virtual_addr);
+	else
+		l2_header = *(fifo->fifo_virtual_addr +
+					fifo->reader_local_rptr + 1);
+
+	*len = l2_header & MASK_0_39_BIT;
+	return (l2_header>>L2_HEADER_OFFSET) & MASK_0_15_BIT;
+}
+
 u8 read_remaining_messages_common()
 {
 	struct fifo_read_params *fifo = &cmt_shm_fifo_0;
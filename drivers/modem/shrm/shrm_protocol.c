@@ -11,6 +11,7 @@
 #include <linux/delay.h>
 #include <linux/netlink.h>
 #include <linux/workqueue.h>
+#include <linux/skbuff.h>
 #include <linux/modem/shrm/shrm.h>
 #include <linux/modem/shrm/shrm_driver.h>
 #include <linux/modem/shrm/shrm_private.h>
@@ -33,6 +34,7 @@
 #define MAX_PAYLOAD 1024
 #define MOD_STUCK_TIMEOUT	6
 #define FIFO_FULL_TIMEOUT	1
+#define RX_POLL_BUDGET		32
 #define PRCM_MOD_AWAKE_STATUS_PRCM_MOD_COREPD_AWAKE	BIT(0)
 #define PRCM_MOD_AWAKE_STATUS_PRCM_MOD_AAPD_AWAKE	BIT(1)
 #define PRCM_MOD_AWAKE_STATUS_PRCM_MOD_VMODEM_OFF_ISO	BIT(2)
@@ -44,6 +46,7 @@ static u8 recieve_common_msg[8*1024];
 static u8 recieve_audio_msg[8*1024];
 static received_msg_handler rx_common_handler;
 static received_msg_handler rx_audio_handler;
+static received_skb_handler rx_common_skb_handler;
 static struct hrtimer timer;
 static struct hrtimer mod_stuck_timer_0;
 static struct hrtimer mod_stuck_timer_1;
@@ -59,8 +62,21 @@ static atomic_t ac_sleep_disable_count = ATOMIC_INIT(0);
 static atomic_t ac_msg_pend_1 = ATOMIC_INIT(0);
 static atomic_t mod_stuck = ATOMIC_INIT(0);
 static atomic_t fifo_full = ATOMIC_INIT(0);
+static atomic_t ca_0_polling = ATOMIC_INIT(0);
 static struct shrm_dev *shm_dev;
 
+/*
+ * Common channel receive activity, counted over one second windows.
+ * The rates reported are those of the last complete window.
+ */
+static struct {
+	unsigned long window;
+	u32 notif;
+	u32 polled;
+	u32 notif_rate;
+	u32 polled_rate;
+} rx_stats;
+
 /* Spin lock and tasklet declaration */
 DECLARE_TASKLET(shm_ca_0_tasklet, shm_ca_msgpending_0_tasklet, 0);
 DECLARE_TASKLET(shm_ca_1_tasklet, shm_ca_msgpending_1_tasklet, 0);
@@ -75,6 +91,7 @@ static DEFINE_SPINLOCK(ca_wake_req_lock);
 static DEFINE_SPINLOCK(boot_lock);
 static DEFINE_SPINLOCK(mod_stuck_lock);
 static DEFINE_SPINLOCK(start_timer_lock);
+static DEFINE_SPINLOCK(rx_stats_lock);
 
 enum shrm_nl {
 	SHRM_NL_MOD_RESET = 1,
@@ -322,7 +339,103 @@ static int check_modem_in_reset2(void)
 #endif
 }
 
+/* called with rx_stats_lock held */
+static void rx_stats_roll(void)
+{
+	unsigned long now = jiffies;
+
+	if (time_before(now, rx_stats.window + HZ))
+		return;
+
+	if (time_before(now, rx_stats.window + 2 * HZ)) {
+		rx_stats.notif_rate = rx_stats.notif;
+		rx_stats.polled_rate = rx_stats.polled;
+	} else {
+		/* nothing happened during the last window */
+		rx_stats.notif_rate = 0;
+		rx_stats.polled_rate = 0;
+	}
+	rx_stats.notif = 0;
+	rx_stats.polled = 0;
+	rx_stats.window = now;
+}
+
+static void rx_stats_add(u32 notif, u32 polled)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rx_stats_lock, flags);
+	rx_stats_roll();
+	rx_stats.notif += notif;
+	rx_stats.polled += polled;
+	spin_unlock_irqrestore(&rx_stats_lock, flags);
+}
+
+static ssize_t show_ca_notif_rate(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned long flags;
+	u32 rate;
+
+	spin_lock_irqsave(&rx_stats_lock, flags);
+	rx_stats_roll();
+	rate = rx_stats.notif_rate;
+	spin_unlock_irqrestore(&rx_stats_lock, flags);
+
+	return sprintf(buf, "%u\n", rate);
+}
+
+static ssize_t show_ca_polled_rate(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned long flags;
+	u32 rate;
+
+	spin_lock_irqsave(&rx_stats_lock, flags);
+	rx_stats_roll();
+	rate = rx_stats.polled_rate;
+	spin_unlock_irqrestore(&rx_stats_lock, flags);
+
+	return sprintf(buf, "%u\n", rate);
+}
+
+static DEVICE_ATTR(ca_notif_rate, S_IRUGO, show_ca_notif_rate, NULL);
+static DEVICE_ATTR(ca_polled_rate, S_IRUGO, show_ca_polled_rate, NULL);
+
+/*
+ * Leave polling mode, called with ca_common_lock held. A notification
+ * raised after the clear stays latched and fires once unmasked, so
+ * only the messages that arrived before it need to be looked for here.
+ * Returns false if there is more to read and polling continues.
+ */
+static bool ca_0_poll_complete(struct shrm_dev *shrm)
+{
+	u32 reader_local_rptr;
+	u32 reader_local_wptr;
+	u32 shared_rptr;
+
+	if (!check_modem_in_reset() && boot_state == BOOT_DONE) {
+		writel((1 << GOP_COMMON_CA_MSG_PENDING_NOTIFICATION_BIT),
+				shrm->intr_base + GOP_CLEAR_REGISTER_BASE);
+		update_ca_common_local_wptr(shrm);
+		get_reader_pointers(COMMON_CHANNEL, &reader_local_rptr,
+				&reader_local_wptr, &shared_rptr);
+		if (reader_local_rptr != reader_local_wptr ||
+				reader_local_rptr != shared_rptr)
+			return false;
+	}
+
+	atomic_set(&ca_0_polling, 0);
+	enable_irq(shrm->ca_msg_pending_notif_0_irq);
+	return true;
+}
 
+/*
+ * Handles a common channel message pending notification. Once the
+ * channel is up the first notification masks the interrupt and this
+ * tasklet keeps rescheduling itself, reading at most RX_POLL_BUDGET
+ * messages per run, until the FIFO is found empty.
+ */
 void shm_ca_msgpending_0_tasklet(unsigned long tasklet_data)
 {
 	struct shrm_dev *shrm = (struct shrm_dev *)tasklet_data;
@@ -331,12 +444,19 @@ void shm_ca_msgpending_0_tasklet(unsigned long tasklet_data)
 	u32 shared_rptr;
 	u32 config = 0, version = 0;
 	unsigned long flags;
+	int count = 0;
 
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
 
 	/* Interprocess locking */
 	spin_lock(&ca_common_lock);
 
+	if (atomic_read(&ca_0_polling) && check_modem_in_reset()) {
+		ca_0_poll_complete(shrm);
+		spin_unlock(&ca_common_lock);
+		return;
+	}
+
 	/* Update_reader_local_wptr with shared_wptr */
 	update_ca_common_local_wptr(shrm);
 	get_reader_pointers(COMMON_CHANNEL, &reader_local_rptr,
@@ -350,11 +470,19 @@ void shm_ca_msgpending_0_tasklet(unsigned long tasklet_data)
 		if (reader_local_rptr != shared_rptr)
 			ca_msg_read_notification_0(shrm);
 		if (reader_local_rptr != reader_local_wptr)
-			receive_messages_common(shrm);
+			count = receive_messages_common(shrm,
+							RX_POLL_BUDGET);
 		get_reader_pointers(COMMON_CHANNEL, &reader_local_rptr,
 				&reader_local_wptr, &shared_rptr);
 		if (reader_local_rptr == reader_local_wptr)
 			shrm_common_rx_state = SHRM_IDLE;
+
+		if (atomic_read(&ca_0_polling)) {
+			rx_stats_add(0, count);
+			if (reader_local_rptr != reader_local_wptr ||
+					!ca_0_poll_complete(shrm))
+				tasklet_schedule(&shm_ca_0_tasklet);
+		}
 	} else {
 		/* BOOT phase.only a BOOT_RESP should be in FIFO */
 		if (boot_state != BOOT_INFO_SYNC) {
@@ -384,6 +512,8 @@ void shm_ca_msgpending_0_tasklet(unsigned long tasklet_data)
 				"BOOT_INFO_SYNC\n");
 		}
 	}
+	if (atomic_read(&ca_0_polling) && boot_state != BOOT_DONE)
+		ca_0_poll_complete(shrm);
 	/* Interprocess locking */
 	spin_unlock(&ca_common_lock);
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
@@ -995,6 +1125,10 @@ int shrm_protocol_init(struct shrm_dev *shrm,
 		goto drop;
 	}
 #endif
+	if (device_create_file(shrm->dev, &dev_attr_ca_notif_rate) ||
+		device_create_file(shrm->dev, &dev_attr_ca_polled_rate))
+		dev_warn(shrm->dev, "failed to create rx rate attributes\n");
+
 	return 0;
 
 #ifdef CONFIG_U8500_SHRM_MODEM_SILENT_RESET
@@ -1020,8 +1154,23 @@ free_wq1:
 	return err;
 }
 
+/**
+ * shrm_protocol_set_skb_handler() - set the ISI skb receive handler
+ * @handler:	called with an skb holding one ISI message
+ *
+ * Lets the net interface receive ISI messages without going through the
+ * common channel handler and its message queue. Set it before the
+ * protocol is initialised.
+ */
+void shrm_protocol_set_skb_handler(received_skb_handler handler)
+{
+	rx_common_skb_handler = handler;
+}
+
 void shrm_protocol_deinit(struct shrm_dev *shrm)
 {
+	device_remove_file(shrm->dev, &dev_attr_ca_polled_rate);
+	device_remove_file(shrm->dev, &dev_attr_ca_notif_rate);
 	free_irq(IRQ_PRCMU_CA_SLEEP, NULL);
 	free_irq(IRQ_PRCMU_CA_WAKE, NULL);
 	free_irq(IRQ_PRCMU_MODEM_SW_RESET_REQ, NULL);
@@ -1183,6 +1332,10 @@ irqreturn_t ca_msg_pending_notif_0_irq_handler(int irq, void *ctrlr)
 		return IRQ_NONE;
 	}
 
+	rx_stats_add(1, 0);
+	/* switch to polling until the FIFO has been drained */
+	if (boot_state == BOOT_DONE && !atomic_xchg(&ca_0_polling, 1))
+		disable_irq_nosync(irq);
 	tasklet_schedule(&shm_ca_0_tasklet);
 
 	local_irq_save(flags);
@@ -1257,6 +1410,58 @@ irqreturn_t ca_msg_pending_notif_1_irq_handler(int irq, void *ctrlr)
 
 }
 
+static int get_tx_channel(u8 l2_header)
+{
+	if ((l2_header == L2_HEADER_ISI) ||
+			(l2_header == L2_HEADER_RPC) ||
+			(l2_header == L2_HEADER_SECURITY) ||
+			(l2_header == L2_HEADER_COMMON_SIMPLE_LOOPBACK) ||
+			(l2_header == L2_HEADER_COMMON_ADVANCED_LOOPBACK) ||
+			(l2_header == L2_HEADER_CIQ)) {
+		if (shrm_common_tx_state == SHRM_SLEEP_STATE)
+			shrm_common_tx_state = SHRM_PTR_FREE;
+		else if (shrm_common_tx_state == SHRM_IDLE)
+			shrm_common_tx_state = SHRM_PTR_FREE;
+
+		return COMMON_CHANNEL;
+	} else if ((l2_header == L2_HEADER_AUDIO) ||
+			(l2_header == L2_HEADER_AUDIO_SIMPLE_LOOPBACK) ||
+			(l2_header == L2_HEADER_AUDIO_ADVANCED_LOOPBACK)) {
+		if (shrm_audio_tx_state == SHRM_SLEEP_STATE)
+			shrm_audio_tx_state = SHRM_PTR_FREE;
+		else if (shrm_audio_tx_state == SHRM_IDLE)
+			shrm_audio_tx_state = SHRM_PTR_FREE;
+
+		return AUDIO_CHANNEL;
+	}
+	return -ENODEV;
+}
+
+static void handle_fifo_write_error(struct shrm_dev *shrm, int ret)
+{
+	dev_err(shrm->dev, "write message to fifo failed\n");
+	if (ret == -EAGAIN) {
+		if (!atomic_read(&fifo_full)) {
+			/* Start a timer so as to handle this gently */
+			atomic_set(&fifo_full, 1);
+			hrtimer_start(&fifo_full_timer, ktime_set(
+					FIFO_FULL_TIMEOUT, 0),
+					HRTIMER_MODE_REL);
+		}
+	}
+}
+
+static void notify_msg_pending(struct shrm_dev *shrm, u8 channel)
+{
+	/* Send Message Pending Noitication to CMT */
+	if (channel == COMMON_CHANNEL)
+		queue_work(shrm->shm_common_ch_wr_wq,
+				&shrm->send_ac_msg_pend_notify_0);
+	else
+		queue_work(shrm->shm_audio_ch_wr_wq,
+				&shrm->send_ac_msg_pend_notify_1);
+}
+
 /**
  * shm_write_msg() - write message to shared memory
  * @shrm:	pointer to the shrm device information structure
@@ -1273,7 +1478,7 @@ irqreturn_t ca_msg_pending_notif_1_irq_handler(int irq, void *ctrlr)
 int shm_write_msg(struct shrm_dev *shrm, u8 l2_header,
 					void *addr, u32 length)
 {
-	u8 channel = 0;
+	int channel;
 	int ret;
 
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
@@ -1282,69 +1487,74 @@ int shm_write_msg(struct shrm_dev *shrm, u8 l2_header,
 		dev_err(shrm->dev,
 			"error:after boot done  call this fn, L2Header = %d\n",
 			l2_header);
-		ret = -ENODEV;
-		goto out;
+		return -ENODEV;
 	}
 
-	if ((l2_header == L2_HEADER_ISI) ||
-			(l2_header == L2_HEADER_RPC) ||
-			(l2_header == L2_HEADER_SECURITY) ||
-			(l2_header == L2_HEADER_COMMON_SIMPLE_LOOPBACK) ||
-			(l2_header == L2_HEADER_COMMON_ADVANCED_LOOPBACK) ||
-			(l2_header == L2_HEADER_CIQ)) {
-		channel = 0;
-		if (shrm_common_tx_state == SHRM_SLEEP_STATE)
-			shrm_common_tx_state = SHRM_PTR_FREE;
-		else if (shrm_common_tx_state == SHRM_IDLE)
-			shrm_common_tx_state = SHRM_PTR_FREE;
+	channel = get_tx_channel(l2_header);
+	if (channel < 0)
+		return channel;
 
-	} else if ((l2_header == L2_HEADER_AUDIO) ||
-			(l2_header == L2_HEADER_AUDIO_SIMPLE_LOOPBACK) ||
-			(l2_header == L2_HEADER_AUDIO_ADVANCED_LOOPBACK)) {
-		if (shrm_audio_tx_state == SHRM_SLEEP_STATE)
-			shrm_audio_tx_state = SHRM_PTR_FREE;
-		else if (shrm_audio_tx_state == SHRM_IDLE)
-			shrm_audio_tx_state = SHRM_PTR_FREE;
-
-		channel = 1;
-	} else {
-		ret = -ENODEV;
-		goto out;
-	}
 	ret = shm_write_msg_to_fifo(shrm, channel, l2_header, addr, length);
 	if (ret < 0) {
-		dev_err(shrm->dev, "write message to fifo failed\n");
-		if (ret == -EAGAIN) {
-			if (!atomic_read(&fifo_full)) {
-				/* Start a timer so as to handle this gently */
-				atomic_set(&fifo_full, 1);
-				hrtimer_start(&fifo_full_timer, ktime_set(
-						FIFO_FULL_TIMEOUT, 0),
-						HRTIMER_MODE_REL);
-			}
-		}
+		handle_fifo_write_error(shrm, ret);
 		return ret;
 	}
 	/*
 	 * notify only if new msg copied is the only unread one
 	 * otherwise it means that reading process is ongoing
 	 */
-	if (is_the_only_one_unread_message(shrm, channel, length)) {
+	if (is_the_only_one_unread_message(shrm, channel, length))
+		notify_msg_pending(shrm, channel);
 
-		/* Send Message Pending Noitication to CMT */
-		if (channel == 0)
-			queue_work(shrm->shm_common_ch_wr_wq,
-					&shrm->send_ac_msg_pend_notify_0);
-		else
-			queue_work(shrm->shm_audio_ch_wr_wq,
-					&shrm->send_ac_msg_pend_notify_1);
+	dev_dbg(shrm->dev, "%s OUT\n", __func__);
+	return 0;
+}
 
+/**
+ * shm_write_msgv() - write several messages to shared memory
+ * @shrm:	pointer to the shrm device information structure
+ * @l2_header:	L2 header shared by all the messages
+ * @vec:	messages to be written
+ * @count:	number of messages in @vec
+ *
+ * Same as shm_write_msg() but copies a batch of messages into the FIFO
+ * under a single FIFO lock and raises at most one message pending
+ * notification for the whole batch. The modem drains every message up
+ * to the write pointer on that notification. Returns the number of
+ * messages written, which can be less than @count if the FIFO filled
+ * up, or a negative error code if none could be written.
+ */
+int shm_write_msgv(struct shrm_dev *shrm, u8 l2_header,
+				struct kvec *vec, int count)
+{
+	bool was_empty;
+	int channel;
+	int ret;
+
+	if (boot_state != BOOT_DONE) {
+		dev_err(shrm->dev,
+			"error:after boot done  call this fn, L2Header = %d\n",
+			l2_header);
+		return -ENODEV;
 	}
 
-	dev_dbg(shrm->dev, "%s OUT\n", __func__);
-	return 0;
+	if (count <= 0)
+		return 0;
+
+	channel = get_tx_channel(l2_header);
+	if (channel < 0)
+		return channel;
+
+	ret = shm_write_msgv_to_fifo(shrm, channel, l2_header, vec, count,
+								&was_empty);
+	if (ret < 0) {
+		handle_fifo_write_error(shrm, ret);
+		return ret;
+	}
+	/* the modem is still reading otherwise and will see the batch */
+	if (was_empty)
+		notify_msg_pending(shrm, channel);
 
-out:
 	return ret;
 }
 
@@ -1425,54 +1635,74 @@ void ca_msg_read_notification_1(struct shrm_dev *shrm)
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
 }
 
+/*
+ * ISI messages are copied from the FIFO straight into a freshly
+ * allocated skb when the phonet interface is up, the rest goes
+ * through the common bounce buffer to the registered handler.
+ */
+static void receive_one_msg_common(struct shrm_dev *shrm)
+{
+	struct sk_buff *skb;
+	u8 l2_header;
+	u32 len;
+
+	if (rx_common_skb_handler && shrm->netdev_flag_up &&
+			peek_one_l2msg_common(shrm, &len) == L2_HEADER_ISI) {
+		skb = dev_alloc_skb(len);
+		if (skb) {
+			read_one_l2msg_common(shrm, skb_put(skb, len), &len);
+			(*rx_common_skb_handler)(skb, shrm);
+			return;
+		}
+	}
+
+	l2_header = read_one_l2msg_common(shrm, recieve_common_msg, &len);
+	(*rx_common_handler)(l2_header, &recieve_common_msg, len, shrm);
+}
+
 /**
  * receive_messages_common - receive common channnel msg from
  * CMT(Cellular Mobile Terminal)
  * @shrm:	pointer to shrm device information structure
+ * @budget:	maximum number of messages to read
  *
  * The messages sent from CMT to APE are written to the respective FIFO
  * and an interrupt is triggered by the CMT. This ca message pending
  * interrupt calls this function. This function sends a read notification
  * acknowledgement to the CMT and calls the common channel receive handler
  * where the messsage is copied to the respective(ISI, RPC, SECURIT) queue
- * based on the message l2 header.
+ * based on the message l2 header. Returns the number of messages read.
  */
-void receive_messages_common(struct shrm_dev *shrm)
+int receive_messages_common(struct shrm_dev *shrm, int budget)
 {
-	u8 l2_header;
-	u32 len;
+	int count = 1;
 
 	if (check_modem_in_reset()) {
 		dev_err(shrm->dev, "%s:Modem state reset or unknown.\n",
 				__func__);
-		return;
+		return 0;
 	}
 
-	l2_header = read_one_l2msg_common(shrm, recieve_common_msg, &len);
 	/* Send Recieve_Call_back to Upper Layer */
 	if (!rx_common_handler) {
 		dev_err(shrm->dev, "common_rx_handler is Null\n");
 		BUG();
 	}
-	(*rx_common_handler)(l2_header, &recieve_common_msg, len,
-					shrm);
+	receive_one_msg_common(shrm);
 	/* SendReadNotification */
 	ca_msg_read_notification_0(shrm);
 
-	while (read_remaining_messages_common()) {
+	while (count < budget && read_remaining_messages_common()) {
 		if (check_modem_in_reset()) {
 			dev_err(shrm->dev, "%s:Modem state reset or unknown.\n",
 					__func__);
-			return;
+			return count;
 		}
 
-		l2_header = read_one_l2msg_common(shrm, recieve_common_msg,
-								&len);
-		/* Send Recieve_Call_back to Upper Layer */
-		(*rx_common_handler)(l2_header,
-					&recieve_common_msg, len,
-					shrm);
+		receive_one_msg_common(shrm);
+		count++;
 	}
+	return count;
 }
 
 /**
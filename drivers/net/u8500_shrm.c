@@ -107,6 +107,33 @@ out:
 	return -ENOMEM;
 }
 
+/**
+ * shrm_net_receive_skb() - pass an ISI message read from the FIFO up
+ * @dev:	pointer to the network device structure
+ * @skb:	socket buffer holding the message
+ *
+ * Used when the message has been read from the FIFO directly into @skb,
+ * bypassing the ISI queue. Takes ownership of @skb.
+ */
+int shrm_net_receive_skb(struct net_device *dev, struct sk_buff *skb)
+{
+	unsigned int len = skb->len;
+
+	skb_reset_mac_header(skb);
+	__skb_pull(skb, dev->hard_header_len);
+	skb->dev = dev;
+	skb->protocol = htons(ETH_P_PHONET);
+	skb->priority = 0;
+	skb->ip_summed = CHECKSUM_UNNECESSARY; /* don't check it */
+	if (likely(netif_rx(skb) == NET_RX_SUCCESS)) {
+		dev->stats.rx_packets++;
+		dev->stats.rx_bytes += len;
+	} else
+		dev->stats.rx_dropped++;
+
+	return len;
+}
+
 static int netdev_isa_open(struct net_device *dev)
 {
 	struct shrm_net_iface_priv *net_iface_priv =
@@ -129,6 +156,8 @@ static int netdev_isa_close(struct net_device *dev)
 	shrm->netdev_flag_up = 0;
 	netif_stop_queue(dev);
 	netif_carrier_off(dev);
+	tasklet_kill(&net_iface_priv->tx_tasklet);
+	skb_queue_purge(&net_iface_priv->tx_queue);
 	return 0;
 }
 
@@ -149,21 +178,86 @@ static struct net_device_stats *netdev_isa_stats(struct net_device *dev)
 	return &dev->stats;
 }
 
+/**
+ * shrm_net_tx_tasklet() - write queued ISI messages to the FIFO
+ * @data:	pointer to the network device structure
+ *
+ * Hands up to SHRM_TX_BATCH messages at a time to shm_write_msgv() so
+ * that a burst costs one FIFO lock and one message pending notification
+ * instead of one per message. Whatever does not fit in the FIFO goes
+ * back to the head of the queue and is retried from
+ * shrm_restart_netdev() once the modem has caught up.
+ */
+static void shrm_net_tx_tasklet(unsigned long data)
+{
+	struct net_device *dev = (struct net_device *)data;
+	struct shrm_net_iface_priv *net_iface_priv =
+			(struct shrm_net_iface_priv *)netdev_priv(dev);
+	struct shrm_dev *shrm = net_iface_priv->shrm_device;
+	struct sk_buff *skbs[SHRM_TX_BATCH];
+	struct kvec vec[SHRM_TX_BATCH];
+	struct sk_buff *skb;
+	int count, ret, i;
+
+	for (;;) {
+		count = 0;
+		while (count < SHRM_TX_BATCH) {
+			skb = skb_dequeue(&net_iface_priv->tx_queue);
+			if (!skb)
+				break;
+			skbs[count] = skb;
+			vec[count].iov_base = skb->data;
+			vec[count].iov_len = skb->len;
+			count++;
+		}
+		if (!count)
+			break;
+
+		spin_lock_bh(&shrm->isa_context->common_tx);
+		ret = shm_write_msgv(shrm, ISI_MESSAGING, vec, count);
+		spin_unlock_bh(&shrm->isa_context->common_tx);
+
+		if (ret < 0 && ret != -EAGAIN) {
+			for (i = 0; i < count; i++) {
+				dev->stats.tx_dropped++;
+				dev_kfree_skb(skbs[i]);
+			}
+			continue;
+		}
+		if (ret < 0)
+			ret = 0;
+
+		for (i = 0; i < ret; i++) {
+			dev->stats.tx_packets++;
+			dev->stats.tx_bytes += skbs[i]->len;
+			dev_kfree_skb(skbs[i]);
+		}
+		if (ret < count) {
+			/* FIFO full, keep the order for the retry */
+			for (i = count - 1; i >= ret; i--)
+				skb_queue_head(&net_iface_priv->tx_queue,
+								skbs[i]);
+			netif_stop_queue(dev);
+			return;
+		}
+	}
+
+	if (netif_queue_stopped(dev) && shrm->netdev_flag_up)
+		netif_wake_queue(dev);
+}
+
 /**
  * netdev_isa_write() - write through the net interface
  * @skb:	pointer to the socket buffer
  * @dev:	pointer to the network device structure
  *
- * Copies data(ISI message) from the user buffer to the kernel buffer and
- * schedule transfer thread to transmit the message to the modem via FIFO.
+ * Queues the ISI message and schedules the tx tasklet which writes the
+ * queued messages to the modem FIFO in batches.
  */
 static netdev_tx_t netdev_isa_write(struct sk_buff *skb, struct net_device *dev)
 {
-	int err;
-	int retval = 0;
 	struct shrm_net_iface_priv *net_iface_priv =
 			(struct shrm_net_iface_priv *)netdev_priv(dev);
-	struct shrm_dev *shrm = net_iface_priv->shrm_device;
 
 	/*
 	 * FIXME:
@@ -191,21 +285,12 @@ static netdev_tx_t netdev_isa_write(struct sk_buff *skb, struct net_device *dev)
 			skb->data[SRC_OBJ_INDEX] = skb->data[PIPE_HDL_INDEX];
 	}
 
-	spin_lock_bh(&shrm->isa_context->common_tx);
-	err = shm_write_msg(shrm, ISI_MESSAGING, skb->data,
-			skb->len);
-	if (!err) {
-		dev->stats.tx_packets++;
-		dev->stats.tx_bytes += skb->len;
-		retval = NETDEV_TX_OK;
-		dev_kfree_skb(skb);
-	} else {
-		dev->stats.tx_dropped++;
-		retval = NETDEV_TX_BUSY;
-	}
-	spin_unlock_bh(&shrm->isa_context->common_tx);
+	skb_queue_tail(&net_iface_priv->tx_queue, skb);
+	if (skb_queue_len(&net_iface_priv->tx_queue) >= SHRM_TX_QUEUE_MAX)
+		netif_stop_queue(dev);
+	tasklet_schedule(&net_iface_priv->tx_tasklet);
 
-	return retval;
+	return NETDEV_TX_OK;
 }
 
 static const struct net_device_ops shrm_netdev_ops = {
@@ -249,6 +334,14 @@ int shrm_register_netdev(struct shrm_dev *shrm)
 		dev_err(shrm->dev, "Failed to allocate SHRM Netdev\n");
 		return -ENOMEM;
 	}
+
+	net_iface_priv = (struct shrm_net_iface_priv *)netdev_priv(nw_device);
+	net_iface_priv->shrm_device = shrm;
+	net_iface_priv->iface_num = 0;
+	skb_queue_head_init(&net_iface_priv->tx_queue);
+	tasklet_init(&net_iface_priv->tx_tasklet, shrm_net_tx_tasklet,
+					(unsigned long)nw_device);
+
 	err = register_netdev(shrm->ndev);
 	if (err) {
 		dev_err(shrm->dev, "Err %i in reg shrm-netdev\n", err);
@@ -257,10 +350,6 @@ int shrm_register_netdev(struct shrm_dev *shrm)
 	}
 	dev_info(shrm->dev, "Registered shrm netdev\n");
 
-	net_iface_priv = (struct shrm_net_iface_priv *)netdev_priv(nw_device);
-	net_iface_priv->shrm_device = shrm;
-	net_iface_priv->iface_num = 0;
-
 	return err;
 }
 
@@ -272,7 +361,12 @@ int shrm_stop_netdev(struct net_device *dev)
 
 int shrm_restart_netdev(struct net_device *dev)
 {
-	if (netif_queue_stopped(dev))
+	struct shrm_net_iface_priv *net_iface_priv =
+			(struct shrm_net_iface_priv *)netdev_priv(dev);
+
+	if (!skb_queue_empty(&net_iface_priv->tx_queue))
+		tasklet_schedule(&net_iface_priv->tx_tasklet);
+	else if (netif_queue_stopped(dev))
 		netif_wake_queue(dev);
 	return 0;
 }
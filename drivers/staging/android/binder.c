@@ -36,7 +36,10 @@
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
+static DEFINE_MUTEX(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
 static HLIST_HEAD(binder_procs);
@@ -147,13 +150,74 @@ enum binder_stat_types {
 
 struct binder_stats {
 	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	int bc[_IOC_NR(BC_REPLY_SG) + 1];
 	int obj_created[BINDER_STAT_COUNT];
 	int obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
+/*
+ * Transaction payload sizes, bucketed by power of two starting at 64
+ * bytes. "copied" is the parcel the sender flattened itself, "gathered"
+ * is memory described by binder_buffer_objects that the driver copied
+ * straight from the sender, saving the flatten step in userspace.
+ */
+#define BINDER_TRANSFER_HIST_BUCKETS 15
+
+struct binder_transfer_stats {
+	unsigned long long copied_bytes;
+	unsigned long long gathered_bytes;
+	int copied[BINDER_TRANSFER_HIST_BUCKETS];
+	int gathered[BINDER_TRANSFER_HIST_BUCKETS];
+};
+
+static struct binder_transfer_stats binder_transfer_stats;
+
+static inline int binder_transfer_hist_bucket(size_t size)
+{
+	return min_t(int, fls(size >> 6), BINDER_TRANSFER_HIST_BUCKETS - 1);
+}
+
+static void binder_transfer_stats_add(size_t copied, size_t gathered)
+{
+	binder_transfer_stats.copied_bytes += copied;
+	binder_transfer_stats.copied[binder_transfer_hist_bucket(copied)]++;
+	if (gathered) {
+		binder_transfer_stats.gathered_bytes += gathered;
+		binder_transfer_stats.gathered[
+			binder_transfer_hist_bucket(gathered)]++;
+	}
+}
+
+/*
+ * binder_main_lock protects the node/ref graph, the work lists and the
+ * thread transaction stacks. The buffer area of each process has its own
+ * lock (proc->buffer_lock), so buffer allocation, page mapping and the
+ * copy of transaction payloads can run without holding the main lock.
+ * Lock order is binder_main_lock -> proc->buffer_lock -> mmap_sem.
+ */
+struct binder_lock_stats {
+	unsigned long acquired;
+	unsigned long contended;
+};
+
+static struct binder_lock_stats binder_main_lock_stats;
+
+static inline void binder_lock(void)
+{
+	if (!mutex_trylock(&binder_main_lock)) {
+		mutex_lock(&binder_main_lock);
+		binder_main_lock_stats.contended++;
+	}
+	binder_main_lock_stats.acquired++;
+}
+
+static inline void binder_unlock(void)
+{
+	mutex_unlock(&binder_main_lock);
+}
+
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
 	binder_stats.obj_deleted[type]++;
@@ -164,6 +228,18 @@ static inline void binder_stats_created(enum binder_stat_types type)
 	binder_stats.obj_created[type]++;
 }
 
+/* Buffer allocator counters of one process, protected by its buffer_lock */
+struct binder_alloc_stats {
+	int failed_no_vma;
+	int failed_async_space;
+	int failed_fragmented;	/* enough free space, but no hole fits */
+	int failed_no_space;
+	int failed_pages;
+	int async_buffers;
+	unsigned long pages_mapped;
+	unsigned long pages_unmapped;
+};
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -222,6 +298,8 @@ struct binder_node {
 	int internal_strong_refs;
 	int local_weak_refs;
 	int local_strong_refs;
+	/* local strong refs held by senders with the main lock dropped */
+	int tmp_refs;
 	void __user *ptr;
 	void __user *cookie;
 	unsigned has_strong_ref:1;
@@ -270,6 +348,7 @@ struct binder_buffer {
 	struct binder_node *target_node;
 	size_t data_size;
 	size_t offsets_size;
+	size_t extra_buffers_size;
 	uint8_t data[0];
 };
 
@@ -291,13 +370,18 @@ struct binder_proc {
 	struct files_struct *files;
 	struct hlist_node deferred_work_node;
 	int deferred_work;
+	int tmp_ref;
+	unsigned is_dead:1;
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex buffer_lock;
+	struct binder_lock_stats buffer_lock_stats;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
+	struct binder_alloc_stats alloc_stats;
 
 	struct page **pages;
 	size_t buffer_size;
@@ -310,6 +394,8 @@ struct binder_proc {
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
+	int local_wakeups;
+	int remote_wakeups;
 	long default_priority;
 	struct dentry *debugfs_entry;
 };
@@ -354,11 +440,46 @@ struct binder_transaction {
 	unsigned int	flags;
 	long	priority;
 	long	saved_priority;
+	int	sched_policy;
+	int	rt_priority;
+	int	saved_sched_policy;
+	int	saved_rt_priority;
 	uid_t	sender_euid;
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_free_proc(struct binder_proc *proc);
+
+static inline void binder_buffer_lock(struct binder_proc *proc)
+{
+	if (!mutex_trylock(&proc->buffer_lock)) {
+		mutex_lock(&proc->buffer_lock);
+		proc->buffer_lock_stats.contended++;
+	}
+	proc->buffer_lock_stats.acquired++;
+}
+
+static inline void binder_buffer_unlock(struct binder_proc *proc)
+{
+	mutex_unlock(&proc->buffer_lock);
+}
+
+/*
+ * A temporary reference keeps a binder_proc and its buffer area alive
+ * while the main lock is dropped. Both helpers require binder_main_lock.
+ */
+static inline void binder_proc_inc_tmpref(struct binder_proc *proc)
+{
+	proc->tmp_ref++;
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	proc->tmp_ref--;
+	if (proc->is_dead && !proc->tmp_ref)
+		binder_free_proc(proc);
+}
 
 /*
  * copied from get_unused_fd_flags
@@ -515,6 +636,93 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static inline int binder_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static void binder_set_sched(int policy, int rt_priority)
+{
+	struct sched_param param = { .sched_priority = rt_priority };
+
+	if (current->policy == policy && current->rt_priority == rt_priority)
+		return;
+	if (sched_setscheduler_nocheck(current, policy, &param))
+		binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+			     "binder: %d: failed to set policy %d prio %d\n",
+			     current->pid, policy, rt_priority);
+}
+
+/*
+ * Called when a thread picks up a synchronous transaction: run it at the
+ * caller's priority. A real-time caller lends its policy and rt priority,
+ * anyone else its nice value, bounded by the node's min_priority.
+ */
+static void binder_inherit_priority(struct binder_transaction *t,
+				    struct binder_node *target_node)
+{
+	t->saved_priority = task_nice(current);
+	t->saved_sched_policy = current->policy;
+	t->saved_rt_priority = current->rt_priority;
+
+	if (!(t->flags & TF_ONE_WAY) && binder_rt_policy(t->sched_policy) &&
+	    (!binder_rt_policy(current->policy) ||
+	     current->rt_priority < t->rt_priority)) {
+		binder_set_sched(t->sched_policy, t->rt_priority);
+		return;
+	}
+	if (t->priority < target_node->min_priority &&
+	    !(t->flags & TF_ONE_WAY))
+		binder_set_nice(t->priority);
+	else if (!(t->flags & TF_ONE_WAY) ||
+		 t->saved_priority > target_node->min_priority)
+		binder_set_nice(target_node->min_priority);
+}
+
+/* Undo binder_inherit_priority() when the reply is sent */
+static void binder_restore_priority(struct binder_transaction *t)
+{
+	binder_set_sched(t->saved_sched_policy, t->saved_rt_priority);
+	binder_set_nice(t->saved_priority);
+}
+
+/*
+ * Wake one looper thread waiting for process work. Exclusive waiters are
+ * woken in list order, so move a thread that last ran on this CPU in front
+ * of the others; the work then runs where the caller's data is cache hot.
+ */
+static void binder_wakeup_proc(struct binder_proc *proc)
+{
+	wait_queue_t *curr;
+	wait_queue_t *first_exclusive = NULL;
+	wait_queue_t *local = NULL;
+	int cpu = raw_smp_processor_id();
+	unsigned long flags;
+
+	spin_lock_irqsave(&proc->wait.lock, flags);
+	list_for_each_entry(curr, &proc->wait.task_list, task_list) {
+		struct task_struct *tsk = curr->private;
+
+		if (!(curr->flags & WQ_FLAG_EXCLUSIVE))
+			continue;
+		if (first_exclusive == NULL)
+			first_exclusive = curr;
+		if (task_cpu(tsk) == cpu) {
+			local = curr;
+			break;
+		}
+	}
+	if (local) {
+		if (local != first_exclusive)
+			list_move_tail(&local->task_list,
+				       &first_exclusive->task_list);
+		proc->local_wakeups++;
+	} else if (first_exclusive)
+		proc->remote_wakeups++;
+	__wake_up_locked(&proc->wait, TASK_INTERRUPTIBLE);
+	spin_unlock_irqrestore(&proc->wait.lock, flags);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -549,8 +757,13 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 
 		buffer_size = binder_buffer_size(proc, buffer);
 
+		/* by size, then by address to get address-ordered best fit */
 		if (new_buffer_size < buffer_size)
 			p = &parent->rb_left;
+		else if (new_buffer_size > buffer_size)
+			p = &parent->rb_right;
+		else if (new_buffer < buffer)
+			p = &parent->rb_left;
 		else
 			p = &parent->rb_right;
 	}
@@ -583,16 +796,25 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->allocated_buffers);
 }
 
-static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
-						  void __user *user_ptr)
+/*
+ * Find the allocated buffer at user_ptr and, if it has been returned to
+ * user space, take it away from user space in the same buffer_lock hold,
+ * so two BC_FREE_BUFFER commands for the same pointer cannot both free it.
+ * Returns NULL if there is no such buffer and ERR_PTR(-EPERM) if it has
+ * not been returned (or was already claimed).
+ */
+static struct binder_buffer *binder_buffer_lookup_and_claim(
+	struct binder_proc *proc, void __user *user_ptr)
 {
-	struct rb_node *n = proc->allocated_buffers.rb_node;
+	struct rb_node *n;
 	struct binder_buffer *buffer;
 	struct binder_buffer *kern_ptr;
 
 	kern_ptr = user_ptr - proc->user_buffer_offset
 		- offsetof(struct binder_buffer, data);
 
+	binder_buffer_lock(proc);
+	n = proc->allocated_buffers.rb_node;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(buffer->free);
@@ -601,21 +823,38 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 			n = n->rb_left;
 		else if (kern_ptr > buffer)
 			n = n->rb_right;
-		else
+		else {
+			if (buffer->allow_user_free)
+				buffer->allow_user_free = 0;
+			else
+				buffer = ERR_PTR(-EPERM);
+			binder_buffer_unlock(proc);
 			return buffer;
+		}
 	}
+	binder_buffer_unlock(proc);
 	return NULL;
 }
 
+/*
+ * Map or unmap the pages backing [start, end) of the buffer area. All pages
+ * of the range are allocated first and then mapped into the kernel with a
+ * single map_vm_area() call, and the whole range is unmapped with one zap
+ * and one kernel unmap, so a large buffer costs one page table update and
+ * one cache flush instead of one per page.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
 {
-	void *page_addr;
-	unsigned long user_page_addr;
+	unsigned long user_start;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct page **pages;
+	struct page **page_array_ptr;
 	struct mm_struct *mm;
+	int nr_pages;
+	int i = 0;
+	int ret;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -624,6 +863,10 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	pages = &proc->pages[(start - proc->buffer) / PAGE_SIZE];
+	nr_pages = (end - start) / PAGE_SIZE;
+	user_start = (uintptr_t)start + proc->user_buffer_offset;
+
 	if (vma)
 		mm = NULL;
 	else
@@ -643,39 +886,39 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		goto err_no_vma;
 	}
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+	for (i = 0; i < nr_pages; i++) {
+		BUG_ON(pages[i]);
+		pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (pages[i] == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
+			       "for page at %p\n", proc->pid,
+			       start + i * PAGE_SIZE);
 			goto err_alloc_page_failed;
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
-		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
-			goto err_map_kernel_failed;
-		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+	}
+
+	tmp_area.addr = start;
+	tmp_area.size = end - start + PAGE_SIZE /* guard page? */;
+	page_array_ptr = pages;
+	ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
+	if (ret) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+		       "to map pages at %p-%p in kernel\n",
+		       proc->pid, start, end);
+		goto err_map_kernel_failed;
+	}
+
+	for (i = 0; i < nr_pages; i++) {
+		ret = vm_insert_page(vma, user_start + i * PAGE_SIZE, pages[i]);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
+			       proc->pid, user_start + i * PAGE_SIZE);
 			goto err_vm_insert_page_failed;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
 	}
+	proc->alloc_stats.pages_mapped += nr_pages;
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -683,20 +926,34 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	return 0;
 
 free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+	if (vma)
+		zap_page_range(vma, user_start, end - start, NULL);
+	unmap_kernel_range((unsigned long)start, end - start);
+	for (i = 0; i < nr_pages; i++) {
+		__free_page(pages[i]);
+		pages[i] = NULL;
+	}
+	proc->alloc_stats.pages_unmapped += nr_pages;
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return 0;
+
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	if (i)
+		zap_page_range(vma, user_start, i * PAGE_SIZE, NULL);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	unmap_kernel_range((unsigned long)start, end - start);
+	i = nr_pages;
 err_alloc_page_failed:
-		;
+	while (i--) {
+		if (pages[i]) {
+			__free_page(pages[i]);
+			pages[i] = NULL;
+		}
 	}
+	proc->alloc_stats.failed_pages++;
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -705,9 +962,33 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/* Sum up the free buffers of proc; called with proc->buffer_lock held */
+static size_t binder_free_space(struct binder_proc *proc, size_t *largest,
+				int *count)
+{
+	struct rb_node *n;
+	size_t free_space = 0;
+
+	*largest = 0;
+	*count = 0;
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		struct binder_buffer *buffer = rb_entry(n,
+					struct binder_buffer, rb_node);
+		free_space += binder_buffer_size(proc, buffer);
+		(*count)++;
+	}
+	n = rb_last(&proc->free_buffers);
+	if (n)
+		*largest = binder_buffer_size(proc,
+				rb_entry(n, struct binder_buffer, rb_node));
+	return free_space;
+}
+
+static struct binder_buffer *binder_alloc_buf_locked(struct binder_proc *proc,
+						     size_t data_size,
+						     size_t offsets_size,
+						     size_t extra_buffers_size,
+						     int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -720,6 +1001,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	if (proc->vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
 		       proc->pid);
+		proc->alloc_stats.failed_no_vma++;
 		return NULL;
 	}
 
@@ -731,39 +1013,56 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 			"size %zd-%zd\n", proc->pid, data_size, offsets_size);
 		return NULL;
 	}
+	size += ALIGN(extra_buffers_size, sizeof(void *));
+	if (size < extra_buffers_size) {
+		binder_user_error("binder: %d: got transaction with invalid "
+			"extra buffers size %zd\n", proc->pid,
+			extra_buffers_size);
+		return NULL;
+	}
 
 	if (is_async &&
 	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 			     "binder: %d: binder_alloc_buf size %zd"
 			     "failed, no async space left\n", proc->pid, size);
+		proc->alloc_stats.failed_async_space++;
 		return NULL;
 	}
 
+	/*
+	 * The free tree is ordered by size and then by address, so the
+	 * leftmost buffer that fits is the smallest one, and the lowest
+	 * one among equally sized buffers. Preferring low addresses keeps
+	 * the top of the area free for large transactions.
+	 */
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
 		buffer_size = binder_buffer_size(proc, buffer);
 
-		if (size < buffer_size) {
+		if (size <= buffer_size) {
 			best_fit = n;
 			n = n->rb_left;
-		} else if (size > buffer_size)
+		} else
 			n = n->rb_right;
-		else {
-			best_fit = n;
-			break;
-		}
 	}
 	if (best_fit == NULL) {
+		size_t largest;
+		int count;
+		size_t free_space = binder_free_space(proc, &largest, &count);
+
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
-		       "no address space\n", proc->pid, size);
+		       "no address space (free %zd in %d buffers, largest "
+		       "%zd)\n", proc->pid, size, free_space, count, largest);
+		if (free_space >= size)
+			proc->alloc_stats.failed_fragmented++;
+		else
+			proc->alloc_stats.failed_no_space++;
 		return NULL;
 	}
-	if (n == NULL) {
-		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_buffer_size(proc, buffer);
-	}
+	buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
+	buffer_size = binder_buffer_size(proc, buffer);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
@@ -771,12 +1070,10 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	if (n == NULL) {
-		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
-			buffer_size = size; /* no room for other buffers */
-		else
-			buffer_size = size + sizeof(struct binder_buffer);
-	}
+	if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
+		buffer_size = size; /* no room for other buffers */
+	else
+		buffer_size = size + sizeof(struct binder_buffer);
 	end_page_addr =
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
@@ -787,6 +1084,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
+	buffer->allow_user_free = 0;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
@@ -799,8 +1097,10 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		     "%p\n", proc->pid, size, buffer);
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
+	buffer->extra_buffers_size = extra_buffers_size;
 	buffer->async_transaction = is_async;
 	if (is_async) {
+		proc->alloc_stats.async_buffers++;
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
 			     "binder: %d: binder_alloc_buf size %zd "
@@ -811,6 +1111,21 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size,
+					      size_t extra_buffers_size,
+					      int is_async)
+{
+	struct binder_buffer *buffer;
+
+	binder_buffer_lock(proc);
+	buffer = binder_alloc_buf_locked(proc, data_size, offsets_size,
+					 extra_buffers_size, is_async);
+	binder_buffer_unlock(proc);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -868,15 +1183,16 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void binder_free_buf_locked(struct binder_proc *proc,
+				   struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
 	buffer_size = binder_buffer_size(proc, buffer);
 
 	size = ALIGN(buffer->data_size, sizeof(void *)) +
-		ALIGN(buffer->offsets_size, sizeof(void *));
+		ALIGN(buffer->offsets_size, sizeof(void *)) +
+		ALIGN(buffer->extra_buffers_size, sizeof(void *));
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_free_buf %p size %zd buffer"
@@ -889,6 +1205,7 @@ static void binder_free_buf(struct binder_proc *proc,
 	BUG_ON((void *)buffer > proc->buffer + proc->buffer_size);
 
 	if (buffer->async_transaction) {
+		proc->alloc_stats.async_buffers--;
 		proc->free_async_space += size + sizeof(struct binder_buffer);
 
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -923,6 +1240,14 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	binder_buffer_lock(proc);
+	binder_free_buf_locked(proc, buffer);
+	binder_buffer_unlock(proc);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1367,6 +1692,10 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				task_close_fd(proc, fp->handle);
 			break;
 
+		case BINDER_TYPE_PTR:
+			/* lives in the extra space of this buffer */
+			break;
+
 		default:
 			printk(KERN_ERR "binder: transaction release %d bad "
 			       "object type %lx\n", debug_id, fp->type);
@@ -1375,9 +1704,64 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * Copy the memory described by the binder_buffer_objects of a buffer into
+ * its extra space and point the objects at the target's view of the copy.
+ * Called without the main lock; the buffer is not yet visible to anyone.
+ * Offsets that are out of range are skipped here and rejected later by
+ * binder_transaction().
+ */
+static int binder_gather_buffers(struct binder_proc *target_proc,
+				 struct binder_buffer *buffer,
+				 size_t *gathered)
+{
+	size_t *offp, *off_end;
+	uint8_t *sg_ptr, *sg_end;
+
+	offp = (size_t *)(buffer->data + ALIGN(buffer->data_size,
+					       sizeof(void *)));
+	off_end = (void *)offp + buffer->offsets_size;
+	sg_ptr = (uint8_t *)offp + ALIGN(buffer->offsets_size, sizeof(void *));
+	sg_end = sg_ptr + buffer->extra_buffers_size;
+	*gathered = 0;
+
+	for (; offp < off_end; offp++) {
+		struct binder_buffer_object *bp;
+
+		if (*offp > buffer->data_size - sizeof(*bp) ||
+		    buffer->data_size < sizeof(*bp) ||
+		    !IS_ALIGNED(*offp, sizeof(void *)))
+			continue;
+		bp = (struct binder_buffer_object *)(buffer->data + *offp);
+		if (bp->type != BINDER_TYPE_PTR)
+			continue;
+		if (bp->length > sg_end - sg_ptr) {
+			binder_user_error("binder: %d: buffer object of "
+				"size %zd does not fit in %zd bytes of "
+				"extra space\n", current->pid, bp->length,
+				(size_t)(sg_end - sg_ptr));
+			return -EINVAL;
+		}
+		if (copy_from_user(sg_ptr, bp->buffer, bp->length)) {
+			binder_user_error("binder: %d: got buffer object "
+				"with invalid ptr %p\n", current->pid,
+				bp->buffer);
+			return -EFAULT;
+		}
+		bp->buffer = (void __user *)sg_ptr +
+			target_proc->user_buffer_offset;
+		*gathered += bp->length;
+		sg_ptr += ALIGN(bp->length, sizeof(void *));
+		if (sg_ptr > sg_end)
+			sg_ptr = sg_end;
+	}
+	return 0;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+			       struct binder_transaction_data *tr, int reply,
+			       size_t extra_buffers_size)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
@@ -1390,6 +1774,8 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
+	int copy_failed;
+	size_t gathered;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1408,7 +1794,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_restore_priority(in_reply_to);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1481,21 +1867,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1543,33 +1916,111 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	t->sched_policy = current->policy;
+	t->rt_priority = current->rt_priority;
+	if (target_node) {
+		binder_inc_node(target_node, 1, 0, NULL);
+		target_node->tmp_refs++;
+	}
+
+	/*
+	 * Allocating the target buffer and copying the payload may sleep
+	 * (page allocation, faults on the sender's data), so it is done with
+	 * only the target's buffer lock held. The temporary references keep
+	 * target_proc, its buffer area and target_node alive until the main
+	 * lock is retaken; everything looked up before is revalidated after
+	 * that.
+	 */
+	binder_proc_inc_tmpref(target_proc);
+	binder_unlock();
+
+	offp = NULL;
+	copy_failed = 0;
+	gathered = 0;
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, extra_buffers_size,
+		!reply && (t->flags & TF_ONE_WAY));
+	if (t->buffer) {
+		t->buffer->debug_id = t->debug_id;
+		t->buffer->transaction = NULL;
+		t->buffer->target_node = target_node;
+
+		offp = (size_t *)(t->buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+
+		if (copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+				   tr->data_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data ptr\n", proc->pid, thread->pid);
+			copy_failed = 1;
+		} else if (copy_from_user(offp, tr->data.ptr.offsets,
+					  tr->offsets_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets ptr\n", proc->pid, thread->pid);
+			copy_failed = 1;
+		} else if (extra_buffers_size &&
+			   binder_gather_buffers(target_proc, t->buffer,
+						 &gathered)) {
+			copy_failed = 1;
+		}
+	}
+
+	binder_lock();
+	if (target_node)
+		target_node->tmp_refs--;
+	if (target_proc->is_dead) {
+		/* the buffer, if any, is released with target_proc */
+		binder_proc_dec_tmpref(target_proc);
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
+	}
+	binder_proc_dec_tmpref(target_proc);
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
-
-	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
-
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+	if (reply && in_reply_to->from != target_thread) {
+		return_error = BR_DEAD_REPLY;
+		goto err_copy_data_failed;
+	}
+	if (reply && target_thread->transaction_stack != in_reply_to) {
+		binder_user_error("binder: %d:%d got reply transaction "
+			"with bad target transaction stack %d, "
+			"expected %d\n",
+			proc->pid, thread->pid,
+			target_thread->transaction_stack ?
+			target_thread->transaction_stack->debug_id : 0,
+			in_reply_to->debug_id);
 		return_error = BR_FAILED_REPLY;
+		in_reply_to = NULL;
+		target_thread = NULL;
 		goto err_copy_data_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
+	if (copy_failed) {
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
+	t->buffer->transaction = t;
+
+	if (!reply && !(tr->flags & TF_ONE_WAY)) {
+		struct binder_transaction *tmp;
+
+		for (tmp = thread->transaction_stack; tmp;
+		     tmp = tmp->from_parent) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+		}
+		t->to_thread = target_thread;
+	}
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1670,6 +2121,17 @@ static void binder_transaction(struct binder_proc *proc,
 			}
 		} break;
 
+		case BINDER_TYPE_PTR:
+			/* already gathered by binder_gather_buffers() */
+			if (!extra_buffers_size) {
+				binder_user_error("binder: %d:%d got buffer "
+					"object without extra buffer space\n",
+					proc->pid, thread->pid);
+				return_error = BR_FAILED_REPLY;
+				goto err_bad_object_type;
+			}
+			break;
+
 		case BINDER_TYPE_FD: {
 			int target_fd;
 			struct file *file;
@@ -1733,11 +2195,19 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	binder_transfer_stats_add(tr->data_size + tr->offsets_size, gathered);
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
-	if (target_wait)
+	trace_binder_transaction(t->debug_id,
+				 in_reply_to ? in_reply_to->debug_id : 0,
+				 target_proc->pid,
+				 target_thread ? target_thread->pid : 0,
+				 t->code, t->flags);
+	if (target_wait == &target_proc->wait)
+		binder_wakeup_proc(target_proc);
+	else if (target_wait)
 		wake_up_interruptible(target_wait);
 	return;
 
@@ -1753,7 +2223,12 @@ err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
+	goto err_target_node_released;
 err_binder_alloc_buf_failed:
+err_dead_target:
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
+err_target_node_released:
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1934,14 +2409,14 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
-			buffer = binder_buffer_lookup(proc, data_ptr);
+			buffer = binder_buffer_lookup_and_claim(proc, data_ptr);
 			if (buffer == NULL) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
-			if (!buffer->allow_user_free) {
+			if (IS_ERR(buffer)) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
@@ -1965,7 +2440,14 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
+			/*
+			 * Unmapping the pages does not touch the node/ref
+			 * graph. The buffer was claimed above, so nobody else
+			 * can free it while the main lock is dropped.
+			 */
+			binder_unlock();
 			binder_free_buf(proc, buffer);
+			binder_lock();
 			break;
 		}
 
@@ -1976,7 +2458,19 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY, 0);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			binder_transaction(proc, thread, &tr.transaction_data,
+					   cmd == BC_REPLY_SG, tr.buffers_size);
 			break;
 		}
 
@@ -2233,7 +2727,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2257,7 +2751,7 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_lock();
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2407,13 +2901,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_inherit_priority(t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2448,6 +2936,9 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		trace_binder_transaction_received(t->debug_id, current->policy,
+						  current->rt_priority,
+						  task_nice(current));
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2599,12 +3090,12 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_lock();
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2636,7 +3127,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_lock();
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2745,7 +3236,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2885,14 +3376,15 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->buffer_lock);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	binder_lock();
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2941,12 +3433,67 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	return 0;
 }
 
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	BUG_ON(!proc->is_dead);
+	BUG_ON(proc->tmp_ref);
+
+	buffers = 0;
+	while ((n = rb_first(&proc->allocated_buffers))) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		t = buffer->transaction;
+		if (t) {
+			t->buffer = NULL;
+			buffer->transaction = NULL;
+			printk(KERN_ERR "binder: release proc %d, "
+			       "transaction %d, not freed\n",
+			       proc->pid, t->debug_id);
+			/*BUG();*/
+		}
+		binder_free_buf(proc, buffer);
+		buffers++;
+	}
+
+	page_count = 0;
+	if (proc->pages) {
+		int i;
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			if (proc->pages[i]) {
+				void *page_addr = proc->buffer + i * PAGE_SIZE;
+				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+					     "binder_release: %d: "
+					     "page %d at %p not freed\n",
+					     proc->pid, i,
+					     page_addr);
+				unmap_kernel_range((unsigned long)page_addr,
+					PAGE_SIZE);
+				__free_page(proc->pages[i]);
+				page_count++;
+			}
+		}
+		kfree(proc->pages);
+		vfree(proc->buffer);
+	}
+
+	put_task_struct(proc->tsk);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
+
+	kfree(proc);
+}
+
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
@@ -2974,7 +3521,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		nodes++;
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
-		if (hlist_empty(&node->refs)) {
+		if (hlist_empty(&node->refs) && !node->tmp_refs) {
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
@@ -2982,7 +3529,11 @@ static void binder_deferred_release(struct binder_proc *proc)
 			int death = 0;
 
 			node->proc = NULL;
-			node->local_strong_refs = 0;
+			/*
+			 * Senders still filling a buffer drop their
+			 * reference when they see the proc is dead.
+			 */
+			node->local_strong_refs = node->tmp_refs;
 			node->local_weak_refs = 0;
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
 
@@ -3012,57 +3563,23 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
-
-	while ((n = rb_first(&proc->allocated_buffers))) {
-		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
-							rb_node);
-		t = buffer->transaction;
-		if (t) {
-			t->buffer = NULL;
-			buffer->transaction = NULL;
-			printk(KERN_ERR "binder: release proc %d, "
-			       "transaction %d, not freed\n",
-			       proc->pid, t->debug_id);
-			/*BUG();*/
-		}
-		binder_free_buf(proc, buffer);
-		buffers++;
-	}
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
-	page_count = 0;
-	if (proc->pages) {
-		int i;
-		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
-				unmap_kernel_range((unsigned long)page_addr,
-					PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
-			}
-		}
-		kfree(proc->pages);
-		vfree(proc->buffer);
-	}
-
-	put_task_struct(proc->tsk);
-
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
 		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
+		     "refs %d, active transactions %d, tmp refs %d\n",
 		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     active_transactions, proc->tmp_ref);
 
-	kfree(proc);
+	/*
+	 * Senders that dropped the main lock while filling a buffer in this
+	 * process still hold a temporary reference; the last one of them
+	 * frees the buffer area and the proc.
+	 */
+	proc->is_dead = 1;
+	if (!proc->tmp_ref)
+		binder_free_proc(proc);
 }
 
 static void binder_deferred_func(struct work_struct *work)
@@ -3072,7 +3589,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		binder_lock();
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3099,7 +3616,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3280,9 +3797,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	binder_buffer_lock(proc);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	binder_buffer_unlock(proc);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3331,7 +3850,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3378,6 +3899,48 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	}
 }
 
+static void print_binder_alloc_stats(struct seq_file *m,
+				     struct binder_proc *proc)
+{
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	size_t free_space, largest;
+	int count;
+
+	free_space = binder_free_space(proc, &largest, &count);
+	seq_printf(m, "  free buffers: %d, free space %zd, largest %zd, "
+		   "fragmentation %zd%%\n", count, free_space, largest,
+		   free_space ? 100 - largest * 100 / free_space : 0);
+	seq_printf(m, "  async buffers: %d\n", stats->async_buffers);
+	seq_printf(m, "  pages mapped: %lu unmapped: %lu\n",
+		   stats->pages_mapped, stats->pages_unmapped);
+	seq_printf(m, "  alloc failures: no vma %d, async space %d, "
+		   "fragmented %d, no space %d, pages %d\n",
+		   stats->failed_no_vma, stats->failed_async_space,
+		   stats->failed_fragmented, stats->failed_no_space,
+		   stats->failed_pages);
+}
+
+static void print_binder_transfer_stats(struct seq_file *m,
+					struct binder_transfer_stats *stats)
+{
+	int i;
+
+	seq_printf(m, "copied bytes: %llu\n", stats->copied_bytes);
+	seq_printf(m, "gathered bytes: %llu\n", stats->gathered_bytes);
+	seq_puts(m, "transfer sizes:\n");
+	for (i = 0; i < BINDER_TRANSFER_HIST_BUCKETS; i++) {
+		if (!stats->copied[i] && !stats->gathered[i])
+			continue;
+		if (i == 0)
+			seq_printf(m, "  <64: copied %d gathered %d\n",
+				   stats->copied[i], stats->gathered[i]);
+		else
+			seq_printf(m, "  >=%lu: copied %d gathered %d\n",
+				   64UL << (i - 1), stats->copied[i],
+				   stats->gathered[i]);
+	}
+}
+
 static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
@@ -3395,6 +3958,8 @@ static void print_binder_proc_stats(struct seq_file *m,
 			"  free async space %zd\n", proc->requested_threads,
 			proc->requested_threads_started, proc->max_threads,
 			proc->ready_threads, proc->free_async_space);
+	seq_printf(m, "  wakeups: same cpu %d other cpu %d\n",
+		   proc->local_wakeups, proc->remote_wakeups);
 	count = 0;
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
 		count++;
@@ -3412,9 +3977,15 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	binder_buffer_lock(proc);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	print_binder_alloc_stats(m, proc);
+	binder_buffer_unlock(proc);
+	seq_printf(m, "  buffer lock: acquired %lu contended %lu\n",
+		   proc->buffer_lock_stats.acquired,
+		   proc->buffer_lock_stats.contended);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3440,7 +4011,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder state:\n");
 
@@ -3452,7 +4023,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3463,16 +4034,20 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder stats:\n");
 
+	seq_printf(m, "main lock: acquired %lu contended %lu\n",
+		   binder_main_lock_stats.acquired,
+		   binder_main_lock_stats.contended);
 	print_binder_stats(m, "", &binder_stats);
+	print_binder_transfer_stats(m, &binder_transfer_stats);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3483,13 +4058,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3499,11 +4074,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PTR		= B_PACK_CHARS('p', 't', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -61,6 +62,21 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+/*
+ * A block of sender memory that is gathered by BC_TRANSACTION_SG and
+ * BC_REPLY_SG. The driver copies the block straight into the extra space
+ * of the target buffer and rewrites 'buffer' to point at that copy, so
+ * the sender does not need to flatten it into the parcel first. It has
+ * the size of a flat_binder_object and is found through the same
+ * offsets array.
+ */
+struct binder_buffer_object {
+	unsigned long		type;
+	unsigned long		flags;
+	void			*buffer;
+	size_t			length;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
@@ -147,6 +163,12 @@ struct binder_transaction_data {
 	} data;
 };
 
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	/* space needed for all binder_buffer_objects, each pointer aligned */
+	size_t		buffers_size;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +346,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, followed by the
+	 * size of the extra buffer space used by binder_buffer_objects.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
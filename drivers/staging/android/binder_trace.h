@@ -0,0 +1,93 @@
+/* binder_trace.h
+ *
+ * Android IPC Subsystem tracepoints
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+#define TRACE_INCLUDE_FILE binder_trace
+
+/*
+ * A transaction or reply was queued for its target. For replies,
+ * reply_to is the debug id of the transaction being answered, so the
+ * end-to-end latency of a call is the time from its binder_transaction
+ * event to the binder_transaction_received event of the matching reply.
+ */
+TRACE_EVENT(binder_transaction,
+
+	TP_PROTO(int debug_id, int reply_to, int to_proc, int to_thread,
+		 unsigned int code, unsigned int flags),
+
+	TP_ARGS(debug_id, reply_to, to_proc, to_thread, code, flags),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, reply_to)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->reply_to = reply_to;
+		__entry->to_proc = to_proc;
+		__entry->to_thread = to_thread;
+		__entry->code = code;
+		__entry->flags = flags;
+	),
+
+	TP_printk("transaction=%d reply_to=%d dest_proc=%d dest_thread=%d "
+		  "code=0x%x flags=0x%x",
+		  __entry->debug_id, __entry->reply_to, __entry->to_proc,
+		  __entry->to_thread, __entry->code, __entry->flags)
+);
+
+/* A transaction or reply was handed to a thread of its target */
+TRACE_EVENT(binder_transaction_received,
+
+	TP_PROTO(int debug_id, int policy, int rt_priority, long nice),
+
+	TP_ARGS(debug_id, policy, rt_priority, nice),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, policy)
+		__field(int, rt_priority)
+		__field(long, nice)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->policy = policy;
+		__entry->rt_priority = rt_priority;
+		__entry->nice = nice;
+	),
+
+	TP_printk("transaction=%d policy=%d rt_priority=%d nice=%ld",
+		  __entry->debug_id, __entry->policy, __entry->rt_priority,
+		  __entry->nice)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
@@ -24,6 +24,7 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
 #include "logger.h"
 
@@ -34,14 +35,16 @@
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * spinlock 'lock'. Nothing that can fault or sleep runs under it: writers
+ * stage their entry before taking it and readers copy out of a bounce
+ * buffer after dropping it, so a slow reader never stalls a writer.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting buffer */
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
@@ -51,14 +54,25 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->lock; 'mutex'
+ * serializes readers sharing the file over the use of 'bounce'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	size_t			wakeup;	/* bytes pending before wakeup */
+	int			batch;	/* read as many entries as fit */
+	struct mutex		mutex;	/* mutex protecting bounce */
+	unsigned char		*bounce; /* entries on their way to user */
 };
 
+/*
+ * Entries up to this size are staged on the writer's stack; larger ones
+ * go through kmalloc. Most log lines are well below it.
+ */
+#define LOGGER_STACK_ENTRY_LEN	256
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -89,7 +103,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,15 +122,15 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - reads exactly 'count' bytes from 'log' into the kernel
+ * buffer 'buf'. Returns 'count'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static ssize_t do_read_log(struct logger_log *log,
+			   struct logger_reader *reader,
+			   unsigned char *buf,
+			   size_t count)
 {
 	size_t len;
 
@@ -126,49 +140,78 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the log, whichever comes first.
 	 */
 	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	memcpy(buf, log->buffer + reader->r_off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(buf + len, log->buffer, count - len);
 
 	reader->r_off = logger_offset(reader->r_off + count);
 
 	return count;
 }
 
+/*
+ * logger_pending - returns the number of bytes 'reader' has yet to read.
+ *
+ * Caller must hold log->lock.
+ */
+static size_t logger_pending(struct logger_log *log,
+			     struct logger_reader *reader)
+{
+	if (log->w_off >= reader->r_off)
+		return log->w_off - reader->r_off;
+	return (log->size - reader->r_off) + log->w_off;
+}
+
+/*
+ * logger_reader_ready - is there enough pending for 'reader' to be woken?
+ *
+ * Caller must hold log->lock.
+ */
+static inline int logger_reader_ready(struct logger_log *log,
+				      struct logger_reader *reader)
+{
+	return log->w_off != reader->r_off &&
+		logger_pending(log, reader) >= reader->wakeup;
+}
+
 /*
  * logger_read - our log's read() method
  *
  * Behavior:
  *
  * 	- O_NONBLOCK works
- * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- If there are no log entries to read, blocks until log is written to;
+ * 	  with a wakeup threshold set, until that many bytes are pending
+ * 	- Atomically reads exactly one log entry, or in batch mode as many
+ * 	  complete entries as fit in the buffer
  *
- * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
- * buffer is insufficient to hold next entry.
+ * Optimal read size is LOGGER_ENTRY_MAX_LEN, or a multiple of it in batch
+ * mode. Will set errno to EINVAL if read buffer is insufficient to hold
+ * next entry.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
-	ssize_t ret;
+	ssize_t ret, read = 0;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_lock(&log->lock);
+		if (file->f_flags & O_NONBLOCK)
+			ret = (log->w_off == reader->r_off);
+		else
+			ret = !logger_reader_ready(log, reader);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -189,35 +232,69 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+	spin_lock(&log->lock);
 
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
 	ret = get_entry_len(log, reader->r_off);
 	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
+		return -EINVAL;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/*
+	 * Get exactly one entry from the log, or in batch mode keep going
+	 * while whole entries fit. Entries are gathered one bounce buffer at a
+	 * time, and the copy to user space may fault, so it is done without
+	 * holding log->lock.
+	 */
+	while (1) {
+		size_t chunk = 0;
+
+		while (log->w_off != reader->r_off) {
+			size_t len = get_entry_len(log, reader->r_off);
+
+			if (read + chunk + len > count ||
+			    chunk + len > LOGGER_ENTRY_MAX_LEN)
+				break;
+			do_read_log(log, reader, reader->bounce + chunk, len);
+			chunk += len;
+			if (!reader->batch)
+				break;
+		}
+		spin_unlock(&log->lock);
 
-out:
-	mutex_unlock(&log->mutex);
+		if (!chunk)
+			break;
+		if (copy_to_user(buf + read, reader->bounce, chunk)) {
+			if (!read)
+				read = -EFAULT;
+			break;
+		}
+		read += chunk;
+		if (!reader->batch)
+			break;
 
-	return ret;
+		spin_lock(&log->lock);
+	}
+	mutex_unlock(&reader->mutex);
+
+	return read;
 }
 
 /*
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -255,7 +332,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -274,7 +351,7 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 /*
  * do_write_log - writes 'len' bytes from 'buf' to 'log'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 {
@@ -290,32 +367,6 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 }
 
-/*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
- */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
-}
-
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
@@ -325,58 +376,85 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
-	struct logger_entry header;
+	unsigned char stack_entry[LOGGER_STACK_ENTRY_LEN];
+	unsigned char *entry = stack_entry;
+	struct logger_entry *header;
+	struct logger_reader *reader;
 	struct timespec now;
+	size_t count;
 	ssize_t ret = 0;
+	int wake = 0;
 
-	now = current_kernel_time();
-
-	header.pid = current->tgid;
-	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
-	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	count = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 
 	/* null writes succeed, return zero */
-	if (unlikely(!header.len))
+	if (unlikely(!count))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	if (sizeof(struct logger_entry) + count > sizeof(stack_entry)) {
+		entry = kmalloc(sizeof(struct logger_entry) + count,
+				GFP_KERNEL);
+		if (unlikely(!entry))
+			return -ENOMEM;
+	}
+	header = (struct logger_entry *) entry;
 
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * Gather the payload before taking the lock; copying from user space
+	 * may fault, and a failed write then leaves the log untouched.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
+	while (nr_segs-- > 0 && ret < count) {
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		size_t len = min_t(size_t, iov->iov_len, count - ret);
+
+		if (unlikely(copy_from_user(header->msg + ret,
+					    iov->iov_base, len))) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_lock(&log->lock);
+
+	/*
+	 * Stamp the entry under the lock so that entries land in the log in
+	 * timestamp order, whatever order the writers got here in.
+	 */
+	now = current_kernel_time();
+
+	header->len = count;
+	header->__pad = 0;
+	header->pid = current->tgid;
+	header->tid = current->pid;
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new write offset.
+	 */
+	fix_up_readers(log, sizeof(struct logger_entry) + count);
+
+	do_write_log(log, entry, sizeof(struct logger_entry) + count);
+
+	list_for_each_entry(reader, &log->readers, list)
+		if (logger_reader_ready(log, reader)) {
+			wake = 1;
+			break;
+		}
+
+	spin_unlock(&log->lock);
+
+	/* wake up any blocked readers, once one has enough to read */
+	if (wake)
+		wake_up_interruptible(&log->wq);
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+out:
+	if (entry != stack_entry)
+		kfree(entry);
 
 	return ret;
 }
@@ -408,13 +486,22 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->bounce = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->bounce) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
+		reader->wakeup = 0;
+		reader->batch = 0;
+		mutex_init(&reader->mutex);
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -434,10 +521,11 @@ static int logger_release(struct inode *ignored, struct file *file)
 		struct logger_reader *reader = file->private_data;
 		struct logger_log *log = reader->log;
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
+		kfree(reader->bounce);
 		kfree(reader);
 	}
 
@@ -448,6 +536,9 @@ static int logger_release(struct inode *ignored, struct file *file)
  * logger_poll - the log's poll file operation, for poll/select/epoll
  *
  * Note we always return POLLOUT, because you can always write() to the log.
+ * With a wakeup threshold set, POLLIN is only reported once that many bytes
+ * are pending; poll with a timeout and read with O_NONBLOCK to collect a
+ * partial batch.
  * Note also that, strictly speaking, a return value of POLLIN does not
  * guarantee that the log is readable without blocking, as there is a small
  * chance that the writer can lap the reader in the interim between poll()
@@ -467,10 +558,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	spin_lock(&log->lock);
+	if (logger_reader_ready(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -481,7 +572,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -493,10 +584,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		ret = logger_pending(log, reader);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -519,9 +607,32 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		log->head = log->w_off;
 		ret = 0;
 		break;
+	case LOGGER_SET_READ_BATCH:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
+		ret = 0;
+		break;
+	case LOGGER_SET_WAKEUP_THRESHOLD:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		/* a writer lapping the reader must not keep it asleep forever */
+		if (arg > log->size / 2) {
+			ret = -EINVAL;
+			break;
+		}
+		reader = file->private_data;
+		reader->wakeup = arg;
+		ret = 0;
+		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -554,7 +665,7 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
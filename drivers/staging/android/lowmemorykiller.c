@@ -12,6 +12,19 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * Processes are kept in buckets by oom_adj, updated as oom_adj changes, so a
+ * victim is found by searching the highest non-empty bucket for the largest
+ * rss instead of walking every process. The time spent selecting is shown
+ * in select_us and select_max_us, and kill_count counts kills per adj level.
+ *
+ * With pressure_mode set, the minfree levels only pick the candidates; a kill
+ * also needs reclaim to be struggling: at least pressure_kill percent of the
+ * pages vmscan scanned over the last sample were not reclaimed, or at least
+ * stall_kill allocations entered direct reclaim. Before a kill user-space
+ * polling /sys/kernel/lowmemorykiller/pressure is notified, and if notify_ms
+ * is set it gets that long to trim its caches first. A new victim is only
+ * picked once the last one has been freed or death_timeout_ms has passed.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -35,6 +48,12 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -51,9 +70,45 @@ static size_t lowmem_minfree[6] = {
 	16 * 1024,	/* 64MB */
 };
 static int lowmem_minfree_size = 4;
+static uint32_t lowmem_kill_count[6];
+static int lowmem_kill_count_size = ARRAY_SIZE(lowmem_kill_count);
+static uint32_t lowmem_select_us;
+static uint32_t lowmem_select_max_us;
+
+/*
+ * Thread group leaders by oom_adj, from OOM_DISABLE up to OOM_ADJUST_MAX.
+ * A task is added when it becomes a leader and moved whenever its oom_adj
+ * changes; it stays until the task is freed, so exited leaders linger
+ * without an mm and are skipped like they were by the process walk.
+ */
+#define LOWMEM_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
 
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
+static uint32_t lowmem_death_timeout_ms = 1000;
+
+static uint32_t lowmem_pressure_mode;
+static uint32_t lowmem_pressure_kill = 60;
+static uint32_t lowmem_stall_kill = 16;
+static uint32_t lowmem_pressure;
+static uint32_t lowmem_stalls;
+static unsigned long lowmem_sample_scanned;
+static unsigned long lowmem_sample_reclaimed;
+static unsigned long lowmem_sample_stalls;
+static unsigned long lowmem_sample_time;
+static DEFINE_SPINLOCK(lowmem_sample_lock);
+
+/* how often reclaim efficiency is sampled */
+#define LOWMEM_SAMPLE_INTERVAL	(HZ / 10)
+
+static uint32_t lowmem_notify_ms;
+static int lowmem_notify_pending;
+static int lowmem_notify_adj = OOM_ADJUST_MAX + 1;
+static unsigned long lowmem_notify_deadline;
+static struct kobject *lowmem_kobj;
+static struct sysfs_dirent *lowmem_notify_sd;
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -72,13 +127,144 @@ static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
+	unsigned long flags;
 
 	if (task == lowmem_deathpending)
 		lowmem_deathpending = NULL;
 
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	list_del_init(&task->oom_adj_node);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	return NOTIFY_OK;
+}
+
+/* Caller must hold lowmem_bucket_lock */
+static void lowmem_bucket_update(struct task_struct *task)
+{
+	int oom_adj = task->signal->oom_adj;
+
+	if (oom_adj < OOM_DISABLE)
+		oom_adj = OOM_DISABLE;
+	if (oom_adj > OOM_ADJUST_MAX)
+		oom_adj = OOM_ADJUST_MAX;
+	list_move_tail(&task->oom_adj_node,
+		       &lowmem_buckets[oom_adj - OOM_DISABLE]);
+}
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+	struct task_struct *leader;
+	unsigned long flags;
+
+	/*
+	 * The caller holds a reference on task, so it may be added. Its
+	 * leader is only moved if already indexed: once the leader is freed
+	 * task_notify_func() has unlinked it under the same lock.
+	 */
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	rcu_read_lock();
+	leader = task->group_leader;
+	if (leader == task || !list_empty(&leader->oom_adj_node))
+		lowmem_bucket_update(leader);
+	rcu_read_unlock();
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
 	return NOTIFY_OK;
 }
 
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+static inline int lowmem_pressure_enabled(void)
+{
+	return lowmem_pressure_mode;
+}
+
+/* Sum the vmscan event counters over all cpus; may sleep */
+static void lowmem_vm_events(unsigned long *scanned, unsigned long *reclaimed,
+			     unsigned long *stalls)
+{
+	unsigned long events[NR_VM_EVENT_ITEMS];
+	int i;
+
+	all_vm_events(events);
+
+	*scanned = *reclaimed = 0;
+	for (i = PGREFILL_MOVABLE + 1; i <= PGSTEAL_MOVABLE; i++)
+		*reclaimed += events[i];
+	for (i = PGSTEAL_MOVABLE + 1; i <= PGSCAN_DIRECT_MOVABLE; i++)
+		*scanned += events[i];
+	*stalls = events[ALLOCSTALL];
+}
+
+/*
+ * Recompute lowmem_pressure, the percentage of scanned pages that were not
+ * reclaimed, and lowmem_stalls, the number of direct reclaim entries, over
+ * the time since the last sample. A sample covers at least
+ * LOWMEM_SAMPLE_INTERVAL and SWAP_CLUSTER_MAX scanned pages, or one second,
+ * so a handful of scans cannot swing it.
+ */
+static void lowmem_update_pressure(void)
+{
+	unsigned long scanned, reclaimed, stalls;
+
+	if (time_before(jiffies, lowmem_sample_time + LOWMEM_SAMPLE_INTERVAL))
+		return;
+
+	lowmem_vm_events(&scanned, &reclaimed, &stalls);
+
+	if (!spin_trylock(&lowmem_sample_lock))
+		return;
+	/* someone else may have taken a newer sample meanwhile */
+	if (time_before(jiffies, lowmem_sample_time + LOWMEM_SAMPLE_INTERVAL))
+		goto out;
+
+	scanned -= lowmem_sample_scanned;
+	reclaimed -= lowmem_sample_reclaimed;
+	if (scanned < SWAP_CLUSTER_MAX &&
+	    time_before(jiffies, lowmem_sample_time + HZ))
+		goto out;
+
+	if (!scanned || reclaimed >= scanned)
+		lowmem_pressure = 0;
+	else
+		lowmem_pressure = (scanned - reclaimed) * 100 / scanned;
+	lowmem_stalls = stalls - lowmem_sample_stalls;
+
+	lowmem_sample_scanned += scanned;
+	lowmem_sample_reclaimed += reclaimed;
+	lowmem_sample_stalls = stalls;
+	lowmem_sample_time = jiffies;
+out:
+	spin_unlock(&lowmem_sample_lock);
+}
+#else
+/* Without the vmscan event counters only the minfree levels apply */
+static inline int lowmem_pressure_enabled(void)
+{
+	return 0;
+}
+
+static inline void lowmem_update_pressure(void)
+{
+}
+#endif
+
+static ssize_t pressure_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "pressure %u stalls %u adj %d\n",
+		       lowmem_pressure, lowmem_stalls,
+		       lowmem_notify_pending ? lowmem_notify_adj : -1);
+}
+
+static struct kobj_attribute lowmem_pressure_attr = __ATTR_RO(pressure);
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
@@ -87,8 +273,13 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
+	int min_level = 0;
 	int selected_tasksize = 0;
-	int selected_oom_adj;
+	int selected_oom_adj = 0;
+	int oom_adj;
+	unsigned long flags;
+	ktime_t start;
+	uint32_t elapsed;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
@@ -113,6 +304,7 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
 			min_adj = lowmem_adj[i];
+			min_level = i;
 			break;
 		}
 	}
@@ -124,60 +316,98 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
 		global_page_state(NR_INACTIVE_FILE);
-	if (nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
-		lowmem_print(5, "lowmem_shrink %d, %x, return %d\n",
-			     nr_to_scan, gfp_mask, rem);
-		return rem;
+	if (nr_to_scan <= 0)
+		goto no_kill;
+	if (lowmem_pressure_enabled())
+		lowmem_update_pressure();
+	if (min_adj == OOM_ADJUST_MAX + 1)
+		goto no_pressure;
+	if (lowmem_pressure_enabled() &&
+	    lowmem_pressure < lowmem_pressure_kill &&
+	    lowmem_stalls < lowmem_stall_kill) {
+		lowmem_print(3, "lowmem_shrink: pressure %u, stalls %u, "
+			     "no kill\n", lowmem_pressure, lowmem_stalls);
+		goto no_pressure;
 	}
-	selected_oom_adj = min_adj;
+	if (min_adj < OOM_DISABLE)
+		min_adj = OOM_DISABLE;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	/*
+	 * Let user-space know a kill is coming and give it notify_ms to
+	 * free memory on its own. If pressure is gone by then, no one dies.
+	 */
+	if (lowmem_notify_sd &&
+	    (!lowmem_notify_pending || min_adj < lowmem_notify_adj)) {
+		lowmem_notify_adj = min_adj;
+		lowmem_notify_deadline = jiffies +
+			msecs_to_jiffies(lowmem_notify_ms);
+		lowmem_notify_pending = 1;
+		sysfs_notify_dirent(lowmem_notify_sd);
+	}
+	if (lowmem_notify_pending &&
+	    time_before(jiffies, lowmem_notify_deadline))
+		goto no_kill;
+
+	/*
+	 * Only the highest non-empty bucket with a live process in it needs
+	 * to be searched; within it the largest rss is picked, as before.
+	 */
+	start = ktime_get();
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		list_for_each_entry(p, &lowmem_buckets[oom_adj - OOM_DISABLE],
+				    oom_adj_node) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	if (selected)
+		get_task_struct(selected);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	elapsed = ktime_us_delta(ktime_get(), start);
+	lowmem_select_us = elapsed;
+	if (elapsed > lowmem_select_max_us)
+		lowmem_select_max_us = elapsed;
+
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
 		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_deathpending_timeout = jiffies +
+			msecs_to_jiffies(lowmem_death_timeout_ms);
 		force_sig(SIGKILL, selected);
+		put_task_struct(selected);
+		lowmem_kill_count[min_level]++;
+		lowmem_notify_pending = 0;
 		rem -= selected_tasksize;
 	}
-	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
+	lowmem_print(4, "lowmem_shrink %d, %x, return %d, %u us\n",
+		     nr_to_scan, gfp_mask, rem, elapsed);
+	return rem;
+
+no_pressure:
+	lowmem_notify_pending = 0;
+no_kill:
+	lowmem_print(5, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -188,15 +418,53 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
 	task_free_register(&task_nb);
+	oom_adj_register(&oom_adj_nb);
+
+	/* index the processes that exist already */
+	read_lock(&tasklist_lock);
+	spin_lock_irq(&lowmem_bucket_lock);
+	for_each_process(p)
+		lowmem_bucket_update(p);
+	spin_unlock_irq(&lowmem_bucket_lock);
+	read_unlock(&tasklist_lock);
+
+	lowmem_kobj = kobject_create_and_add("lowmemorykiller", kernel_kobj);
+	if (lowmem_kobj &&
+	    !sysfs_create_file(lowmem_kobj, &lowmem_pressure_attr.attr))
+		lowmem_notify_sd = sysfs_get_dirent(lowmem_kobj->sd, NULL,
+						    "pressure");
+	if (!lowmem_notify_sd)
+		printk(KERN_WARNING "lowmemorykiller: no pressure "
+		       "notification, kills will not be announced\n");
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	int i;
+
 	unregister_shrinker(&lowmem_shrinker);
+	if (lowmem_notify_sd)
+		sysfs_put(lowmem_notify_sd);
+	if (lowmem_kobj)
+		kobject_put(lowmem_kobj);
+	oom_adj_unregister(&oom_adj_nb);
 	task_free_unregister(&task_nb);
+
+	spin_lock_irq(&lowmem_bucket_lock);
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		while (!list_empty(&lowmem_buckets[i]))
+			list_del_init(lowmem_buckets[i].next);
+	spin_unlock_irq(&lowmem_bucket_lock);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +473,19 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_array_named(kill_count, lowmem_kill_count, uint,
+			 &lowmem_kill_count_size, S_IRUGO | S_IWUSR);
+module_param_named(select_us, lowmem_select_us, uint, S_IRUGO);
+module_param_named(select_max_us, lowmem_select_max_us, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(death_timeout_ms, lowmem_death_timeout_ms, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_kill, lowmem_pressure_kill, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(stall_kill, lowmem_stall_kill, uint, S_IRUGO | S_IWUSR);
+module_param_named(notify_ms, lowmem_notify_ms, uint, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
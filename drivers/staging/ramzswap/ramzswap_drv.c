@@ -23,8 +23,11 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
+#include <linux/crypto.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -35,6 +38,7 @@
 /* Globals */
 static int ramzswap_major;
 static struct ramzswap *devices;
+static struct workqueue_struct *ramzswap_wb_wq;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
@@ -57,21 +61,262 @@ static void rzs_clear_flag(struct ramzswap *rzs, u32 index,
 	rzs->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Slot contents may only be freed by the writeback work while no reader
+ * is using them, and writes set up a slot's flags and contents under the
+ * write lock so the work never sees a half initialized slot. Without a
+ * backing device there is no writeback work and no locking.
+ */
+static inline void rzs_slot_read_lock(struct ramzswap *rzs)
+{
+	if (rzs->backing_bdev)
+		read_lock(&rzs->wb_lock);
+}
+
+static inline void rzs_slot_read_unlock(struct ramzswap *rzs)
+{
+	if (rzs->backing_bdev)
+		read_unlock(&rzs->wb_lock);
+}
+
+static inline void rzs_slot_write_lock(struct ramzswap *rzs)
+{
+	if (rzs->backing_bdev)
+		write_lock(&rzs->wb_lock);
+}
+
+static inline void rzs_slot_write_unlock(struct ramzswap *rzs)
+{
+	if (rzs->backing_bdev)
+		write_unlock(&rzs->wb_lock);
+}
+
+/*
+ * Is the page one word repeated? If so, return that word in 'element'.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+/*
+ * Look for a stored object with the same compressed data as 'cdata' and
+ * take a reference on it.
+ */
+static struct rzs_dedup_entry *rzs_dedup_get(struct ramzswap *rzs,
+			const unsigned char *cdata, u32 clen, u32 hash)
+{
+	struct rzs_dedup_entry *entry;
+	struct hlist_node *pos;
+	struct hlist_head *head;
+
+	head = &rzs->dedup_table[hash & ((1 << RZS_DEDUP_HASH_BITS) - 1)];
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(entry, pos, head, node) {
+		unsigned char *cmem;
+		int same;
+
+		if (entry->hash != hash || entry->clen != clen)
+			continue;
+
+		cmem = zs_map_object(rzs->mem_pool, entry->handle);
+		same = !memcmp(cmem, cdata, clen);
+		zs_unmap_object(rzs->mem_pool, cmem);
+
+		if (same) {
+			entry->refcount++;
+			spin_unlock(&rzs->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return NULL;
+}
+
+static void rzs_dedup_add(struct ramzswap *rzs, struct rzs_dedup_entry *entry)
+{
+	struct hlist_head *head;
+
+	head = &rzs->dedup_table[entry->hash &
+				 ((1 << RZS_DEDUP_HASH_BITS) - 1)];
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_add_head(&entry->node, head);
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/*
+ * Drop a slot's reference on the object 'handle', whose data is 'cdata'.
+ * Returns 1 if other slots still share the object; otherwise the caller
+ * frees it.
+ */
+static int rzs_dedup_put(struct ramzswap *rzs, unsigned long handle,
+			const unsigned char *cdata, u32 clen)
+{
+	u32 hash = jhash(cdata, clen, 0);
+	struct rzs_dedup_entry *entry;
+	struct hlist_node *pos;
+	struct hlist_head *head;
+
+	head = &rzs->dedup_table[hash & ((1 << RZS_DEDUP_HASH_BITS) - 1)];
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(entry, pos, head, node) {
+		if (entry->handle != handle)
+			continue;
+
+		if (--entry->refcount) {
+			spin_unlock(&rzs->dedup_lock);
+			return 1;
+		}
+
+		hlist_del(&entry->node);
+		spin_unlock(&rzs->dedup_lock);
+		kfree(entry);
+		return 0;
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	/* stored while no entry could be allocated */
+	return 0;
+}
+
+static struct rzs_stream *rzs_stream_get(struct ramzswap *rzs)
+{
+	struct rzs_stream *stream;
+
+	stream = per_cpu_ptr(rzs->streams, raw_smp_processor_id());
+	if (!mutex_trylock(&stream->lock)) {
+		rzs_stat64_inc(rzs, &rzs->stats.stream_contended);
+		mutex_lock(&stream->lock);
+	}
+
+	return stream;
+}
+
+static void rzs_stream_put(struct rzs_stream *stream)
+{
+	mutex_unlock(&stream->lock);
+}
+
+/*
+ * Compress a page from 'src' into stream->buffer. Returns 0 on success,
+ * with the compressed length in 'clen'.
+ */
+static int rzs_compress(struct rzs_stream *stream, const unsigned char *src,
+			size_t *clen)
+{
+	unsigned int dlen = 2 * PAGE_SIZE;
+	int ret;
+
+	stream->num_compress++;
+
+	if (!stream->tfm)
+		return lzo1x_1_compress(src, PAGE_SIZE, stream->buffer, clen,
+					stream->workmem);
+
+	ret = crypto_comp_compress(stream->tfm, src, PAGE_SIZE,
+				   stream->buffer, &dlen);
+	*clen = dlen;
+	return ret;
+}
+
+/*
+ * Decompress 'slen' bytes from 'src' into the page 'dst'. The native
+ * compressor needs no workspace, so 'stream' is only used for the crypto
+ * API. Returns 0 on success.
+ */
+static int rzs_decompress(struct rzs_stream *stream, const unsigned char *src,
+			  size_t slen, unsigned char *dst)
+{
+	size_t clen = PAGE_SIZE;
+	unsigned int dlen = PAGE_SIZE;
+	int ret;
+
+	if (!stream) {
+		ret = lzo1x_decompress_safe(src, slen, dst, &clen);
+		if (ret == LZO_E_OK && clen != PAGE_SIZE)
+			ret = LZO_E_ERROR;
+		return ret;
+	}
+
+	ret = crypto_comp_decompress(stream->tfm, src, slen, dst, &dlen);
+	if (!ret && dlen != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
+static void rzs_destroy_streams(struct ramzswap *rzs)
+{
+	int cpu;
+
+	if (!rzs->streams)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+
+		kfree(stream->workmem);
+		if (stream->tfm)
+			crypto_free_comp(stream->tfm);
+		free_pages((unsigned long)stream->buffer, 1);
+	}
+
+	free_percpu(rzs->streams);
+	rzs->streams = NULL;
+}
+
+static int rzs_create_streams(struct ramzswap *rzs)
+{
+	int cpu;
+
+	rzs->use_crypto = strcmp(rzs->compressor, RZS_NATIVE_COMPRESSOR);
+
+	rzs->streams = alloc_percpu(struct rzs_stream);
+	if (!rzs->streams)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+
+		mutex_init(&stream->lock);
+
+		stream->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!stream->buffer)
+			return -ENOMEM;
+
+		if (rzs->use_crypto) {
+			stream->tfm = crypto_alloc_comp(rzs->compressor, 0, 0);
+			if (IS_ERR(stream->tfm)) {
+				int ret = PTR_ERR(stream->tfm);
+
+				stream->tfm = NULL;
+				return ret;
+			}
+		} else {
+			stream->workmem = kzalloc(LZO1X_MEM_COMPRESS,
+						  GFP_KERNEL);
+			if (!stream->workmem)
+				return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 static void ramzswap_set_disksize(struct ramzswap *rzs, size_t totalram_bytes)
 {
 	if (!rzs->disksize) {
@@ -125,8 +370,9 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	struct ramzswap_stats *rs = &rzs->stats;
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
+	int cpu, i = 0;
 
-	mem_used = xv_get_total_size_bytes(rzs->mem_pool)
+	mem_used = zs_get_total_size_bytes(rzs->mem_pool)
 			+ (rs->pages_expand << PAGE_SHIFT);
 	succ_writes = rzs_stat64_read(rzs, &rs->num_writes) -
 			rzs_stat64_read(rzs, &rs->failed_writes);
@@ -154,61 +400,123 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
 	s->compr_data_size = rs->compr_size;
 	s->mem_used_total = mem_used;
+
+	s->num_streams = num_possible_cpus();
+	s->stream_contended = rzs_stat64_read(rzs, &rs->stream_contended);
+	for_each_possible_cpu(cpu) {
+		if (i == RZS_STATS_MAX_STREAMS)
+			break;
+		s->stream_compress[i++] =
+			per_cpu_ptr(rzs->streams, cpu)->num_compress;
+	}
+
+	s->pages_same = rs->pages_same;
+	s->pages_dedup = rs->pages_dedup;
+	s->saved_bytes = ((u64)(rs->pages_zero + rs->pages_same) << PAGE_SHIFT)
+			+ rzs_stat64_read(rzs, &rs->dedup_saved);
+
+	s->pages_backed = rs->pages_backed;
+	s->backed_reads = rzs_stat64_read(rzs, &rs->backed_reads);
+	s->backed_writes = rzs_stat64_read(rzs, &rs->backed_writes);
+
+	s->pool_pages = zs_get_total_size_bytes(rzs->mem_pool) >> PAGE_SHIFT;
+	s->pages_compacted = rzs_stat64_read(rzs, &rs->pages_compacted);
 	}
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
-static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
+static void __ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
 	u32 clen;
 	void *obj;
+	int shared = 0;
 
-	struct page *page = rzs->table[index].page;
-	u32 offset = rzs->table[index].offset;
+	unsigned long handle = rzs->table[index].handle;
 
-	if (unlikely(!page)) {
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+
+	if (rzs_test_flag(rzs, index, RZS_BACKED)) {
+		rzs_clear_flag(rzs, index, RZS_BACKED);
+		rzs_stat_dec(rzs, &rzs->stats.pages_backed);
+		return;
+	}
+
+	if (rzs_test_flag(rzs, index, RZS_SAME)) {
+		rzs_clear_flag(rzs, index, RZS_SAME);
+		rzs_stat_dec(rzs, &rzs->stats.pages_same);
+		rzs->table[index].element = 0;
+		return;
+	}
+
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
 		 */
 		if (rzs_test_flag(rzs, index, RZS_ZERO)) {
 			rzs_clear_flag(rzs, index, RZS_ZERO);
-			rzs_stat_dec(&rzs->stats.pages_zero);
+			rzs_stat_dec(rzs, &rzs->stats.pages_zero);
 		}
 		return;
 	}
 
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(rzs->table[index].page);
 		rzs_clear_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_dec(&rzs->stats.pages_expand);
+		rzs_stat_dec(rzs, &rzs->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	clen = rzs->table[index].size;
+	if (rzs->dedup) {
+		obj = zs_map_object(rzs->mem_pool, handle);
+		shared = rzs_dedup_put(rzs, handle, obj, clen);
+		zs_unmap_object(rzs->mem_pool, obj);
+	}
 
-	xv_free(rzs->mem_pool, page, offset);
+	if (!shared)
+		zs_free(rzs->mem_pool, handle);
 	if (clen <= PAGE_SIZE / 2)
-		rzs_stat_dec(&rzs->stats.good_compress);
+		rzs_stat_dec(rzs, &rzs->stats.good_compress);
 
 out:
-	rzs->stats.compr_size -= clen;
-	rzs_stat_dec(&rzs->stats.pages_stored);
+	if (shared) {
+		rzs_stat_dec(rzs, &rzs->stats.pages_dedup);
+		rzs_stat64_add(rzs, &rzs->stats.dedup_saved, -(s64)clen);
+	} else {
+		spin_lock(&rzs->stat64_lock);
+		rzs->stats.compr_size -= clen;
+		spin_unlock(&rzs->stat64_lock);
+	}
+	rzs_stat_dec(rzs, &rzs->stats.pages_stored);
 
-	rzs->table[index].page = NULL;
-	rzs->table[index].offset = 0;
+	rzs->table[index].handle = 0;
+	rzs->table[index].size = 0;
 }
 
-static int handle_zero_page(struct bio *bio)
+static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
+{
+	rzs_slot_write_lock(rzs);
+	__ramzswap_free_page(rzs, index);
+	rzs_slot_write_unlock(rzs);
+}
+
+static int handle_same_page(struct bio *bio, unsigned long element)
 {
 	void *user_mem;
 	struct page *page = bio->bi_io_vec[0].bv_page;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		unsigned long *p = user_mem;
+		unsigned int pos;
+
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*p); pos++)
+			p[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -218,28 +526,136 @@ static int handle_zero_page(struct bio *bio)
 	return 0;
 }
 
-static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
+/*
+ * Copy or decompress the contents of slot 'index' into 'page'. Returns 0
+ * on success.
+ */
+static int rzs_load_page(struct ramzswap *rzs, u32 index,
+			struct rzs_stream *stream, struct page *page)
 {
-	u32 index;
-	struct page *page;
+	int ret = 0;
 	unsigned char *user_mem, *cmem;
 
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
 
-	memcpy(user_mem, cmem, PAGE_SIZE);
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
+		cmem = kmap_atomic(rzs->table[index].page, KM_USER1);
+		memcpy(user_mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+	} else {
+		cmem = zs_map_object(rzs->mem_pool, rzs->table[index].handle);
+		ret = rzs_decompress(stream, cmem, rzs->table[index].size,
+				user_mem);
+		zs_unmap_object(rzs->mem_pool, cmem);
+	}
+
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
-	flush_dcache_page(page);
+	return ret;
+}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return 0;
+static void ramzswap_backing_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Write 'page' to the backing device as slot 'index' and wait for it.
+ */
+static int ramzswap_backing_write(struct ramzswap *rzs, u32 index,
+				struct page *page)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	bio->bi_bdev = rzs->backing_bdev;
+	bio->bi_sector = index << SECTORS_PER_PAGE_SHIFT;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+	bio->bi_end_io = ramzswap_backing_end_io;
+	bio->bi_private = &done;
+
+	submit_bio(WRITE, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+/*
+ * Runs every wb_idle_secs. A stored page is first marked idle; reads,
+ * rewrites and frees clear the mark, so a page still marked on the next
+ * pass has not been touched for a full period and is moved to the
+ * backing device. Slot 0 holds the swap header and stays in memory.
+ */
+static void ramzswap_writeback_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(work, struct ramzswap,
+					wb_work.work);
+	size_t index, num_pages = rzs->disksize >> PAGE_SHIFT;
+
+	for (index = 1; index < num_pages; index++) {
+		struct rzs_stream *stream = NULL;
+		unsigned long handle;
+		int ret;
+
+		/* most slots take one of the shortcuts below */
+		cond_resched();
+
+		write_lock(&rzs->wb_lock);
+		handle = rzs->table[index].handle;
+		if (!handle || rzs_test_flag(rzs, index, RZS_SAME)) {
+			write_unlock(&rzs->wb_lock);
+			continue;
+		}
+		if (!rzs_test_flag(rzs, index, RZS_IDLE)) {
+			rzs_set_flag(rzs, index, RZS_IDLE);
+			write_unlock(&rzs->wb_lock);
+			continue;
+		}
+		write_unlock(&rzs->wb_lock);
+
+		if (rzs->use_crypto)
+			stream = rzs_stream_get(rzs);
+
+		/* the slot may have changed while we waited for a stream */
+		write_lock(&rzs->wb_lock);
+		if (rzs->table[index].handle != handle ||
+		    !rzs_test_flag(rzs, index, RZS_IDLE)) {
+			write_unlock(&rzs->wb_lock);
+			if (stream)
+				rzs_stream_put(stream);
+			continue;
+		}
+		ret = rzs_load_page(rzs, index, stream, rzs->wb_page);
+		rzs->wb_index = index;
+		write_unlock(&rzs->wb_lock);
+
+		if (stream)
+			rzs_stream_put(stream);
+
+		if (!ret)
+			ret = ramzswap_backing_write(rzs, index, rzs->wb_page);
+
+		/* a read, rewrite or free in the meantime cleared RZS_IDLE */
+		write_lock(&rzs->wb_lock);
+		rzs->wb_index = 0;
+		if (!ret && rzs->table[index].handle == handle &&
+		    rzs_test_flag(rzs, index, RZS_IDLE)) {
+			__ramzswap_free_page(rzs, index);
+			rzs_set_flag(rzs, index, RZS_BACKED);
+			rzs_stat_inc(rzs, &rzs->stats.pages_backed);
+			rzs_stat64_inc(rzs, &rzs->stats.backed_writes);
+		}
+		write_unlock(&rzs->wb_lock);
+	}
+
+	queue_delayed_work(ramzswap_wb_wq, &rzs->wb_work,
+			rzs->wb_idle_secs * HZ);
 }
 
 /*
@@ -265,10 +681,8 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
 	u32 index;
-	size_t clen;
 	struct page *page;
-	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem;
+	struct rzs_stream *stream = NULL;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
 
@@ -276,32 +690,44 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	if (rzs_test_flag(rzs, index, RZS_ZERO))
-		return handle_zero_page(bio);
+		return handle_same_page(bio, 0);
 
-	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
-		return handle_ramzswap_fault(rzs, bio);
+	if (rzs_test_flag(rzs, index, RZS_SAME))
+		return handle_same_page(bio, rzs->table[index].element);
 
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(rzs, bio);
+	if (rzs->use_crypto)
+		stream = rzs_stream_get(rzs);
 
-	user_mem = kmap_atomic(page, KM_USER0);
-	clen = PAGE_SIZE;
+	rzs_slot_read_lock(rzs);
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	/* Page was written back: let the backing device serve it */
+	if (rzs_test_flag(rzs, index, RZS_BACKED)) {
+		rzs_slot_read_unlock(rzs);
+		if (stream)
+			rzs_stream_put(stream);
+		rzs_stat64_inc(rzs, &rzs->stats.backed_reads);
+		bio->bi_bdev = rzs->backing_bdev;
+		return 1;
+	}
 
-	ret = lzo1x_decompress_safe(
-		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
-		user_mem, &clen);
+	/* Requested page is not present in compressed area */
+	if (!rzs->table[index].page) {
+		rzs_slot_read_unlock(rzs);
+		if (stream)
+			rzs_stream_put(stream);
+		return handle_ramzswap_fault(rzs, bio);
+	}
 
-	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+	ret = rzs_load_page(rzs, index, stream, page);
+
+	rzs_slot_read_unlock(rzs);
+
+	if (stream)
+		rzs_stream_put(stream);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
@@ -322,10 +748,13 @@ out:
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
-	u32 offset, index;
+	u32 index;
 	size_t clen;
-	struct zobj_header *zheader;
+	u32 hash = 0;
+	unsigned long element, handle = 0;
 	struct page *page, *page_store;
+	struct rzs_stream *stream;
+	struct rzs_dedup_entry *entry = NULL;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,29 +762,38 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
+	/* The slot may still hold an older copy of this page */
+	ramzswap_free_page(rzs, index);
 
-	mutex_lock(&rzs->lock);
+	stream = rzs_stream_get(rzs);
+	src = stream->buffer;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	if (page_zero_filled(user_mem)) {
+	if (page_same_filled(user_mem, &element)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
-		rzs_stat_inc(&rzs->stats.pages_zero);
-		rzs_set_flag(rzs, index, RZS_ZERO);
+		rzs_stream_put(stream);
+		rzs_slot_write_lock(rzs);
+		if (!element) {
+			rzs_stat_inc(rzs, &rzs->stats.pages_zero);
+			rzs_set_flag(rzs, index, RZS_ZERO);
+		} else {
+			rzs_stat_inc(rzs, &rzs->stats.pages_same);
+			rzs->table[index].element = element;
+			rzs_set_flag(rzs, index, RZS_SAME);
+		}
+		rzs_slot_write_unlock(rzs);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	ret = rzs_compress(stream, user_mem, &clen);
 
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		rzs_stream_put(stream);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
@@ -367,62 +805,108 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		/*
+		 * With a backing device, send the page there as it is
+		 * unless writeback of an older copy is still in flight.
+		 */
+		if (rzs->backing_bdev) {
+			rzs_slot_write_lock(rzs);
+			if (index != rzs->wb_index) {
+				rzs_set_flag(rzs, index, RZS_BACKED);
+				rzs_slot_write_unlock(rzs);
+				rzs_stream_put(stream);
+				rzs_stat_inc(rzs, &rzs->stats.pages_backed);
+				rzs_stat64_inc(rzs, &rzs->stats.backed_writes);
+				bio->bi_bdev = rzs->backing_bdev;
+				return 1;
+			}
+			rzs_slot_write_unlock(rzs);
+		}
+
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
+			rzs_stream_put(stream);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 			goto out;
 		}
 
-		offset = 0;
-		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_inc(&rzs->stats.pages_expand);
-		rzs->table[index].page = page_store;
 		src = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+
+		rzs_slot_write_lock(rzs);
+		rzs->table[index].page = page_store;
+		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
+		rzs_slot_write_unlock(rzs);
+		rzs_stat_inc(rzs, &rzs->stats.pages_expand);
 		goto memstore;
 	}
 
-	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
-			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
+	/*
+	 * An identical object may be stored already; then this slot just
+	 * takes another reference on it.
+	 */
+	if (rzs->dedup) {
+		hash = jhash(src, clen, 0);
+		entry = rzs_dedup_get(rzs, src, clen, hash);
+		if (entry) {
+			rzs_stream_put(stream);
+			rzs_slot_write_lock(rzs);
+			rzs->table[index].handle = entry->handle;
+			rzs->table[index].size = clen;
+			rzs_slot_write_unlock(rzs);
+			rzs_stat_inc(rzs, &rzs->stats.pages_dedup);
+			rzs_stat64_add(rzs, &rzs->stats.dedup_saved, clen);
+			goto stored;
+		}
+		/* without an entry the object is simply not shared */
+		entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	}
+
+	handle = zs_malloc(rzs->mem_pool, clen, GFP_NOIO | __GFP_HIGHMEM);
+	if (!handle) {
+		rzs_stream_put(stream);
+		kfree(entry);
 		pr_info("Error allocating memory for compressed "
 			"page: %u, size=%zu\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
 
-memstore:
-	rzs->table[index].offset = offset;
+	cmem = zs_map_object(rzs->mem_pool, handle);
+	memcpy(cmem, src, clen);
+	zs_unmap_object(rzs->mem_pool, cmem);
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	rzs_slot_write_lock(rzs);
+	rzs->table[index].handle = handle;
+	rzs->table[index].size = clen;
+	rzs_slot_write_unlock(rzs);
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
+memstore:
+	rzs_stream_put(stream);
+
+	if (entry) {
+		entry->handle = handle;
+		entry->clen = clen;
+		entry->hash = hash;
+		entry->refcount = 1;
+		rzs_dedup_add(rzs, entry);
 	}
-#endif
-
-	memcpy(cmem, src, clen);
 
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	spin_lock(&rzs->stat64_lock);
+	rzs->stats.compr_size += clen;
+	spin_unlock(&rzs->stat64_lock);
 
+stored:
 	/* Update stats */
-	rzs->stats.compr_size += clen;
-	rzs_stat_inc(&rzs->stats.pages_stored);
+	rzs_stat_inc(rzs, &rzs->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
-		rzs_stat_inc(&rzs->stats.good_compress);
-
-	mutex_unlock(&rzs->lock);
+		rzs_stat_inc(rzs, &rzs->stats.good_compress);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
@@ -484,6 +968,23 @@ static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
+/*
+ * Memory pressure: release pool pages by moving compressed objects
+ * together.
+ */
+static int ramzswap_shrink(struct shrinker *shrinker, int nr_to_scan,
+			gfp_t gfp_mask)
+{
+	struct ramzswap *rzs = container_of(shrinker, struct ramzswap,
+					shrinker);
+
+	if (nr_to_scan)
+		rzs_stat64_add(rzs, &rzs->stats.pages_compacted,
+				zs_compact(rzs->mem_pool));
+
+	return zs_get_compactable_pages(rzs->mem_pool);
+}
+
 static void reset_device(struct ramzswap *rzs)
 {
 	size_t index;
@@ -491,34 +992,42 @@ static void reset_device(struct ramzswap *rzs)
 	/* Do not accept any new I/O request */
 	rzs->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
+	if (rzs->backing_bdev)
+		cancel_delayed_work_sync(&rzs->wb_work);
 
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+	if (rzs->mem_pool)
+		unregister_shrinker(&rzs->shrinker);
 
-	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+	/* Free the compression streams */
+	rzs_destroy_streams(rzs);
 
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
-	}
+	/*
+	 * Free all pages that are still in this ramzswap device. This goes
+	 * through ramzswap_free_page() so objects shared by several slots
+	 * are only freed once.
+	 */
+	for (index = 0; rzs->table && index < rzs->disksize >> PAGE_SHIFT;
+	     index++)
+		ramzswap_free_page(rzs, index);
 
 	vfree(rzs->table);
 	rzs->table = NULL;
 
-	xv_destroy_pool(rzs->mem_pool);
+	vfree(rzs->dedup_table);
+	rzs->dedup_table = NULL;
+
+	if (rzs->wb_page)
+		__free_page(rzs->wb_page);
+	rzs->wb_page = NULL;
+
+	if (rzs->backing_bdev)
+		close_bdev_exclusive(rzs->backing_bdev,
+				FMODE_READ | FMODE_WRITE);
+	rzs->backing_bdev = NULL;
+	rzs->wb_idle_secs = 0;
+
+	if (rzs->mem_pool)
+		zs_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
 
 	/* Reset stats */
@@ -541,17 +1050,10 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = rzs_create_streams(rzs);
+	if (ret) {
+		pr_err("Error allocating %s compression streams\n",
+			rzs->compressor);
 		goto fail;
 	}
 
@@ -566,6 +1068,34 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 	memset(rzs->table, 0, num_pages * sizeof(*rzs->table));
 
+	if (rzs->dedup) {
+		int i;
+
+		rzs->dedup_table = vmalloc(sizeof(*rzs->dedup_table)
+					   << RZS_DEDUP_HASH_BITS);
+		if (!rzs->dedup_table) {
+			pr_err("Error allocating dedup table\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+		for (i = 0; i < 1 << RZS_DEDUP_HASH_BITS; i++)
+			INIT_HLIST_HEAD(&rzs->dedup_table[i]);
+	}
+
+	if (rzs->backing_bdev) {
+		if (i_size_read(rzs->backing_bdev->bd_inode) < rzs->disksize) {
+			pr_err("Backing device is smaller than disksize\n");
+			ret = -EINVAL;
+			goto fail;
+		}
+		rzs->wb_page = alloc_page(GFP_KERNEL);
+		if (!rzs->wb_page) {
+			pr_err("Error allocating writeback page\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
 	page = alloc_page(__GFP_ZERO);
 	if (!page) {
 		pr_err("Error allocating swap header page\n");
@@ -584,15 +1114,20 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	/* ramzswap devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->disk->queue);
 
-	rzs->mem_pool = xv_create_pool();
+	rzs->mem_pool = zs_create_pool();
 	if (!rzs->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
+	register_shrinker(&rzs->shrinker);
 
 	rzs->init_done = 1;
 
+	if (rzs->backing_bdev && rzs->wb_idle_secs)
+		queue_delayed_work(ramzswap_wb_wq, &rzs->wb_work,
+				rzs->wb_idle_secs * HZ);
+
 	pr_debug("Initialization done!\n");
 	return 0;
 
@@ -634,6 +1169,89 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		pr_info("Disk size set to %zu kB\n", disksize_kb);
 		break;
 
+	case RZSIO_SET_COMPRESSOR:
+	{
+		char name[RZS_COMPRESSOR_NAME_LEN];
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(name, (void *)arg, _IOC_SIZE(cmd))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		if (strcmp(name, RZS_NATIVE_COMPRESSOR) &&
+		    !crypto_has_comp(name, 0, 0)) {
+			ret = -EINVAL;
+			goto out;
+		}
+		strcpy(rzs->compressor, name);
+		pr_info("Compressor set to %s\n", name);
+		break;
+	}
+
+	case RZSIO_SET_DEDUP:
+	{
+		int dedup;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(&dedup, (void *)arg, _IOC_SIZE(cmd))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		rzs->dedup = !!dedup;
+		pr_info("Dedup %s\n", rzs->dedup ? "enabled" : "disabled");
+		break;
+	}
+
+	case RZSIO_SET_BACKING:
+	{
+		struct ramzswap_ioctl_backing backing;
+		struct block_device *backing_bdev = NULL;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(&backing, (void *)arg, _IOC_SIZE(cmd))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		backing.path[sizeof(backing.path) - 1] = '\0';
+
+		if (backing.path[0]) {
+			backing_bdev = open_bdev_exclusive(backing.path,
+					FMODE_READ | FMODE_WRITE, rzs);
+			if (IS_ERR(backing_bdev)) {
+				ret = PTR_ERR(backing_bdev);
+				goto out;
+			}
+		}
+		if (rzs->backing_bdev)
+			close_bdev_exclusive(rzs->backing_bdev,
+					FMODE_READ | FMODE_WRITE);
+		rzs->backing_bdev = backing_bdev;
+		rzs->wb_idle_secs = backing.idle_secs;
+		pr_info("Backing device %s, writeback after %u s idle\n",
+			backing.path[0] ? backing.path : "none",
+			backing.idle_secs);
+		break;
+	}
+
+	case RZSIO_COMPACT:
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		rzs_stat64_add(rzs, &rzs->stats.pages_compacted,
+				zs_compact(rzs->mem_pool));
+		break;
+
 	case RZSIO_GET_STATS:
 	{
 		struct ramzswap_ioctl_stats *stats;
@@ -703,8 +1321,14 @@ static int create_device(struct ramzswap *rzs, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&rzs->lock);
 	spin_lock_init(&rzs->stat64_lock);
+	spin_lock_init(&rzs->dedup_lock);
+	rwlock_init(&rzs->wb_lock);
+	INIT_DELAYED_WORK(&rzs->wb_work, ramzswap_writeback_work);
+
+	rzs->shrinker.shrink = ramzswap_shrink;
+	rzs->shrinker.seeks = DEFAULT_SEEKS;
+	strcpy(rzs->compressor, RZS_NATIVE_COMPRESSOR);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -770,11 +1394,17 @@ static int __init ramzswap_init(void)
 		goto out;
 	}
 
+	ramzswap_wb_wq = create_singlethread_workqueue("ramzswap_wb");
+	if (!ramzswap_wb_wq) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	ramzswap_major = register_blkdev(0, "ramzswap");
 	if (ramzswap_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto destroy_wq;
 	}
 
 	if (!num_devices) {
@@ -803,6 +1433,8 @@ free_devices:
 		destroy_device(&devices[--dev_id]);
 unregister:
 	unregister_blkdev(ramzswap_major, "ramzswap");
+destroy_wq:
+	destroy_workqueue(ramzswap_wb_wq);
 out:
 	return ret;
 }
@@ -821,6 +1453,7 @@ static void __exit ramzswap_exit(void)
 	}
 
 	unregister_blkdev(ramzswap_major, "ramzswap");
+	destroy_workqueue(ramzswap_wb_wq);
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
@@ -17,9 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
 
 #include "ramzswap_ioctl.h"
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -27,18 +30,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default ramzswap disk size: 25% of total RAM */
@@ -51,10 +42,15 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than or equal to ZS_MAX_ALLOC_SIZE
+ * otherwise, zs_malloc() would always return failure.
+ */
+
+/*
+ * Compressor used unless another is selected with RZSIO_SET_COMPRESSOR.
+ * It is called directly; any other name is looked up in the crypto API.
  */
+#define RZS_NATIVE_COMPRESSOR	"lzo"
 
 /*-- End of configurable params */
 
@@ -71,6 +67,15 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page is one word repeated, kept in table[page_no].element */
+	RZS_SAME,
+
+	/* Page is on the backing device, at the same page no */
+	RZS_BACKED,
+
+	/* Page was not accessed since the last writeback pass */
+	RZS_IDLE,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
@@ -81,12 +86,44 @@ enum rzs_pageflags {
  * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		struct page *page;	/* RZS_UNCOMPRESSED pages */
+		unsigned long handle;	/* zsmalloc object */
+		unsigned long element;	/* RZS_SAME pages */
+	};
+	u16 size;	/* compressed object size */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/*
+ * Workspace for one compression at a time. There is one stream per
+ * possible cpu and a write uses the stream of the cpu it starts on, so
+ * writes on different cpus compress concurrently.
+ */
+struct rzs_stream {
+	struct mutex lock;
+	void *workmem;		/* native compressor working memory */
+	struct crypto_comp *tfm;	/* crypto API compressor */
+	void *buffer;		/* compressed output, two pages */
+	u64 num_compress;	/* pages compressed with this stream */
+};
+
+/* Size of the dedup hash table */
+#define RZS_DEDUP_HASH_BITS	12
+
+/*
+ * With dedup enabled every stored compressed object has one of these,
+ * hashed by its contents, counting the swap slots that share it.
+ */
+struct rzs_dedup_entry {
+	struct hlist_node node;
+	unsigned long handle;
+	u32 clen;
+	u32 hash;
+	u32 refcount;
+};
+
 struct ramzswap_stats {
 	/* basic stats */
 	size_t compr_size;	/* compressed size of pages stored -
@@ -103,16 +140,42 @@ struct ramzswap_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u64 stream_contended;	/* times a stream was found busy */
+	u32 pages_same;		/* no. of pages filled with one word */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 dedup_saved;	/* bytes not stored thanks to dedup */
+	u32 pages_backed;	/* no. of pages on the backing device */
+	u64 backed_reads;	/* reads served by the backing device */
+	u64 backed_writes;	/* pages written to the backing device */
+	u64 pages_compacted;	/* pool pages released by compaction */
 #endif
 };
 
 struct ramzswap {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct shrinker shrinker;	/* compacts mem_pool */
+	struct rzs_stream *streams;	/* per-cpu */
+	char compressor[RZS_COMPRESSOR_NAME_LEN];
+	int use_crypto;		/* compressor is not the native one */
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
+	int dedup;		/* share identical compressed objects */
+	struct hlist_head *dedup_table;
+	spinlock_t dedup_lock;
+	spinlock_t stat64_lock;	/* protect stats */
+
+	/*
+	 * Optional backing device. Incompressible pages are written to it
+	 * directly and the writeback work moves pages that stayed idle for
+	 * wb_idle_secs there. While a backing device is set, wb_lock keeps
+	 * the work from freeing a slot's memory under a reader.
+	 */
+	struct block_device *backing_bdev;
+	u32 wb_idle_secs;
+	rwlock_t wb_lock;
+	struct delayed_work wb_work;
+	struct page *wb_page;	/* bounce page for writeback */
+	u32 wb_index;		/* slot being written back, 0 if none */
+
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -130,14 +193,18 @@ struct ramzswap {
 
 /* Debugging and Stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
-static void rzs_stat_inc(u32 *v)
+static void rzs_stat_inc(struct ramzswap *rzs, u32 *v)
 {
+	spin_lock(&rzs->stat64_lock);
 	*v = *v + 1;
+	spin_unlock(&rzs->stat64_lock);
 }
 
-static void rzs_stat_dec(u32 *v)
+static void rzs_stat_dec(struct ramzswap *rzs, u32 *v)
 {
+	spin_lock(&rzs->stat64_lock);
 	*v = *v - 1;
+	spin_unlock(&rzs->stat64_lock);
 }
 
 static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
@@ -147,6 +214,13 @@ static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
 	spin_unlock(&rzs->stat64_lock);
 }
 
+static void rzs_stat64_add(struct ramzswap *rzs, u64 *v, s64 delta)
+{
+	spin_lock(&rzs->stat64_lock);
+	*v = *v + delta;
+	spin_unlock(&rzs->stat64_lock);
+}
+
 static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 {
 	u64 val;
@@ -158,9 +232,10 @@ static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 	return val;
 }
 #else
-#define rzs_stat_inc(v)
-#define rzs_stat_dec(v)
+#define rzs_stat_inc(r, v)
+#define rzs_stat_dec(r, v)
 #define rzs_stat64_inc(r, v)
+#define rzs_stat64_add(r, v, d)
 #define rzs_stat64_read(r, v)
 #endif /* CONFIG_RAMZSWAP_STATS */
 
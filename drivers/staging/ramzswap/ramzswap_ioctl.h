@@ -15,6 +15,11 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+/* Per-stream stats are reported for this many streams at most */
+#define RZS_STATS_MAX_STREAMS	4
+
+#define RZS_COMPRESSOR_NAME_LEN	64
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -32,11 +37,35 @@ struct ramzswap_ioctl_stats {
 	u64 orig_data_size;
 	u64 compr_data_size;
 	u64 mem_used_total;
+	u32 num_streams;	/* compression streams, one per cpu */
+	u64 stream_contended;	/* times a stream was found busy */
+	u64 stream_compress[RZS_STATS_MAX_STREAMS]; /* pages compressed */
+	u32 pages_same;		/* no. of pages filled with one word */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 saved_bytes;	/* memory saved by zero, same and dedup */
+	u32 pages_backed;	/* no. of pages on the backing device */
+	u64 backed_reads;	/* reads served by the backing device */
+	u64 backed_writes;	/* pages written to the backing device */
+	u32 pool_pages;		/* pages holding compressed objects */
+	u64 pages_compacted;	/* pool pages released by compaction */
 } __attribute__ ((packed, aligned(4)));
 
+#define RZS_BACKING_PATH_LEN	128
+
+struct ramzswap_ioctl_backing {
+	char path[RZS_BACKING_PATH_LEN];	/* backing block device,
+						 * empty for none */
+	u32 idle_secs;		/* write back pages idle this long,
+				 * 0: only incompressible pages */
+};
+
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, char [RZS_COMPRESSOR_NAME_LEN])
+#define RZSIO_SET_DEDUP		_IOW('z', 5, int)
+#define RZSIO_SET_BACKING	_IOW('z', 6, struct ramzswap_ioctl_backing)
+#define RZSIO_COMPACT		_IO('z', 7)
 
 #endif
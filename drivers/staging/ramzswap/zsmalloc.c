@@ -0,0 +1,505 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped in size classes ZS_SIZE_CLASS_DELTA bytes apart and
+ * each zero-order page holds objects of one class only, so no per-object
+ * header is needed and malloc/free never touch the page contents. Callers
+ * refer to objects through handles; zs_compact() moves objects out of
+ * sparsely used pages into fuller ones of the same class and releases
+ * the pages that become empty.
+ */
+
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* Handles of all pools come from one cache, created with the first pool */
+static struct kmem_cache *zs_handle_cachep;
+static DEFINE_MUTEX(zs_handle_cache_mutex);
+static int zs_nr_pools;
+
+/*
+ * Get index of the size class for objects of given size.
+ */
+static u32 get_size_class_index(u32 size)
+{
+	if (unlikely(size < ZS_MIN_ALLOC_SIZE))
+		size = ZS_MIN_ALLOC_SIZE;
+	size = ALIGN(size, ZS_SIZE_CLASS_DELTA);
+	return (size - ZS_MIN_ALLOC_SIZE) / ZS_SIZE_CLASS_DELTA;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zs_page *zpage)
+{
+	if (!zpage->inuse)
+		return ZS_EMPTY;
+	if (zpage->inuse == class->objs_per_page)
+		return ZS_FULL;
+	if (zpage->inuse * 4 > class->objs_per_page * 3)
+		return ZS_ALMOST_FULL;
+	return ZS_ALMOST_EMPTY;
+}
+
+/*
+ * Move page to the list matching its current use. Empty pages are only
+ * unlinked; the caller frees them.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zs_page *zpage)
+{
+	enum fullness_group fg = get_fullness_group(class, zpage);
+
+	if (fg == zpage->fullness)
+		return fg;
+
+	list_del(&zpage->list);
+	if (fg != ZS_EMPTY)
+		list_add(&zpage->list, &class->fullness_list[fg]);
+	zpage->fullness = fg;
+
+	return fg;
+}
+
+static struct zs_page *alloc_zs_page(struct size_class *class, gfp_t flags)
+{
+	struct zs_page *zpage;
+
+	zpage = kzalloc(sizeof(*zpage) + class->objs_per_page *
+			sizeof(zpage->handles[0]), flags & ~__GFP_HIGHMEM);
+	if (unlikely(!zpage))
+		return NULL;
+
+	zpage->page = alloc_page(flags);
+	if (unlikely(!zpage->page)) {
+		kfree(zpage);
+		return NULL;
+	}
+
+	zpage->class = class;
+	zpage->fullness = ZS_ALMOST_EMPTY;
+
+	return zpage;
+}
+
+static void free_zs_page(struct zs_pool *pool, struct zs_page *zpage)
+{
+	__free_page(zpage->page);
+	kfree(zpage);
+	atomic_dec(&pool->total_pages);
+}
+
+/*
+ * Page to allocate the next object of this class from, NULL if all
+ * pages are full. Fuller pages come first so that sparse pages get a
+ * chance to drain.
+ */
+static struct zs_page *find_zs_page(struct size_class *class)
+{
+	enum fullness_group fg;
+
+	for (fg = ZS_ALMOST_FULL; fg <= ZS_ALMOST_EMPTY; fg++) {
+		if (!list_empty(&class->fullness_list[fg]))
+			return list_first_entry(&class->fullness_list[fg],
+						struct zs_page, list);
+	}
+
+	return NULL;
+}
+
+/*
+ * Create a memory pool. Allocates size classes and other
+ * per-pool metadata.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	int i;
+	struct zs_pool *pool;
+	struct size_class *prev = NULL;
+
+	mutex_lock(&zs_handle_cache_mutex);
+	if (!zs_nr_pools) {
+		zs_handle_cachep = KMEM_CACHE(zs_handle, 0);
+		if (!zs_handle_cachep) {
+			mutex_unlock(&zs_handle_cache_mutex);
+			return NULL;
+		}
+	}
+	zs_nr_pools++;
+	mutex_unlock(&zs_handle_cache_mutex);
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		goto fail;
+
+	rwlock_init(&pool->migrate_lock);
+
+	/*
+	 * Walk down from the largest size so that sizes with the same
+	 * number of objects per page all map to the largest of them.
+	 */
+	for (i = ZS_NR_SIZE_CLASSES - 1; i >= 0; i--) {
+		struct size_class *class;
+		u32 size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		enum fullness_group fg;
+
+		if (prev && prev->objs_per_page == PAGE_SIZE / size) {
+			pool->size_class[i] = prev;
+			prev->index = i;
+			continue;
+		}
+
+		class = kzalloc(sizeof(*class), GFP_KERNEL);
+		if (!class)
+			goto fail;
+
+		spin_lock_init(&class->lock);
+		class->size = size;
+		class->objs_per_page = PAGE_SIZE / size;
+		class->index = i;
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+
+		pool->size_class[i] = class;
+		prev = class;
+	}
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; pool && i < ZS_NR_SIZE_CLASSES; i++) {
+		struct size_class *class = pool->size_class[i];
+
+		if (!class || class->index != i)
+			continue;
+
+		/* Caller must have freed all objects */
+		WARN_ON(class->pages);
+		kfree(class);
+	}
+	kfree(pool);
+
+	mutex_lock(&zs_handle_cache_mutex);
+	if (!--zs_nr_pools) {
+		kmem_cache_destroy(zs_handle_cachep);
+		zs_handle_cachep = NULL;
+	}
+	mutex_unlock(&zs_handle_cache_mutex);
+}
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ * @flags: gfp flags for pool growth and handle allocation
+ *
+ * On success, returns a handle identifying the object; use
+ * zs_map_object() to access it. On failure, returns 0.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, u32 size, gfp_t flags)
+{
+	u16 slot;
+	struct zs_page *zpage;
+	struct zs_handle *handle;
+	struct size_class *class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	class = pool->size_class[get_size_class_index(size)];
+
+	handle = kmem_cache_alloc(zs_handle_cachep, flags & ~__GFP_HIGHMEM);
+	if (unlikely(!handle))
+		return 0;
+
+	spin_lock(&class->lock);
+	zpage = find_zs_page(class);
+
+	if (!zpage) {
+		spin_unlock(&class->lock);
+		zpage = alloc_zs_page(class, flags);
+		if (unlikely(!zpage)) {
+			kmem_cache_free(zs_handle_cachep, handle);
+			return 0;
+		}
+		atomic_inc(&pool->total_pages);
+
+		spin_lock(&class->lock);
+		list_add(&zpage->list,
+			&class->fullness_list[ZS_ALMOST_EMPTY]);
+		class->pages++;
+	}
+
+	for (slot = 0; zpage->handles[slot]; slot++)
+		;
+
+	zpage->handles[slot] = handle;
+	handle->zpage = zpage;
+	handle->slot = slot;
+
+	zpage->inuse++;
+	class->objs_inuse++;
+	fix_fullness_group(class, zpage);
+
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+
+/*
+ * Free object identified with handle
+ */
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_page *zpage;
+	struct size_class *class;
+	enum fullness_group fg;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	read_lock(&pool->migrate_lock);
+
+	zpage = handle->zpage;
+	class = zpage->class;
+
+	spin_lock(&class->lock);
+
+	/* Catch double free bugs */
+	BUG_ON(zpage->handles[handle->slot] != handle);
+
+	zpage->handles[handle->slot] = NULL;
+	zpage->inuse--;
+	class->objs_inuse--;
+
+	/* No used objects in this page. Free it. */
+	fg = fix_fullness_group(class, zpage);
+	if (fg == ZS_EMPTY)
+		class->pages--;
+
+	spin_unlock(&class->lock);
+	read_unlock(&pool->migrate_lock);
+
+	if (fg == ZS_EMPTY)
+		free_zs_page(pool, zpage);
+	kmem_cache_free(zs_handle_cachep, handle);
+}
+
+void *zs_map_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	read_lock(&pool->migrate_lock);
+	return kmap_atomic(handle->zpage->page, KM_USER1) +
+		handle->slot * handle->zpage->class->size;
+}
+
+void zs_unmap_object(struct zs_pool *pool, void *obj)
+{
+	kunmap_atomic(obj, KM_USER1);
+	read_unlock(&pool->migrate_lock);
+}
+
+/*
+ * Class has enough free slots that at least one page could be emptied.
+ */
+static int zs_can_compact(struct size_class *class)
+{
+	return class->pages * class->objs_per_page - class->objs_inuse >=
+		class->objs_per_page;
+}
+
+/*
+ * Page to move objects out of: the first almost empty one or else the
+ * last almost full one.
+ */
+static struct zs_page *find_src_zs_page(struct size_class *class)
+{
+	struct list_head *head;
+
+	head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zs_page, list);
+
+	head = &class->fullness_list[ZS_ALMOST_FULL];
+	if (!list_empty(head))
+		return list_entry(head->prev, struct zs_page, list);
+
+	return NULL;
+}
+
+static struct zs_page *find_dst_zs_page(struct size_class *class,
+					struct zs_page *src)
+{
+	enum fullness_group fg;
+	struct zs_page *zpage;
+
+	for (fg = ZS_ALMOST_FULL; fg <= ZS_ALMOST_EMPTY; fg++) {
+		list_for_each_entry(zpage, &class->fullness_list[fg], list) {
+			if (zpage != src)
+				return zpage;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Move objects from src to dst until src is empty or dst is full, and
+ * point their handles at the new location.
+ */
+static void migrate_zs_page(struct size_class *class, struct zs_page *src,
+			struct zs_page *dst)
+{
+	u16 s, d = 0;
+	unsigned char *s_addr, *d_addr;
+
+	s_addr = kmap_atomic(src->page, KM_USER0);
+	d_addr = kmap_atomic(dst->page, KM_USER1);
+
+	for (s = 0; src->inuse && s < class->objs_per_page; s++) {
+		struct zs_handle *handle = src->handles[s];
+
+		if (!handle)
+			continue;
+
+		while (dst->handles[d])
+			d++;
+
+		memcpy(d_addr + d * class->size, s_addr + s * class->size,
+			class->size);
+
+		src->handles[s] = NULL;
+		dst->handles[d] = handle;
+		handle->zpage = dst;
+		handle->slot = d;
+
+		src->inuse--;
+		dst->inuse++;
+		if (dst->inuse == class->objs_per_page)
+			break;
+	}
+
+	kunmap_atomic(d_addr, KM_USER1);
+	kunmap_atomic(s_addr, KM_USER0);
+}
+
+/*
+ * Each round either empties the source page or fills the destination,
+ * so the number of partially used pages shrinks until no page can be
+ * freed anymore.
+ */
+static unsigned long compact_size_class(struct zs_pool *pool,
+					struct size_class *class)
+{
+	unsigned long freed = 0;
+
+	for (;;) {
+		struct zs_page *src, *dst;
+		enum fullness_group fg = ZS_ALMOST_EMPTY;
+
+		write_lock(&pool->migrate_lock);
+		spin_lock(&class->lock);
+
+		src = zs_can_compact(class) ? find_src_zs_page(class) : NULL;
+		dst = src ? find_dst_zs_page(class, src) : NULL;
+
+		if (dst) {
+			migrate_zs_page(class, src, dst);
+			fix_fullness_group(class, dst);
+			fg = fix_fullness_group(class, src);
+			if (fg == ZS_EMPTY)
+				class->pages--;
+		}
+
+		spin_unlock(&class->lock);
+		write_unlock(&pool->migrate_lock);
+
+		if (!dst)
+			break;
+
+		if (fg == ZS_EMPTY) {
+			free_zs_page(pool, src);
+			freed++;
+		}
+
+		cond_resched();
+	}
+
+	return freed;
+}
+
+/*
+ * Returns number of pages released by moving objects together.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = 0; i < ZS_NR_SIZE_CLASSES; i++) {
+		struct size_class *class = pool->size_class[i];
+
+		if (class->index != i || class->objs_per_page == 1)
+			continue;
+
+		freed += compact_size_class(pool, class);
+	}
+
+	return freed;
+}
+
+/*
+ * Returns the number of pages zs_compact() could release at most.
+ */
+unsigned long zs_get_compactable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_NR_SIZE_CLASSES; i++) {
+		struct size_class *class = pool->size_class[i];
+
+		if (class->index != i)
+			continue;
+
+		spin_lock(&class->lock);
+		pages += (class->pages * class->objs_per_page -
+			  class->objs_inuse) / class->objs_per_page;
+		spin_unlock(&class->lock);
+	}
+
+	return pages;
+}
+
+/*
+ * Returns total memory used by allocator (userdata only; descriptors
+ * and handles come from the slab)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_read(&pool->total_pages) << PAGE_SHIFT;
+}
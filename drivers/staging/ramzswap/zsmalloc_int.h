@@ -0,0 +1,95 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/* Size classes are separated by ZS_SIZE_CLASS_DELTA bytes */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_NR_SIZE_CLASSES	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+				/ ZS_SIZE_CLASS_DELTA + 1)
+
+/* End of user params */
+
+#define ZS_MAX_OBJS_PER_PAGE	(PAGE_SIZE / ZS_MIN_ALLOC_SIZE)
+
+/*
+ * Pages of a class are kept on one list per fullness group. Allocation
+ * prefers almost full pages; compaction moves objects out of almost
+ * empty pages. Empty pages are freed at once.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,		/* more than 3/4 of the objects in use */
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+/*
+ * What callers get back from zs_malloc(). It stays put while compaction
+ * moves the object it refers to.
+ */
+struct zs_handle {
+	struct zs_page *zpage;
+	u16 slot;
+};
+
+/* One zero-order page holding objects of a single size class */
+struct zs_page {
+	struct list_head list;	/* in class->fullness_list */
+	struct page *page;
+	struct size_class *class;
+	u16 inuse;
+	u8 fullness;
+	/* owner of each slot, NULL while free */
+	struct zs_handle *handles[0];
+};
+
+struct size_class {
+	spinlock_t lock;
+	u32 size;		/* object size in bytes */
+	u16 objs_per_page;
+	u16 index;		/* first index in pool->size_class */
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	u32 pages;
+	u32 objs_inuse;
+};
+
+struct zs_pool {
+	/*
+	 * Sizes that fit the same number of objects in a page share the
+	 * largest of their classes.
+	 */
+	struct size_class *size_class[ZS_NR_SIZE_CLASSES];
+
+	/*
+	 * Held for read while an object is mapped or freed and for write
+	 * while compaction moves objects.
+	 */
+	rwlock_t migrate_lock;
+
+	/* stats */
+	atomic_t total_pages;
+};
+
+#endif
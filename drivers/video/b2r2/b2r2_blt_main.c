@@ -34,6 +34,7 @@
 #include <linux/sched.h>
 #include <linux/err.h>
 #include <linux/hwmem.h>
+#include <linux/syscalls.h>
 
 #include "b2r2_internal.h"
 #include "b2r2_node_split.h"
@@ -48,6 +49,9 @@
 #define B2R2_HEAP_SIZE (4 * PAGE_SIZE)
 #define MAX_TMP_BUF_SIZE (128 * PAGE_SIZE)
 
+/* One region per image plane */
+#define MAX_IMG_REGIONS 3
+
 /*
  * TODO:
  * Implementation of query cap
@@ -124,6 +128,31 @@ static unsigned long stat_n_in_open;
  * stat_n_in_release - Number of clients currently in b2r2_blt_release
  */
 static unsigned long stat_n_in_release;
+/**
+ * stat_n_batches - Number of batches added to b2r2_core
+ */
+static unsigned long stat_n_batches;
+/**
+ * stat_n_batched_blts - Number of blits added as part of a batch
+ */
+static unsigned long stat_n_batched_blts;
+/**
+ * stat_batch_*_nsec - Time from a batch was issued until it was done, i.e.
+ *                     the cost of composing one frame
+ */
+static u32 stat_batch_last_nsec;
+static u32 stat_batch_max_nsec;
+static u64 stat_batch_total_nsec;
+/**
+ * stat_n_cache_syncs - Number of blits whose buffers have been synchronized
+ */
+static unsigned long stat_n_cache_syncs;
+/**
+ * stat_cache_sync_*_nsec - Time spent on cache maintenance per blit
+ */
+static u32 stat_cache_sync_last_nsec;
+static u32 stat_cache_sync_max_nsec;
+static u64 stat_cache_sync_total_nsec;
 
 /* Debug file system support */
 #ifdef CONFIG_DEBUG_FS
@@ -142,14 +171,32 @@ static int sprintf_req(struct b2r2_blt_request *request, char *buf, int size);
 /* Local functions */
 static void inc_stat(unsigned long *stat);
 static void dec_stat(unsigned long *stat);
+static void add_batch_stat(u32 nsec, u32 n_blts);
+static s32 add_cache_sync_stat(struct b2r2_blt_request *request);
 static int b2r2_blt_synch(struct b2r2_blt_instance *instance,
 			int request_id);
 static int b2r2_blt_query_cap(struct b2r2_blt_instance *instance,
 			struct b2r2_blt_query_cap *query_cap);
+static struct b2r2_blt_request *request_from_user(
+		struct b2r2_blt_instance *instance,
+		const struct b2r2_blt_req __user *user_req);
 
 #ifndef CONFIG_B2R2_GENERIC_ONLY
 static int b2r2_blt(struct b2r2_blt_instance *instance,
 		struct b2r2_blt_request *request);
+static int b2r2_blt_batch(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_batch *batch, struct b2r2_fence *in_fence,
+		struct b2r2_fence *out_fence);
+static int b2r2_blt_fenced(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_fenced_req __user *user_fenced_req);
+static int b2r2_blt_fenced_batch(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_fenced_batch __user *user_fenced_batch);
+static int prepare_request(struct b2r2_blt_request *request);
+static void unresolve_request_bufs(struct b2r2_blt_request *request);
+static void sync_request_bufs(struct b2r2_blt_request *request);
+static struct b2r2_node *last_node_of(struct b2r2_blt_request *request);
+static void set_up_job(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_request *request, struct b2r2_node *last_node);
 
 static void job_callback(struct b2r2_core_job *job);
 static void job_release(struct b2r2_core_job *job);
@@ -184,8 +231,8 @@ static bool is_report_list_empty(struct b2r2_blt_instance *instance);
 static bool is_synching(struct b2r2_blt_instance *instance);
 static void get_actual_dst_rect(struct b2r2_blt_req *req,
 					struct b2r2_blt_rect *actual_dst_rect);
-static void set_up_hwmem_region(struct b2r2_blt_img *img,
-		struct b2r2_blt_rect *rect, struct hwmem_region *region);
+static u32 set_up_img_regions(struct b2r2_blt_img *img,
+		struct b2r2_blt_rect *rect, struct hwmem_region *regions);
 static int resolve_hwmem(struct b2r2_blt_img *img,
 			struct b2r2_blt_rect *rect_2b_used, bool is_dst,
 				struct b2r2_resolved_buf *resolved_buf);
@@ -201,6 +248,8 @@ struct sync_args {
 	unsigned long start;
 	unsigned long end;
 };
+static void sync_range(struct sync_args *sa, u32 start_phys, u32 end_phys,
+		bool is_dst);
 /**
  * flush_l1_cache_range_curr_cpu() - Cleans and invalidates L1 cache on the current CPU
  *
@@ -375,6 +424,85 @@ static int b2r2_blt_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/**
+ * request_from_user - Allocates a request and fills it in from user space
+ *
+ * @instance: The B2R2 BLT instance
+ * @user_req: User pointer to the struct b2r2_blt_req
+ *
+ * Returns the request or an ERR_PTR
+ */
+static struct b2r2_blt_request *request_from_user(
+		struct b2r2_blt_instance *instance,
+		const struct b2r2_blt_req __user *user_req)
+{
+	struct b2r2_blt_request *request =
+		kmalloc(sizeof(*request), GFP_KERNEL);
+	if (!request) {
+		b2r2_log_err("%s: Failed to alloc mem\n",
+			__func__);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* Initialize the structure */
+	memset(request, 0, sizeof(*request));
+	INIT_LIST_HEAD(&request->list);
+	request->instance = instance;
+
+	/*
+	 * The user request is a sub structure of the
+	 * kernel request structure.
+	 */
+
+	/* Get the user data */
+	if (copy_from_user(&request->user_req, user_req,
+			sizeof(request->user_req))) {
+		b2r2_log_err(
+			"%s: copy_from_user failed\n",
+			__func__);
+		kfree(request);
+		return ERR_PTR(-EFAULT);
+	}
+
+	if (!b2r2_validate_user_req(&request->user_req)) {
+		kfree(request);
+		return ERR_PTR(-EINVAL);
+	}
+
+	request->profile = is_profiler_registered_approx();
+
+	/*
+	 * If the user specified a color look-up table,
+	 * make a copy that the HW can use.
+	 */
+	if ((request->user_req.flags &
+			B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION) != 0) {
+		request->clut = dma_alloc_coherent(b2r2_blt_device(),
+			CLUT_SIZE, &(request->clut_phys_addr),
+			GFP_DMA | GFP_KERNEL);
+		if (request->clut == NULL) {
+			b2r2_log_err("%s CLUT allocation failed.\n",
+				__func__);
+			kfree(request);
+			return ERR_PTR(-ENOMEM);
+		}
+
+		if (copy_from_user(request->clut,
+				request->user_req.clut, CLUT_SIZE)) {
+			b2r2_log_err("%s: CLUT copy_from_user failed\n",
+				__func__);
+			dma_free_coherent(b2r2_blt_device(), CLUT_SIZE,
+				request->clut, request->clut_phys_addr);
+			request->clut = NULL;
+			request->clut_phys_addr = 0;
+			kfree(request);
+			return ERR_PTR(-EFAULT);
+		}
+	}
+
+	return request;
+}
+
 /**
  * b2r2_blt_ioctl - This routine implements b2r2_blt ioctl interface
  *
@@ -403,68 +531,9 @@ static long b2r2_blt_ioctl(struct file *file,
 
 		/* arg is user pointer to struct b2r2_blt_request */
 		struct b2r2_blt_request *request =
-			kmalloc(sizeof(*request), GFP_KERNEL);
-		if (!request) {
-			b2r2_log_err("%s: Failed to alloc mem\n",
-				__func__);
-			return -ENOMEM;
-		}
-
-		/* Initialize the structure */
-		memset(request, 0, sizeof(*request));
-		INIT_LIST_HEAD(&request->list);
-		request->instance = instance;
-
-		/*
-		 * The user request is a sub structure of the
-		 * kernel request structure.
-		 */
-
-		/* Get the user data */
-		if (copy_from_user(&request->user_req, (void *)arg,
-				sizeof(request->user_req))) {
-			b2r2_log_err(
-				"%s: copy_from_user failed\n",
-				__func__);
-			kfree(request);
-			return -EFAULT;
-		}
-
-		if (!b2r2_validate_user_req(&request->user_req)) {
-			kfree(request);
-			return -EINVAL;
-		}
-
-		request->profile = is_profiler_registered_approx();
-
-		/*
-		 * If the user specified a color look-up table,
-		 * make a copy that the HW can use.
-		 */
-		if ((request->user_req.flags &
-				B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION) != 0) {
-			request->clut = dma_alloc_coherent(b2r2_blt_device(),
-				CLUT_SIZE, &(request->clut_phys_addr),
-				GFP_DMA | GFP_KERNEL);
-			if (request->clut == NULL) {
-				b2r2_log_err("%s CLUT allocation failed.\n",
-					__func__);
-				kfree(request);
-				return -ENOMEM;
-			}
-
-			if (copy_from_user(request->clut,
-					request->user_req.clut, CLUT_SIZE)) {
-				b2r2_log_err("%s: CLUT copy_from_user failed\n",
-					__func__);
-				dma_free_coherent(b2r2_blt_device(), CLUT_SIZE,
-					request->clut, request->clut_phys_addr);
-				request->clut = NULL;
-				request->clut_phys_addr = 0;
-				kfree(request);
-				return -EFAULT;
-			}
-		}
+			request_from_user(instance, (void __user *)arg);
+		if (IS_ERR(request))
+			return PTR_ERR(request);
 
 		/* Perform the blit */
 
@@ -553,6 +622,44 @@ static long b2r2_blt_ioctl(struct file *file,
 		break;
 	}
 
+	case B2R2_BLT_BATCH_IOC:
+	{
+		/* Arg is user pointer to struct b2r2_blt_batch */
+		struct b2r2_blt_batch batch;
+
+		if (copy_from_user(&batch, (void *)arg, sizeof(batch))) {
+			b2r2_log_err(
+				"%s: copy_from_user failed\n",
+				__func__);
+			return -EFAULT;
+		}
+
+#ifdef CONFIG_B2R2_GENERIC_ONLY
+		/* The generic path can't chain requests */
+		ret = -ENOSYS;
+#else
+		ret = b2r2_blt_batch(instance, &batch, NULL, NULL);
+#endif
+		break;
+	}
+
+	case B2R2_BLT_FENCED_IOC:
+#ifdef CONFIG_B2R2_GENERIC_ONLY
+		/* The generic path has no fences */
+		ret = -ENOSYS;
+#else
+		ret = b2r2_blt_fenced(instance, (void __user *)arg);
+#endif
+		break;
+
+	case B2R2_BLT_FENCED_BATCH_IOC:
+#ifdef CONFIG_B2R2_GENERIC_ONLY
+		ret = -ENOSYS;
+#else
+		ret = b2r2_blt_fenced_batch(instance, (void __user *)arg);
+#endif
+		break;
+
 	case B2R2_BLT_SYNCH_IOC:
 		/* This is the "synch" command */
 
@@ -765,10 +872,7 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		struct b2r2_blt_request *request)
 {
 	int ret = 0;
-	struct b2r2_blt_rect actual_dst_rect;
 	int request_id = 0;
-	struct b2r2_node *last_node = request->first_node;
-	int node_count;
 
 	u32 thread_runtime_at_start = 0;
 
@@ -825,7 +929,457 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 
 	dec_stat(&stat_n_in_blt_synch);
 
-	/* Resolve the buffers */
+	/* Resolve the buffers and build the node list */
+	ret = prepare_request(request);
+	if (ret < 0)
+		goto prepare_failed;
+
+	/* Exit here if dry run */
+	if (request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN)
+		goto exit_dry_run;
+
+	/* Configure the request */
+	set_up_job(instance, request, last_node_of(request));
+
+	/* Synchronize memory occupied by the buffers */
+	sync_request_bufs(request);
+	request->nsec_cache_sync = add_cache_sync_stat(request);
+
+#ifdef CONFIG_DEBUG_FS
+	/* Remember latest request for debugfs */
+	debugfs_latest_request = *request;
+#endif
+
+	/* Submit the job */
+	b2r2_log_info("%s: Submitting job\n", __func__);
+
+	inc_stat(&stat_n_in_blt_add);
+
+	if (request->profile)
+		request->nsec_active_in_cpu =
+			(s32)((u32)task_sched_runtime(current) -
+					thread_runtime_at_start);
+
+	mutex_lock(&instance->lock);
+
+	/* Add the job to b2r2_core */
+	request_id = b2r2_core_job_add(&request->job);
+	request->request_id = request_id;
+
+	dec_stat(&stat_n_in_blt_add);
+
+	if (request_id < 0) {
+		b2r2_log_warn("%s: Failed to add job, ret = %d\n",
+			__func__, request_id);
+		ret = request_id;
+		mutex_unlock(&instance->lock);
+		goto job_add_failed;
+	}
+
+	inc_stat(&stat_n_jobs_added);
+
+	instance->no_of_active_requests++;
+	mutex_unlock(&instance->lock);
+
+	/* Wait for the job to be done if synchronous */
+	if ((request->user_req.flags & B2R2_BLT_FLAG_ASYNCH) == 0) {
+		b2r2_log_info("%s: Synchronous, waiting\n",
+			__func__);
+
+		inc_stat(&stat_n_in_blt_wait);
+
+		ret = b2r2_core_job_wait(&request->job);
+
+		dec_stat(&stat_n_in_blt_wait);
+
+		if (ret < 0 && ret != -ENOENT)
+			b2r2_log_warn(
+				"%s: Failed to wait job, ret = %d\n",
+				__func__, ret);
+		else
+			b2r2_log_info(
+				"%s: Synchronous wait done\n", __func__);
+		ret = 0;
+	}
+
+	/*
+	 * Release matching the addref in b2r2_core_job_add,
+	 * the request must not be accessed after this call
+	 */
+	b2r2_core_job_release(&request->job, __func__);
+
+	dec_stat(&stat_n_in_blt);
+
+	return ret >= 0 ? request_id : ret;
+
+job_add_failed:
+exit_dry_run:
+	unresolve_request_bufs(request);
+prepare_failed:
+synch_interrupted:
+	job_release(&request->job);
+	dec_stat(&stat_n_jobs_released);
+	if ((request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN) == 0 || ret)
+		b2r2_log_warn(
+			"%s returns with error %d\n", __func__, ret);
+
+	dec_stat(&stat_n_in_blt);
+
+	return ret;
+}
+
+/**
+ * b2r2_blt_batch - Implementation of the B2R2 batch request
+ *
+ * @instance: The B2R2 BLT instance
+ * @batch: The batch received from user space
+ * @in_fence: Fence the batch shall wait for, or NULL
+ * @out_fence: Fence to signal when the batch is done, or NULL
+ *
+ * The node lists of all requests are chained into the job of the first
+ * request so the batch costs one job, one interrupt and one completion.
+ * Nothing is queued unless every request can take the optimized path.
+ */
+static int b2r2_blt_batch(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_batch *batch, struct b2r2_fence *in_fence,
+		struct b2r2_fence *out_fence)
+{
+	int ret = 0;
+	int request_id;
+	u32 i;
+	struct b2r2_blt_request *head = NULL;
+	struct b2r2_blt_request *tail = NULL;
+	u32 start_time_nsec = b2r2_get_curr_nsec();
+	u32 thread_runtime_at_start = (u32)task_sched_runtime(current);
+
+	b2r2_log_info("%s: count=%u\n", __func__, batch->count);
+
+	if (batch->count == 0 || batch->count > B2R2_BLT_MAX_BATCH)
+		return -EINVAL;
+
+	inc_stat(&stat_n_in_blt);
+
+	inc_stat(&stat_n_in_blt_synch);
+
+	/* Wait here if synch is ongoing */
+	ret = wait_event_interruptible(instance->synch_done_waitq,
+				!is_synching(instance));
+	dec_stat(&stat_n_in_blt_synch);
+	if (ret) {
+		b2r2_log_warn("%s: Sync wait interrupted, %d\n",
+			__func__, ret);
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		struct b2r2_blt_request *request =
+			kzalloc(sizeof(*request), GFP_KERNEL);
+		if (!request) {
+			b2r2_log_err("%s: Failed to alloc mem\n", __func__);
+			ret = -ENOMEM;
+			goto prepare_failed;
+		}
+
+		INIT_LIST_HEAD(&request->list);
+		request->instance = instance;
+
+		if (copy_from_user(&request->user_req,
+				(void __user *)&batch->reqs[i],
+				sizeof(request->user_req))) {
+			b2r2_log_err("%s: copy_from_user failed\n", __func__);
+			kfree(request);
+			ret = -EFAULT;
+			goto prepare_failed;
+		}
+
+		if (!b2r2_validate_user_req(&request->user_req)) {
+			kfree(request);
+			ret = -EINVAL;
+			goto prepare_failed;
+		}
+
+		/* Such requests must be issued one by one */
+		if (request->user_req.flags &
+				(B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION |
+					B2R2_BLT_FLAG_DRY_RUN)) {
+			kfree(request);
+			ret = -ENOSYS;
+			goto prepare_failed;
+		}
+
+		ret = prepare_request(request);
+		if (ret < 0) {
+			job_release(&request->job);
+			dec_stat(&stat_n_jobs_released);
+			goto prepare_failed;
+		}
+
+		/* Let B2R2 continue with this request's nodes */
+		if (tail == NULL)
+			head = request;
+		else {
+			last_node_of(tail)->node.GROUP0.B2R2_NIP =
+				request->first_node->physical_address;
+			tail->batch_next = request;
+		}
+		tail = request;
+	}
+
+	/* The batch completes, and reports, as one request */
+	head->user_req.flags &= ~(B2R2_BLT_FLAG_ASYNCH |
+				B2R2_BLT_FLAG_REPORT_WHEN_DONE);
+	head->user_req.flags |= batch->flags & (B2R2_BLT_FLAG_ASYNCH |
+				B2R2_BLT_FLAG_REPORT_WHEN_DONE);
+	head->user_req.prio = batch->prio;
+	head->user_req.report1 = batch->report1;
+	head->user_req.report2 = batch->report2;
+	head->batch_count = batch->count;
+	head->profile = is_profiler_registered_approx();
+	head->start_time_nsec = start_time_nsec;
+	if (in_fence)
+		head->in_fence = b2r2_fence_get(in_fence);
+	if (out_fence)
+		head->out_fence = b2r2_fence_get(out_fence);
+
+	set_up_job(instance, head, last_node_of(tail));
+
+	for (tail = head; tail != NULL; tail = tail->batch_next) {
+		sync_request_bufs(tail);
+		head->nsec_cache_sync += add_cache_sync_stat(tail);
+	}
+
+#ifdef CONFIG_DEBUG_FS
+	debugfs_latest_request = *head;
+#endif
+
+	inc_stat(&stat_n_in_blt_add);
+
+	head->nsec_active_in_cpu = (s32)((u32)task_sched_runtime(current) -
+					thread_runtime_at_start);
+
+	mutex_lock(&instance->lock);
+
+	request_id = b2r2_core_job_add(&head->job);
+	head->request_id = request_id;
+
+	dec_stat(&stat_n_in_blt_add);
+
+	if (request_id < 0) {
+		b2r2_log_warn("%s: Failed to add job, ret = %d\n",
+			__func__, request_id);
+		ret = request_id;
+		mutex_unlock(&instance->lock);
+		goto job_add_failed;
+	}
+
+	inc_stat(&stat_n_jobs_added);
+
+	instance->no_of_active_requests++;
+	mutex_unlock(&instance->lock);
+
+	if ((batch->flags & B2R2_BLT_FLAG_ASYNCH) == 0) {
+		inc_stat(&stat_n_in_blt_wait);
+
+		ret = b2r2_core_job_wait(&head->job);
+
+		dec_stat(&stat_n_in_blt_wait);
+
+		if (ret < 0 && ret != -ENOENT)
+			b2r2_log_warn("%s: Failed to wait job, ret = %d\n",
+				__func__, ret);
+		ret = 0;
+	}
+
+	/* Release matching the addref in b2r2_core_job_add */
+	b2r2_core_job_release(&head->job, __func__);
+
+	dec_stat(&stat_n_in_blt);
+
+	return request_id;
+
+job_add_failed:
+prepare_failed:
+	/* Releasing the head releases the whole chain */
+	for (tail = head; tail != NULL; tail = tail->batch_next)
+		unresolve_request_bufs(tail);
+	if (head != NULL) {
+		job_release(&head->job);
+		dec_stat(&stat_n_jobs_released);
+	}
+out:
+	b2r2_log_warn("%s returns with error %d\n", __func__, ret);
+
+	dec_stat(&stat_n_in_blt);
+
+	return ret;
+}
+
+/**
+ * get_fences - Gets the fences of a fenced ioctl
+ *
+ * @in_fd: File descriptor of the input fence, or -1
+ * @in_fence: Returns the input fence, or NULL
+ * @out_fence: Returns a new output fence
+ *
+ * Returns 0 if OK else a negative error code. The caller shall put the
+ * fences with put_fences().
+ */
+static int get_fences(s32 in_fd, struct b2r2_fence **in_fence,
+		struct b2r2_fence **out_fence)
+{
+	*in_fence = NULL;
+	if (in_fd >= 0) {
+		*in_fence = b2r2_fence_fdget(in_fd);
+		if (IS_ERR(*in_fence))
+			return PTR_ERR(*in_fence);
+	}
+
+	*out_fence = b2r2_fence_create();
+	if (*out_fence == NULL) {
+		if (*in_fence)
+			b2r2_fence_put(*in_fence);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void put_fences(struct b2r2_fence *in_fence,
+		struct b2r2_fence *out_fence)
+{
+	if (in_fence)
+		b2r2_fence_put(in_fence);
+	b2r2_fence_put(out_fence);
+}
+
+/**
+ * export_out_fence - Hands the output fence of a queued request to user space
+ *
+ * @out_fence: The fence
+ * @user_fd: Where to return the file descriptor
+ *
+ * Returns 0 if OK else a negative error code. The request stays queued
+ * regardless.
+ */
+static int export_out_fence(struct b2r2_fence *out_fence,
+		__s32 __user *user_fd)
+{
+	int fd = b2r2_fence_install_fd(out_fence);
+
+	if (fd < 0) {
+		b2r2_log_warn("%s: Failed to install fence fd, %d\n",
+			__func__, fd);
+		return fd;
+	}
+
+	if (put_user(fd, user_fd)) {
+		sys_close(fd);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/**
+ * b2r2_blt_fenced - Implementation of the fenced B2R2 blit request
+ *
+ * @instance: The B2R2 BLT instance
+ * @user_fenced_req: The request in user space
+ */
+static int b2r2_blt_fenced(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_fenced_req __user *user_fenced_req)
+{
+	int ret;
+	s32 in_fd;
+	struct b2r2_fence *in_fence;
+	struct b2r2_fence *out_fence;
+	struct b2r2_blt_request *request;
+
+	if (get_user(in_fd, &user_fenced_req->in_fence))
+		return -EFAULT;
+
+	ret = get_fences(in_fd, &in_fence, &out_fence);
+	if (ret < 0)
+		return ret;
+
+	request = request_from_user(instance, &user_fenced_req->req);
+	if (IS_ERR(request)) {
+		ret = PTR_ERR(request);
+		goto out;
+	}
+
+	if (in_fence)
+		request->in_fence = b2r2_fence_get(in_fence);
+	request->out_fence = b2r2_fence_get(out_fence);
+
+	/* No generic fallback, it does not know about fences */
+	ret = b2r2_blt(instance, request);
+	if (ret >= 0) {
+		int export_ret = export_out_fence(out_fence,
+				&user_fenced_req->out_fence);
+		if (export_ret < 0)
+			ret = export_ret;
+	}
+
+out:
+	put_fences(in_fence, out_fence);
+
+	return ret;
+}
+
+/**
+ * b2r2_blt_fenced_batch - Implementation of the fenced B2R2 batch request
+ *
+ * @instance: The B2R2 BLT instance
+ * @user_fenced_batch: The batch in user space
+ */
+static int b2r2_blt_fenced_batch(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_fenced_batch __user *user_fenced_batch)
+{
+	int ret;
+	struct b2r2_blt_fenced_batch fenced_batch;
+	struct b2r2_fence *in_fence;
+	struct b2r2_fence *out_fence;
+
+	if (copy_from_user(&fenced_batch, user_fenced_batch,
+			sizeof(fenced_batch))) {
+		b2r2_log_err("%s: copy_from_user failed\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = get_fences(fenced_batch.in_fence, &in_fence, &out_fence);
+	if (ret < 0)
+		return ret;
+
+	ret = b2r2_blt_batch(instance, &fenced_batch.batch, in_fence,
+			out_fence);
+	if (ret >= 0) {
+		int export_ret = export_out_fence(out_fence,
+				&user_fenced_batch->out_fence);
+		if (export_ret < 0)
+			ret = export_ret;
+	}
+
+	put_fences(in_fence, out_fence);
+
+	return ret;
+}
+
+/**
+ * prepare_request - Resolves the buffers and builds the node list of a
+ *                   request, everything but submitting the job
+ *
+ * @request: The request to prepare
+ *
+ * Returns 0 if OK, -ENOSYS if there is no optimized path for the request,
+ * else a negative error code. The buffers are unresolved on failure.
+ */
+static int prepare_request(struct b2r2_blt_request *request)
+{
+	int ret;
+	struct b2r2_blt_rect actual_dst_rect;
+	int node_count;
 
 	/* Source buffer */
 	ret = resolve_buf(&request->user_req.src_img,
@@ -889,7 +1443,7 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		/* There was no optimized path for this request */
 		b2r2_log_info(
 			"%s: No optimized path for request\n", __func__);
-		goto no_optimized_path;
+		goto generate_nodes_failed;
 
 	} else if (ret < 0) {
 		b2r2_log_warn(
@@ -922,6 +1476,7 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		b2r2_log_warn(
 			"%s: Failed to allocate nodes, ret = %d\n",
 			__func__, ret);
+		ret = -ENOMEM;
 		goto generate_nodes_failed;
 	}
 #else
@@ -930,6 +1485,8 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		b2r2_log_warn(
 			"%s: Failed to allocate nodes, ret = %d\n",
 			__func__, ret);
+		if (ret >= 0)
+			ret = -ENOMEM;
 		goto generate_nodes_failed;
 	}
 #endif
@@ -945,28 +1502,43 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		goto generate_nodes_failed;
 	}
 
-	/* Exit here if dry run */
-	if (request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN)
-		goto exit_dry_run;
-
-	/* Configure the request */
-	last_node = request->first_node;
-	while (last_node && last_node->next)
-		last_node = last_node->next;
+	return 0;
 
-	request->job.tag = (int) instance;
-	request->job.prio = request->user_req.prio;
-	request->job.first_node_address =
-		request->first_node->physical_address;
-	request->job.last_node_address =
-		last_node->physical_address;
-	request->job.callback = job_callback;
-	request->job.release = job_release;
-	request->job.acquire_resources = job_acquire_resources;
-	request->job.release_resources = job_release_resources;
+generate_nodes_failed:
+	unresolve_buf(&request->user_req.dst_img.buf,
+		&request->dst_resolved);
+resolve_dst_buf_failed:
+	unresolve_buf(&request->user_req.src_mask.buf,
+		&request->src_mask_resolved);
+resolve_src_mask_buf_failed:
+	unresolve_buf(&request->user_req.src_img.buf,
+		&request->src_resolved);
+resolve_src_buf_failed:
+	return ret;
+}
 
-	/* Synchronize memory occupied by the buffers */
+/**
+ * unresolve_request_bufs - Unresolves the buffers of a prepared request
+ *
+ * @request: The request
+ */
+static void unresolve_request_bufs(struct b2r2_blt_request *request)
+{
+	unresolve_buf(&request->user_req.src_img.buf,
+		&request->src_resolved);
+	unresolve_buf(&request->user_req.src_mask.buf,
+		&request->src_mask_resolved);
+	unresolve_buf(&request->user_req.dst_img.buf,
+		&request->dst_resolved);
+}
 
+/**
+ * sync_request_bufs - Synchronizes the memory of a request's buffers
+ *
+ * @request: The request
+ */
+static void sync_request_bufs(struct b2r2_blt_request *request)
+{
 	/* Source buffer */
 	if (!(request->user_req.flags &
 				B2R2_BLT_FLAG_SRC_NO_CACHE_FLUSH) &&
@@ -1002,97 +1574,44 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 			&request->dst_resolved,
 			true, /*is_dst*/
 			&request->user_req.dst_rect);
+}
 
-#ifdef CONFIG_DEBUG_FS
-	/* Remember latest request for debugfs */
-	debugfs_latest_request = *request;
-#endif
-
-	/* Submit the job */
-	b2r2_log_info("%s: Submitting job\n", __func__);
-
-	inc_stat(&stat_n_in_blt_add);
-
-	if (request->profile)
-		request->nsec_active_in_cpu =
-			(s32)((u32)task_sched_runtime(current) -
-					thread_runtime_at_start);
-
-	mutex_lock(&instance->lock);
-
-	/* Add the job to b2r2_core */
-	request_id = b2r2_core_job_add(&request->job);
-	request->request_id = request_id;
-
-	dec_stat(&stat_n_in_blt_add);
-
-	if (request_id < 0) {
-		b2r2_log_warn("%s: Failed to add job, ret = %d\n",
-			__func__, request_id);
-		ret = request_id;
-		mutex_unlock(&instance->lock);
-		goto job_add_failed;
-	}
-
-	inc_stat(&stat_n_jobs_added);
-
-	instance->no_of_active_requests++;
-	mutex_unlock(&instance->lock);
-
-	/* Wait for the job to be done if synchronous */
-	if ((request->user_req.flags & B2R2_BLT_FLAG_ASYNCH) == 0) {
-		b2r2_log_info("%s: Synchronous, waiting\n",
-			__func__);
-
-		inc_stat(&stat_n_in_blt_wait);
-
-		ret = b2r2_core_job_wait(&request->job);
-
-		dec_stat(&stat_n_in_blt_wait);
-
-		if (ret < 0 && ret != -ENOENT)
-			b2r2_log_warn(
-				"%s: Failed to wait job, ret = %d\n",
-				__func__, ret);
-		else
-			b2r2_log_info(
-				"%s: Synchronous wait done\n", __func__);
-		ret = 0;
-	}
-
-	/*
-	 * Release matching the addref in b2r2_core_job_add,
-	 * the request must not be accessed after this call
-	 */
-	b2r2_core_job_release(&request->job, __func__);
-
-	dec_stat(&stat_n_in_blt);
-
-	return ret >= 0 ? request_id : ret;
+/**
+ * last_node_of - Returns the last node in a request's node list
+ *
+ * @request: The request
+ */
+static struct b2r2_node *last_node_of(struct b2r2_blt_request *request)
+{
+	struct b2r2_node *last_node = request->first_node;
 
-job_add_failed:
-exit_dry_run:
-no_optimized_path:
-generate_nodes_failed:
-	unresolve_buf(&request->user_req.dst_img.buf,
-		&request->dst_resolved);
-resolve_dst_buf_failed:
-	unresolve_buf(&request->user_req.src_mask.buf,
-		&request->src_mask_resolved);
-resolve_src_mask_buf_failed:
-	unresolve_buf(&request->user_req.src_img.buf,
-		&request->src_resolved);
-resolve_src_buf_failed:
-synch_interrupted:
-	job_release(&request->job);
-	dec_stat(&stat_n_jobs_released);
-	if ((request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN) == 0 || ret)
-		b2r2_log_warn(
-			"%s returns with error %d\n", __func__, ret);
+	while (last_node && last_node->next)
+		last_node = last_node->next;
 
-	dec_stat(&stat_n_in_blt);
+	return last_node;
+}
 
-	return ret;
+/**
+ * set_up_job - Fills in the core job of a request
+ *
+ * @instance: The B2R2 BLT instance
+ * @request: The request owning the job
+ * @last_node: The node B2R2 shall stop at
+ */
+static void set_up_job(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_request *request, struct b2r2_node *last_node)
+{
+	request->job.tag = (int) instance;
+	request->job.prio = request->user_req.prio;
+	request->job.first_node_address =
+		request->first_node->physical_address;
+	request->job.last_node_address =
+		last_node->physical_address;
+	request->job.in_fence = request->in_fence;
+	request->job.callback = job_callback;
+	request->job.release = job_release;
+	request->job.acquire_resources = job_acquire_resources;
+	request->job.release_resources = job_release_resources;
 }
 
 /**
@@ -1104,6 +1623,7 @@ static void job_callback(struct b2r2_core_job *job)
 {
 	struct b2r2_blt_request *request =
 		container_of(job, struct b2r2_blt_request, job);
+	struct b2r2_blt_request *r;
 
 	if (b2r2_blt_device())
 		b2r2_log_info("%s\n", __func__);
@@ -1111,13 +1631,19 @@ static void job_callback(struct b2r2_core_job *job)
 	/* Local addref / release within this func */
 	b2r2_core_job_addref(job, __func__);
 
-	/* Unresolve the buffers */
-	unresolve_buf(&request->user_req.src_img.buf,
-		&request->src_resolved);
-	unresolve_buf(&request->user_req.src_mask.buf,
-		&request->src_mask_resolved);
-	unresolve_buf(&request->user_req.dst_img.buf,
-		&request->dst_resolved);
+	/* Unresolve the buffers of the request and the rest of its batch */
+	for (r = request; r != NULL; r = r->batch_next)
+		unresolve_request_bufs(r);
+
+	/* The buffers may be used by whoever waits for the fence now */
+	if (request->out_fence)
+		b2r2_fence_signal(request->out_fence,
+			job->job_state == B2R2_CORE_JOB_CANCELED ?
+				-ECANCELED : 0);
+
+	if (request->batch_count)
+		add_batch_stat(b2r2_get_curr_nsec() - request->start_time_nsec,
+				request->batch_count);
 
 	/* Move to report list if the job shall be reported */
 	/* FIXME: Use a smaller struct? */
@@ -1194,25 +1720,40 @@ static void job_release(struct b2r2_core_job *job)
 	b2r2_log_info("%s, first_node=%p, ref_count=%d\n",
 		__func__, request->first_node, request->job.ref_count);
 
-	b2r2_node_split_cancel(&request->node_split_job);
+	/* Nothing happens if the job callback has signaled it already */
+	if (request->out_fence) {
+		b2r2_fence_signal(request->out_fence, -ECANCELED);
+		b2r2_fence_put(request->out_fence);
+	}
+	if (request->in_fence)
+		b2r2_fence_put(request->in_fence);
 
-	if (request->first_node) {
-		b2r2_debug_job_done(request->first_node);
+	/* The rest of a batch is released together with its first request */
+	while (request != NULL) {
+		struct b2r2_blt_request *next = request->batch_next;
+
+		b2r2_node_split_cancel(&request->node_split_job);
+
+		if (request->first_node) {
+			b2r2_debug_job_done(request->first_node);
 #ifdef B2R2_USE_NODE_GEN
-		b2r2_blt_free_nodes(request->first_node);
+			b2r2_blt_free_nodes(request->first_node);
 #else
-		b2r2_node_free(request->first_node);
+			b2r2_node_free(request->first_node);
 #endif
-	}
+		}
 
-	/* Release memory for the request */
-	if (request->clut != NULL) {
-		dma_free_coherent(b2r2_blt_device(), CLUT_SIZE, request->clut,
-				request->clut_phys_addr);
-		request->clut = NULL;
-		request->clut_phys_addr = 0;
+		/* Release memory for the request */
+		if (request->clut != NULL) {
+			dma_free_coherent(b2r2_blt_device(), CLUT_SIZE,
+				request->clut, request->clut_phys_addr);
+			request->clut = NULL;
+			request->clut_phys_addr = 0;
+		}
+		kfree(request);
+
+		request = next;
 	}
-	kfree(request);
 }
 
 /**
@@ -1228,20 +1769,29 @@ static int job_acquire_resources(struct b2r2_core_job *job, bool atomic)
 {
 	struct b2r2_blt_request *request =
 		container_of(job, struct b2r2_blt_request, job);
+	struct b2r2_blt_request *r;
+	u32 buf_count = 0;
 	int ret;
 	int i;
 
 	b2r2_log_info("%s\n", __func__);
 
-	if (request->buf_count == 0)
-		return 0;
-
-	if (request->buf_count > MAX_TMP_BUFS_NEEDED) {
-		b2r2_log_err("%s: request->buf_count > MAX_TMP_BUFS_NEEDED\n",
-								__func__);
-		return -ENOMSG;
+	/*
+	 * The requests of a batch are executed one after the other so they
+	 * can all use the same temp buffers.
+	 */
+	for (r = request; r != NULL; r = r->batch_next) {
+		if (r->buf_count > MAX_TMP_BUFS_NEEDED) {
+			b2r2_log_err("%s: request->buf_count > "
+				"MAX_TMP_BUFS_NEEDED\n", __func__);
+			return -ENOMSG;
+		}
+		buf_count = max(buf_count, r->buf_count);
 	}
 
+	if (buf_count == 0)
+		return 0;
+
 	/*
 	 * 1 to 1 mapping between request temp buffers and temp buffers
 	 * (request temp buf 0 is always temp buf 0, request temp buf 1 is
@@ -1253,26 +1803,30 @@ static int job_acquire_resources(struct b2r2_core_job *job, bool atomic)
 	if (tmp_bufs[0].in_use)
 		return -EAGAIN;
 
-	for (i = 0; i < request->buf_count; i++) {
-		if (tmp_bufs[i].buf.size < request->bufs[i].size) {
-			b2r2_log_err("%s: tmp_bufs[i].buf.size < "
-					"request->bufs[i].size\n",
+	for (r = request; r != NULL; r = r->batch_next) {
+		if (r->buf_count == 0)
+			continue;
+
+		for (i = 0; i < r->buf_count; i++) {
+			if (tmp_bufs[i].buf.size < r->bufs[i].size) {
+				b2r2_log_err("%s: tmp_bufs[i].buf.size < "
+						"request->bufs[i].size\n",
 								__func__);
-			ret = -ENOMSG;
-			goto error;
-		}
+				ret = -ENOMSG;
+				goto error;
+			}
 
-		tmp_bufs[i].in_use = true;
-		request->bufs[i].phys_addr = tmp_bufs[i].buf.phys_addr;
-		request->bufs[i].virt_addr = tmp_bufs[i].buf.virt_addr;
+			tmp_bufs[i].in_use = true;
+			r->bufs[i].phys_addr = tmp_bufs[i].buf.phys_addr;
+			r->bufs[i].virt_addr = tmp_bufs[i].buf.virt_addr;
 
-		b2r2_log_info("%s: phys=%p, virt=%p\n",
-			__func__, (void *)request->bufs[i].phys_addr,
-			request->bufs[i].virt_addr);
+			b2r2_log_info("%s: phys=%p, virt=%p\n",
+				__func__, (void *)r->bufs[i].phys_addr,
+				r->bufs[i].virt_addr);
+		}
 
-		ret = b2r2_node_split_assign_buffers(&request->node_split_job,
-					request->first_node, request->bufs,
-					request->buf_count);
+		ret = b2r2_node_split_assign_buffers(&r->node_split_job,
+					r->first_node, r->bufs, r->buf_count);
 		if (ret < 0)
 			goto error;
 	}
@@ -1280,7 +1834,7 @@ static int job_acquire_resources(struct b2r2_core_job *job, bool atomic)
 	return 0;
 
 error:
-	for (i = 0; i < request->buf_count; i++)
+	for (i = 0; i < buf_count; i++)
 		tmp_bufs[i].in_use = false;
 
 	return ret;
@@ -1303,29 +1857,32 @@ static void job_release_resources(struct b2r2_core_job *job, bool atomic)
 
 	b2r2_log_info("%s\n", __func__);
 
-	/* Free any temporary buffers */
-	for (i = 0; i < request->buf_count; i++) {
+	for (; request != NULL; request = request->batch_next) {
+		/* Free any temporary buffers */
+		for (i = 0; i < request->buf_count; i++) {
 
-		b2r2_log_info("%s: freeing %d bytes\n",
-			__func__, request->bufs[i].size);
-		tmp_bufs[i].in_use = false;
-		memset(&request->bufs[i], 0, sizeof(request->bufs[i]));
-	}
-	request->buf_count = 0;
+			b2r2_log_info("%s: freeing %d bytes\n",
+				__func__, request->bufs[i].size);
+			tmp_bufs[i].in_use = false;
+			memset(&request->bufs[i], 0, sizeof(request->bufs[i]));
+		}
+		request->buf_count = 0;
 
-	/*
-	 * Early release of nodes
-	 * FIXME: If nodes are to be reused we don't want to release here
-	 */
-	if (!atomic && request->first_node) {
-		b2r2_debug_job_done(request->first_node);
+		/*
+		 * Early release of nodes
+		 * FIXME: If nodes are to be reused we don't want to release
+		 * here
+		 */
+		if (!atomic && request->first_node) {
+			b2r2_debug_job_done(request->first_node);
 
 #ifdef B2R2_USE_NODE_GEN
-		b2r2_blt_free_nodes(request->first_node);
+			b2r2_blt_free_nodes(request->first_node);
 #else
-		b2r2_node_free(request->first_node);
+			b2r2_node_free(request->first_node);
 #endif
-		request->first_node = NULL;
+			request->first_node = NULL;
+		}
 	}
 }
 
@@ -1807,6 +2364,8 @@ static int b2r2_generic_blt(struct b2r2_blt_instance *instance,
 			true, /*is_dst*/
 			&request->user_req.dst_rect);
 
+	request->nsec_cache_sync = add_cache_sync_stat(request);
+
 #ifdef CONFIG_DEBUG_FS
 	/* Remember latest request */
 	debugfs_latest_request = *request;
@@ -2252,43 +2811,117 @@ static void get_actual_dst_rect(struct b2r2_blt_req *req,
 							actual_dst_rect);
 }
 
-static void set_up_hwmem_region(struct b2r2_blt_img *img,
-		struct b2r2_blt_rect *rect, struct hwmem_region *region)
+/**
+ * set_up_img_regions() - Describes the part of each image plane that B2R2
+ *                        accesses for a rectangle
+ *
+ * @img: The image
+ * @rect: The rectangle
+ * @regions: Returns the regions, room for MAX_IMG_REGIONS
+ *
+ * Offsets are relative to the start of the buffer, not of the image.
+ *
+ * Returns the number of regions
+ */
+static u32 set_up_img_regions(struct b2r2_blt_img *img,
+		struct b2r2_blt_rect *rect, struct hwmem_region *regions)
 {
-	s32 img_size;
+	u32 pitch;
+	u32 plane_offset;
+	u32 start;
+	u32 end;
+	s32 chroma_y;
+	s32 chroma_rows;
+	s32 chroma_height;
 
-	memset(region, 0, sizeof(*region));
+	memset(regions, 0, sizeof(*regions) * MAX_IMG_REGIONS);
 
 	if (b2r2_is_zero_area_rect(rect))
-		return;
+		return 1;
+
+	if (b2r2_is_mb_fmt(img->fmt)) {
+		/* Macro block tiled, not worth the trouble */
+		regions[0].offset = (u32)img->buf.offset;
+		regions[0].count = 1;
+		regions[0].start = 0;
+		regions[0].end = (u32)b2r2_get_img_size(img);
+		regions[0].size = regions[0].end;
+
+		return 1;
+	}
+
+	pitch = b2r2_get_img_pitch(img);
+
+	if (b2r2_is_single_plane_fmt(img->fmt)) {
+		int bpp = b2r2_get_fmt_bpp(img->fmt);
+		s32 x = rect->x;
+		s32 x_end = rect->x + rect->width;
+
+		/* In 422 interleaved formats 2 pixels share chroma */
+		if (!b2r2_is_independent_pixel_fmt(img->fmt)) {
+			x &= ~1;
+			x_end = b2r2_align_up(x_end, 2);
+		}
+
+		regions[0].offset = (u32)(img->buf.offset + rect->y * pitch);
+		regions[0].count = (u32)rect->height;
+		regions[0].start = (u32)((x * bpp) / 8);
+		regions[0].end = (u32)b2r2_div_round_up(x_end * bpp, 8);
+		regions[0].size = pitch;
+
+		return 1;
+	}
 
-	img_size = b2r2_get_img_size(img);
+	/* Luma plane, 8 bits per pixel */
+	start = (u32)rect->x;
+	end = (u32)(rect->x + rect->width);
 
-	if (b2r2_is_single_plane_fmt(img->fmt) &&
-				b2r2_is_independent_pixel_fmt(img->fmt)) {
-		int img_fmt_bpp = b2r2_get_fmt_bpp(img->fmt);
-		u32 img_pitch = b2r2_get_img_pitch(img);
+	regions[0].offset = (u32)(img->buf.offset + rect->y * pitch);
+	regions[0].count = (u32)rect->height;
+	regions[0].start = start;
+	regions[0].end = end;
+	regions[0].size = pitch;
 
-		region->offset = (u32)(img->buf.offset + (rect->y *
-								img_pitch));
-		region->count = (u32)rect->height;
-		region->start = (u32)((rect->x * img_fmt_bpp) / 8);
-		region->end = (u32)b2r2_div_round_up(
-				(rect->x + rect->width) * img_fmt_bpp, 8);
-		region->size = img_pitch;
+	plane_offset = (u32)img->buf.offset + pitch * img->height;
+
+	if (b2r2_is_ycbcr420_fmt(img->fmt)) {
+		chroma_y = rect->y / 2;
+		chroma_rows = (rect->y + rect->height + 1) / 2 - chroma_y;
+		chroma_height = (img->height + 1) / 2;
 	} else {
-		/*
-		 * TODO: Locking entire buffer as a quick safe solution. In the
-		 * future we should lock less to avoid unecessary cache
-		 * synching. Pixel interleaved YCbCr formats should be quite
-		 * easy, just align start and stop points on 2.
-		 */
-		region->offset = (u32)img->buf.offset;
-		region->count = 1;
-		region->start = 0;
-		region->end = (u32)img_size;
-		region->size = (u32)img_size;
+		chroma_y = rect->y;
+		chroma_rows = rect->height;
+		chroma_height = img->height;
+	}
+
+	if (b2r2_is_ycbcrsp_fmt(img->fmt)) {
+		/* One CbCr pair per two luma pixels, same pitch as luma */
+		regions[1].offset = plane_offset + chroma_y * pitch;
+		regions[1].count = (u32)chroma_rows;
+		regions[1].start = start & ~1;
+		regions[1].end = (u32)b2r2_align_up(end, 2);
+		regions[1].size = pitch;
+
+		return 2;
+	}
+
+	/* Planar, the chroma planes have half the luma pitch unless 444 */
+	if (!b2r2_is_ycbcr444_fmt(img->fmt)) {
+		pitch >>= 1;
+		start >>= 1;
+		end = (u32)b2r2_div_round_up(end, 2);
 	}
+
+	regions[1].offset = plane_offset + chroma_y * pitch;
+	regions[1].count = (u32)chroma_rows;
+	regions[1].start = start;
+	regions[1].end = end;
+	regions[1].size = pitch;
+
+	regions[2] = regions[1];
+	regions[2].offset += pitch * chroma_height;
+
+	return 3;
 }
 
 static int resolve_hwmem(struct b2r2_blt_img *img,
@@ -2302,7 +2935,9 @@ static int resolve_hwmem(struct b2r2_blt_img *img,
 	enum hwmem_access required_access;
 	struct hwmem_mem_chunk mem_chunk;
 	size_t mem_chunk_length = 1;
-	struct hwmem_region region;
+	struct hwmem_region regions[MAX_IMG_REGIONS];
+	u32 num_regions;
+	u32 sync_start_nsec;
 
 	resolved_buf->hwmem_alloc =
 			hwmem_resolve_by_name(img->buf.hwmem_buf_name);
@@ -2347,9 +2982,18 @@ static int resolve_hwmem(struct b2r2_blt_img *img,
 	}
 	resolved_buf->file_physical_start = mem_chunk.paddr;
 
-	set_up_hwmem_region(img, rect_2b_used, &region);
-	return_value = hwmem_set_domain(resolved_buf->hwmem_alloc,
-				required_access, HWMEM_DOMAIN_SYNC, &region);
+	/*
+	 * hwmem knows the cache settings and domain of the buffer and only
+	 * does the cache maintenance that is needed, for the part of each
+	 * plane that we access.
+	 */
+	num_regions = set_up_img_regions(img, rect_2b_used, regions);
+	sync_start_nsec = b2r2_get_curr_nsec();
+	return_value = hwmem_set_domain_regions(resolved_buf->hwmem_alloc,
+			required_access, HWMEM_DOMAIN_SYNC, regions,
+			num_regions);
+	resolved_buf->nsec_cache_sync +=
+			(s32)(b2r2_get_curr_nsec() - sync_start_nsec);
 	if (return_value < 0) {
 		b2r2_log_info("%s: hwmem_set_domain failed, "
 				"error code: %i\n", __func__, return_value);
@@ -2546,14 +3190,16 @@ static void sync_buf(struct b2r2_blt_img *img,
 {
 	struct sync_args sa;
 	u32 start_phys, end_phys;
+	struct hwmem_region regions[MAX_IMG_REGIONS];
+	u32 num_regions;
+	u32 sync_start_nsec;
+	u32 i;
 
+	/* hwmem buffers were synchronized when put in the sync domain */
 	if (B2R2_BLT_PTR_NONE == img->buf.type ||
 			B2R2_BLT_PTR_HWMEM_BUF_NAME_OFFSET == img->buf.type)
 		return;
 
-	start_phys = resolved->physical_address;
-	end_phys = resolved->physical_address + img->buf.len;
-
 	/*
 	 * TODO: Very ugly. We should find out whether the memory is coherent in
 	 * some generic way but cache handling will be rewritten soon so there
@@ -2571,96 +3217,57 @@ static void sync_buf(struct b2r2_blt_img *img,
 		return;
 	}
 
-	/*
-	 * src_mask does not have rect.
-	 * Also flush full buffer for planar and semiplanar YUV formats
-	 */
-	if (rect == NULL ||
-			(img->fmt == B2R2_BLT_FMT_YUV420_PACKED_PLANAR) ||
-			(img->fmt == B2R2_BLT_FMT_YUV422_PACKED_PLANAR) ||
-			(img->fmt == B2R2_BLT_FMT_YUV444_PACKED_PLANAR) ||
-			(img->fmt == B2R2_BLT_FMT_YUV420_PACKED_SEMI_PLANAR) ||
-			(img->fmt == B2R2_BLT_FMT_YUV422_PACKED_SEMI_PLANAR) ||
-			(img->fmt ==
-				B2R2_BLT_FMT_YUV420_PACKED_SEMIPLANAR_MB_STE) ||
-			(img->fmt ==
-				B2R2_BLT_FMT_YUV422_PACKED_SEMIPLANAR_MB_STE)) {
-		sa.start = (unsigned long)resolved->virtual_address;
-		sa.end = (unsigned long)resolved->virtual_address +
-			img->buf.len;
-		start_phys = resolved->physical_address;
-		end_phys = resolved->physical_address + img->buf.len;
+	sync_start_nsec = b2r2_get_curr_nsec();
+
+	if (rect == NULL) {
+		/* src_mask does not have rect */
+		memset(regions, 0, sizeof(regions));
+		regions[0].offset = img->buf.offset;
+		regions[0].count = 1;
+		regions[0].start = 0;
+		regions[0].end = img->buf.len;
+		regions[0].size = img->buf.len;
+		num_regions = 1;
 	} else {
-		/*
-		 * buffer is not a src_mask so make use of rect when
-		 * clean & flush caches
-		 */
-		u32 bpp;	/* Bits per pixel */
-		u32 pitch;
-
-		switch (img->fmt) {
-		case B2R2_BLT_FMT_16_BIT_ARGB4444: /* Fall through */
-		case B2R2_BLT_FMT_16_BIT_ARGB1555: /* Fall through */
-		case B2R2_BLT_FMT_16_BIT_RGB565:   /* Fall through */
-		case B2R2_BLT_FMT_Y_CB_Y_CR:       /* Fall through */
-		case B2R2_BLT_FMT_CB_Y_CR_Y:
-			bpp = 16;
-			break;
-		case B2R2_BLT_FMT_24_BIT_RGB888:   /* Fall through */
-		case B2R2_BLT_FMT_24_BIT_ARGB8565: /* Fall through */
-		case B2R2_BLT_FMT_24_BIT_YUV888:
-		case B2R2_BLT_FMT_24_BIT_VUY888:
-			bpp =  24;
-			break;
-		case B2R2_BLT_FMT_32_BIT_ARGB8888: /* Fall through */
-		case B2R2_BLT_FMT_32_BIT_ABGR8888: /* Fall through */
-		case B2R2_BLT_FMT_32_BIT_AYUV8888:
-		case B2R2_BLT_FMT_32_BIT_VUYA8888:
-			bpp = 32;
-			break;
-		default:
-			bpp = 12;
-		}
-		if (img->pitch == 0)
-			pitch = (img->width * bpp) / 8;
-		else
-			pitch = img->pitch;
+		/* Only the part of each plane that B2R2 accesses */
+		num_regions = set_up_img_regions(img, rect, regions);
+	}
 
-		/*
-		 * For 422I formats 2 horizontal pixels share color data.
-		 * Thus, the x position must be aligned down to closest even
-		 * number and width must be aligned up.
-		 */
-		{
-			s32 x;
-			s32 width;
-
-			switch (img->fmt) {
-			case B2R2_BLT_FMT_Y_CB_Y_CR:       /* Fall through */
-			case B2R2_BLT_FMT_CB_Y_CR_Y:
-				x = (rect->x / 2) * 2;
-				width = ((rect->width + 1) / 2) * 2;
-				break;
-			default:
-				x = rect->x;
-				width = rect->width;
-				break;
-			}
+	for (i = 0; i < num_regions; i++) {
+		struct hwmem_region *region = &regions[i];
+		u32 offset;
+		u32 len;
 
-			sa.start = (unsigned long)resolved->virtual_address +
-					rect->y * pitch + (x * bpp) / 8;
-			sa.end = (unsigned long)sa.start +
-					(rect->height - 1) * pitch +
-					(width * bpp) / 8;
-
-			start_phys = resolved->physical_address +
-					rect->y * pitch + (x * bpp) / 8;
-			end_phys = start_phys +
-					(rect->height - 1) * pitch +
-					(width * bpp) / 8;
-		}
+		if (region->count == 0)
+			continue;
+
+		offset = region->offset + region->start;
+		len = (region->count - 1) * region->size + region->end -
+				region->start;
+
+		sa.start = (unsigned long)resolved->file_virtual_start + offset;
+		sa.end = sa.start + len;
+		start_phys = resolved->file_physical_start + offset;
+		end_phys = start_phys + len;
+
+		sync_range(&sa, start_phys, end_phys, is_dst);
 	}
 
+	resolved->nsec_cache_sync +=
+			(s32)(b2r2_get_curr_nsec() - sync_start_nsec);
+}
+
+/**
+ * sync_range() - Synchronizes a range of a pmem buffer
+ *
+ * @sa: Virtual range
+ * @start_phys: Physical start of the range
+ * @end_phys: Physical end of the range
+ * @is_dst: true if B2R2 writes the range
+ */
+static void sync_range(struct sync_args *sa, u32 start_phys, u32 end_phys,
+		bool is_dst)
+{
 	/*
 	 * The virtual address to a pmem buffer is retrieved from ioremap, not
 	 * sure if it's	ok to use such an address as a kernel virtual address.
@@ -2677,9 +3284,9 @@ static void sync_buf(struct b2r2_blt_img *img,
 
 		/* Flush L1 cache */
 #ifdef CONFIG_SMP
-		flush_l1_cache_range_all_cpus(&sa);
+		flush_l1_cache_range_all_cpus(sa);
 #else
-		flush_l1_cache_range_curr_cpu(&sa);
+		flush_l1_cache_range_curr_cpu(sa);
 #endif
 
 		/* Flush L2 cache */
@@ -2687,9 +3294,9 @@ static void sync_buf(struct b2r2_blt_img *img,
 	} else {
 		/* Clean L1 cache */
 #ifdef CONFIG_SMP
-		clean_l1_cache_range_all_cpus(&sa);
+		clean_l1_cache_range_all_cpus(sa);
 #else
-		clean_l1_cache_range_curr_cpu(&sa);
+		clean_l1_cache_range_curr_cpu(sa);
 #endif
 
 		/* Clean L2 cache */
@@ -2761,6 +3368,47 @@ static void dec_stat(unsigned long *stat)
 	mutex_unlock(&stat_lock);
 }
 
+/**
+ * add_batch_stat() - Spin lock protected accounting of a finished batch
+ *
+ * @nsec: Time from the batch was issued until it was done
+ * @n_blts: Number of blits in the batch
+ */
+static void add_batch_stat(u32 nsec, u32 n_blts)
+{
+	mutex_lock(&stat_lock);
+	stat_n_batches++;
+	stat_n_batched_blts += n_blts;
+	stat_batch_last_nsec = nsec;
+	stat_batch_max_nsec = max(stat_batch_max_nsec, nsec);
+	stat_batch_total_nsec += nsec;
+	mutex_unlock(&stat_lock);
+}
+
+/**
+ * add_cache_sync_stat() - Spin lock protected accounting of the cache
+ *                         maintenance of a request
+ *
+ * @request: The request, its buffers have been synchronized
+ *
+ * Returns the time spent on cache maintenance for the request
+ */
+static s32 add_cache_sync_stat(struct b2r2_blt_request *request)
+{
+	s32 nsec = request->src_resolved.nsec_cache_sync +
+		request->src_mask_resolved.nsec_cache_sync +
+		request->dst_resolved.nsec_cache_sync;
+
+	mutex_lock(&stat_lock);
+	stat_n_cache_syncs++;
+	stat_cache_sync_last_nsec = nsec;
+	stat_cache_sync_max_nsec = max(stat_cache_sync_max_nsec, (u32)nsec);
+	stat_cache_sync_total_nsec += nsec;
+	mutex_unlock(&stat_lock);
+
+	return nsec;
+}
+
 
 #ifdef CONFIG_DEBUG_FS
 /**
@@ -3146,6 +3794,32 @@ static int debugfs_b2r2_blt_stat_read(struct file *filp, char __user *buf,
 			stat_n_in_synch_job);
 	dev_size += sprintf(Buf + dev_size, "Clients in query_cap: %lu\n",
 			stat_n_in_query_cap);
+	dev_size += sprintf(Buf + dev_size, "Batches: %lu\n",
+			stat_n_batches);
+	dev_size += sprintf(Buf + dev_size, "Batched blits: %lu\n",
+			stat_n_batched_blts);
+	if (stat_n_batches) {
+		u64 avg_nsec = stat_batch_total_nsec;
+
+		do_div(avg_nsec, stat_n_batches);
+		dev_size += sprintf(Buf + dev_size,
+			"Batch time last/avg/max: %u/%u/%u us\n",
+			stat_batch_last_nsec / 1000,
+			(u32)avg_nsec / 1000,
+			stat_batch_max_nsec / 1000);
+	}
+	dev_size += sprintf(Buf + dev_size, "Synched blits: %lu\n",
+			stat_n_cache_syncs);
+	if (stat_n_cache_syncs) {
+		u64 avg_nsec = stat_cache_sync_total_nsec;
+
+		do_div(avg_nsec, stat_n_cache_syncs);
+		dev_size += sprintf(Buf + dev_size,
+			"Cache sync time last/avg/max: %u/%u/%u us\n",
+			stat_cache_sync_last_nsec / 1000,
+			(u32)avg_nsec / 1000,
+			stat_cache_sync_max_nsec / 1000);
+	}
 	mutex_unlock(&stat_lock);
 
 	/* No more to read if offset != 0 */
@@ -200,6 +200,7 @@ struct addref_release {
  * @log_dev: Device used for logging via dev_... functions
  *
  * @prio_queue: Queue of jobs sorted in priority order
+ * @waiting_jobs: Jobs waiting for their input fence
  * @active_jobs: Array containing pointer to zero or one job per queue
  * @n_active_jobs: Number of active jobs
  * @jiffies_last_active: jiffie value when adding last active job
@@ -242,6 +243,7 @@ struct b2r2_core {
 	struct device *log_dev;
 
 	struct list_head prio_queue;
+	struct list_head waiting_jobs;
 
 	struct b2r2_core_job *active_jobs[B2R2_CORE_QUEUE_NO_OF];
 	unsigned long    n_active_jobs;
@@ -306,6 +308,10 @@ static void trigger_job(struct b2r2_core_job *job);
 static void exit_job_list(struct list_head *job_list);
 static int get_next_job_id(void);
 static void job_work_function(struct work_struct *ptr);
+static void in_fence_work_function(struct work_struct *ptr);
+static bool cancel_job(struct b2r2_core_job *job);
+static void in_fence_signaled(struct b2r2_fence *fence,
+		struct b2r2_fence_cb *cb);
 static void init_job(struct b2r2_core_job *job);
 static void insert_into_prio_list(struct b2r2_core_job *job);
 static struct b2r2_core_job *find_job_in_list(
@@ -557,6 +563,29 @@ int b2r2_core_job_add(struct b2r2_core_job *job)
 	/* Initial reference, should be released by caller of this function */
 	job->ref_count = 1;
 
+	if (job->in_fence && b2r2_fence_add_callback(job->in_fence,
+			&job->in_fence_cb, in_fence_signaled) == 0) {
+		/*
+		 * Park the job until the fence is signaled. The reference is
+		 * handed over to in_fence_work_function.
+		 */
+		internal_job_addref(job, __func__);
+		list_add_tail(&job->list, &b2r2_core.waiting_jobs);
+		job->job_state = B2R2_CORE_JOB_WAITING;
+		spin_unlock_irqrestore(&b2r2_core.lock, flags);
+
+		return 0;
+	}
+
+	if (job->in_fence && b2r2_fence_status(job->in_fence) < 0) {
+		/* What we depend on failed */
+		job->job_state = B2R2_CORE_JOB_WAITING;
+		cancel_job(job);
+		spin_unlock_irqrestore(&b2r2_core.lock, flags);
+
+		return 0;
+	}
+
 	/* Insert job into prio list */
 	insert_into_prio_list(job);
 
@@ -582,6 +611,9 @@ struct b2r2_core_job *b2r2_core_job_find(int job_id)
 	if (!job)
 		job = find_job_in_active_jobs(job_id);
 
+	if (!job)
+		job = find_job_in_list(job_id, &b2r2_core.waiting_jobs);
+
 	spin_unlock_irqrestore(&b2r2_core.lock, flags);
 
 	return job;
@@ -602,6 +634,9 @@ struct b2r2_core_job *b2r2_core_job_find_first_with_tag(int tag)
 	if (!job)
 		job = find_tag_in_active_jobs(tag);
 
+	if (!job)
+		job = find_tag_in_list(tag, &b2r2_core.waiting_jobs);
+
 	spin_unlock_irqrestore(&b2r2_core.lock, flags);
 
 	return job;
@@ -623,6 +658,7 @@ static bool is_job_done(struct b2r2_core_job *job)
 
 	spin_lock_irqsave(&b2r2_core.lock, flags);
 	job_is_done =
+		job->job_state != B2R2_CORE_JOB_WAITING &&
 		job->job_state != B2R2_CORE_JOB_QUEUED &&
 		job->job_state != B2R2_CORE_JOB_RUNNING;
 	spin_unlock_irqrestore(&b2r2_core.lock, flags);
@@ -669,6 +705,23 @@ static bool cancel_job(struct b2r2_core_job *job)
 {
 	bool found_job = false;
 	bool job_was_active = false;
+	bool job_was_waiting = false;
+
+	/* Remove from the jobs waiting for their fence */
+	if (job->job_state == B2R2_CORE_JOB_WAITING) {
+		list_del_init(&job->list);
+		/*
+		 * If the fence callback is still registered its reference is
+		 * handed over to the callback work below. Otherwise the
+		 * pending in_fence_work_function keeps it and the callback
+		 * work gets one of its own.
+		 */
+		if (!b2r2_fence_remove_callback(job->in_fence,
+						&job->in_fence_cb))
+			internal_job_addref(job, __func__);
+		found_job = true;
+		job_was_waiting = true;
+	}
 
 	/* Remove from prio list */
 	if (job->job_state == B2R2_CORE_JOB_QUEUED) {
@@ -706,7 +759,7 @@ static bool cancel_job(struct b2r2_core_job *job)
 		queue_work(b2r2_core.work_queue, &job->work);
 
 		/* Statistics */
-		if (!job_was_active)
+		if (!job_was_active && !job_was_waiting)
 			b2r2_core.stat_n_jobs_in_prio_list--;
 
 	}
@@ -920,6 +973,50 @@ static void job_work_function(struct work_struct *ptr)
 	b2r2_core_job_release(job, __func__);
 }
 
+/**
+ * in_fence_signaled() - Fence callback of a waiting job, may be called in
+ *                       atomic context
+ */
+static void in_fence_signaled(struct b2r2_fence *fence,
+		struct b2r2_fence_cb *cb)
+{
+	struct b2r2_core_job *job = container_of(cb, struct b2r2_core_job,
+						in_fence_cb);
+
+	queue_work(b2r2_core.work_queue, &job->in_fence_work);
+}
+
+/**
+ * in_fence_work_function() - Work queue function that queues a job once its
+ *                            input fence has been signaled
+ *
+ * @ptr: Pointer to work struct (embedded in struct b2r2_core_job)
+ */
+static void in_fence_work_function(struct work_struct *ptr)
+{
+	unsigned long flags;
+	struct b2r2_core_job *job = container_of(
+		ptr, struct b2r2_core_job, in_fence_work);
+
+	spin_lock_irqsave(&b2r2_core.lock, flags);
+
+	/* Canceled while the work was pending? */
+	if (job->job_state == B2R2_CORE_JOB_WAITING) {
+		if (b2r2_fence_status(job->in_fence) < 0) {
+			cancel_job(job);
+		} else {
+			list_del_init(&job->list);
+			insert_into_prio_list(job);
+			check_prio_list(false);
+		}
+	}
+
+	spin_unlock_irqrestore(&b2r2_core.lock, flags);
+
+	/* Matches the addref when the job started waiting */
+	b2r2_core_job_release(job, __func__);
+}
+
 #ifdef HANDLE_TIMEOUTED_JOBS
 /**
  * timeout_work_function() - Work queue function that checks for
@@ -1122,6 +1219,8 @@ static void init_job(struct b2r2_core_job *job)
 	INIT_LIST_HEAD(&job->list);
 	init_waitqueue_head(&job->event);
 	INIT_WORK(&job->work, job_work_function);
+	INIT_LIST_HEAD(&job->in_fence_cb.list);
+	INIT_WORK(&job->in_fence_work, in_fence_work_function);
 
 	/* Map given prio to B2R2 queues */
 	if (job->prio < B2R2_CORE_LOWEST_PRIO)
@@ -2364,6 +2463,7 @@ static void exit_hw(void)
 	/* Cancel all pending jobs */
 	b2r2_log_debug("%s: canceling pending jobs\n", __func__);
 	exit_job_list(&b2r2_core.prio_queue);
+	exit_job_list(&b2r2_core.waiting_jobs);
 
 	/* Soft reset B2R2 (Close all DMA,
 	   reset all state to idle, reset regs)*/
@@ -2410,6 +2510,7 @@ static int b2r2_probe(struct platform_device *pdev)
 
 	/* Init job queues */
 	INIT_LIST_HEAD(&b2r2_core.prio_queue);
+	INIT_LIST_HEAD(&b2r2_core.waiting_jobs);
 
 #ifdef HANDLE_TIMEOUTED_JOBS
 	/* Create work queue for callbacks & timeout */
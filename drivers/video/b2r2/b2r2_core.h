@@ -17,6 +17,7 @@
 #include <linux/spinlock.h>
 #include <linux/wait.h>
 #include <linux/workqueue.h>
+#include <video/b2r2_fence.h>
 
 /**
  * enum b2r2_core_queue - Indicates the B2R2 queue that the job belongs to
@@ -45,6 +46,7 @@ enum b2r2_core_queue {
  * enum b2r2_core_job_state - Indicates the current state of the job
  *
  * @B2R2_CORE_JOB_IDLE: Never queued
+ * @B2R2_CORE_JOB_WAITING: Added but waiting for its input fence
  * @B2R2_CORE_JOB_QUEUED: In queue but not started yet
  * @B2R2_CORE_JOB_RUNNING: Running, executed by B2R2
  * @B2R2_CORE_JOB_DONE: Completed
@@ -52,6 +54,7 @@ enum b2r2_core_queue {
  */
 enum b2r2_core_job_state {
 	B2R2_CORE_JOB_IDLE = 0,
+	B2R2_CORE_JOB_WAITING,
 	B2R2_CORE_JOB_QUEUED,
 	B2R2_CORE_JOB_RUNNING,
 	B2R2_CORE_JOB_DONE,
@@ -70,6 +73,9 @@ enum b2r2_core_job_state {
  *                      in by the client.
  * @last_node_address: Physical address of the last node. Filled
  *                     in by the client.
+ * @in_fence: Fence that must be signaled before the job is queued, or NULL.
+ *            Filled in by the client and must stay valid until the job is
+ *            released. The job is canceled if the fence signals an error.
  *
  * @callback: Function that will be called when the job is done.
  * @acquire_resources: Function that allocates the resources needed
@@ -88,6 +94,9 @@ enum b2r2_core_job_state {
  * @list: List entry element for internal list management
  * @event: Wait queue event to wait for job done
  * @work: Work queue structure, for callback implementation
+ * @in_fence_cb: Callback registered on in_fence
+ * @in_fence_work: Work queue structure, queues the job once in_fence is
+ *                 signaled
  *
  * @queue: The queue that this job shall be submitted to
  * @control: B2R2 Queue control
@@ -104,6 +113,7 @@ struct b2r2_core_job {
 	int prio;
 	u32 first_node_address;
 	u32 last_node_address;
+	struct b2r2_fence *in_fence;
 	void (*callback)(struct b2r2_core_job *);
 	int (*acquire_resources)(struct b2r2_core_job *,
 		bool atomic);
@@ -125,6 +135,8 @@ struct b2r2_core_job {
 	struct list_head  list;
 	wait_queue_head_t event;
 	struct work_struct work;
+	struct b2r2_fence_cb in_fence_cb;
+	struct work_struct in_fence_work;
 
 	/* B2R2 HW data */
 	enum b2r2_core_queue queue;
@@ -147,6 +159,9 @@ struct b2r2_core_job {
  * release the reference. The job callback function will be always
  * be called after the job is done or cancelled.
  *
+ * A job with an unsignaled in_fence is held back, without blocking other
+ * jobs, until the fence is signaled.
+ *
  * @job: Job to be added
  *
  * Returns 0 if OK else negative error code
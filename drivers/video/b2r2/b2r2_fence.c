@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ *
+ * ST-Ericsson B2R2 fences
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/err.h>
+#include <linux/anon_inodes.h>
+#include <video/b2r2_fence.h>
+
+static const struct file_operations b2r2_fence_fops;
+
+struct b2r2_fence *b2r2_fence_create(void)
+{
+	struct b2r2_fence *fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+
+	if (fence == NULL)
+		return NULL;
+
+	kref_init(&fence->ref);
+	spin_lock_init(&fence->lock);
+	init_waitqueue_head(&fence->wait);
+	INIT_LIST_HEAD(&fence->callbacks);
+
+	return fence;
+}
+EXPORT_SYMBOL(b2r2_fence_create);
+
+struct b2r2_fence *b2r2_fence_get(struct b2r2_fence *fence)
+{
+	kref_get(&fence->ref);
+
+	return fence;
+}
+EXPORT_SYMBOL(b2r2_fence_get);
+
+static void fence_free(struct kref *ref)
+{
+	struct b2r2_fence *fence = container_of(ref, struct b2r2_fence, ref);
+
+	WARN_ON(!list_empty(&fence->callbacks));
+	kfree(fence);
+}
+
+void b2r2_fence_put(struct b2r2_fence *fence)
+{
+	kref_put(&fence->ref, fence_free);
+}
+EXPORT_SYMBOL(b2r2_fence_put);
+
+void b2r2_fence_signal(struct b2r2_fence *fence, int status)
+{
+	unsigned long flags;
+	struct list_head callbacks;
+	struct b2r2_fence_cb *cb;
+	struct b2r2_fence_cb *tmp;
+
+	INIT_LIST_HEAD(&callbacks);
+
+	spin_lock_irqsave(&fence->lock, flags);
+	if (fence->signaled) {
+		spin_unlock_irqrestore(&fence->lock, flags);
+		return;
+	}
+	fence->signaled = true;
+	fence->status = status;
+	list_splice_init(&fence->callbacks, &callbacks);
+	spin_unlock_irqrestore(&fence->lock, flags);
+
+	wake_up_all(&fence->wait);
+
+	/* Callbacks may register new callbacks, so call them unlocked */
+	list_for_each_entry_safe(cb, tmp, &callbacks, list) {
+		list_del_init(&cb->list);
+		cb->func(fence, cb);
+	}
+}
+EXPORT_SYMBOL(b2r2_fence_signal);
+
+int b2r2_fence_status(struct b2r2_fence *fence)
+{
+	unsigned long flags;
+	int status;
+
+	spin_lock_irqsave(&fence->lock, flags);
+	status = fence->signaled ? fence->status : 1;
+	spin_unlock_irqrestore(&fence->lock, flags);
+
+	return status;
+}
+EXPORT_SYMBOL(b2r2_fence_status);
+
+int b2r2_fence_wait(struct b2r2_fence *fence, long timeout)
+{
+	long ret;
+
+	ret = wait_event_interruptible_timeout(fence->wait,
+			b2r2_fence_status(fence) <= 0, timeout);
+	if (ret < 0)
+		return ret;
+	if (ret == 0 && b2r2_fence_status(fence) > 0)
+		return -ETIME;
+
+	return b2r2_fence_status(fence);
+}
+EXPORT_SYMBOL(b2r2_fence_wait);
+
+int b2r2_fence_add_callback(struct b2r2_fence *fence,
+		struct b2r2_fence_cb *cb, b2r2_fence_func_t func)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	cb->func = func;
+
+	spin_lock_irqsave(&fence->lock, flags);
+	if (fence->signaled) {
+		INIT_LIST_HEAD(&cb->list);
+		ret = -EALREADY;
+	} else {
+		list_add_tail(&cb->list, &fence->callbacks);
+	}
+	spin_unlock_irqrestore(&fence->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(b2r2_fence_add_callback);
+
+bool b2r2_fence_remove_callback(struct b2r2_fence *fence,
+		struct b2r2_fence_cb *cb)
+{
+	unsigned long flags;
+	bool removed = false;
+
+	spin_lock_irqsave(&fence->lock, flags);
+	if (!fence->signaled && !list_empty(&cb->list)) {
+		list_del_init(&cb->list);
+		removed = true;
+	}
+	spin_unlock_irqrestore(&fence->lock, flags);
+
+	return removed;
+}
+EXPORT_SYMBOL(b2r2_fence_remove_callback);
+
+static unsigned int b2r2_fence_poll(struct file *file, poll_table *wait)
+{
+	struct b2r2_fence *fence = file->private_data;
+
+	poll_wait(file, &fence->wait, wait);
+
+	if (b2r2_fence_status(fence) <= 0)
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+static int b2r2_fence_release(struct inode *inode, struct file *file)
+{
+	b2r2_fence_put(file->private_data);
+
+	return 0;
+}
+
+static const struct file_operations b2r2_fence_fops = {
+	.owner = THIS_MODULE,
+	.poll = b2r2_fence_poll,
+	.release = b2r2_fence_release,
+};
+
+int b2r2_fence_install_fd(struct b2r2_fence *fence)
+{
+	int fd;
+
+	fd = anon_inode_getfd("b2r2_fence", &b2r2_fence_fops,
+			b2r2_fence_get(fence), O_RDONLY);
+	if (fd < 0)
+		b2r2_fence_put(fence);
+
+	return fd;
+}
+EXPORT_SYMBOL(b2r2_fence_install_fd);
+
+struct b2r2_fence *b2r2_fence_fdget(int fd)
+{
+	struct file *file = fget(fd);
+	struct b2r2_fence *fence;
+
+	if (file == NULL)
+		return ERR_PTR(-EBADF);
+
+	if (file->f_op != &b2r2_fence_fops) {
+		fput(file);
+		return ERR_PTR(-EINVAL);
+	}
+
+	fence = b2r2_fence_get(file->private_data);
+	fput(file);
+
+	return fence;
+}
+EXPORT_SYMBOL(b2r2_fence_fdget);
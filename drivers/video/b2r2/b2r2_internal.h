@@ -97,6 +97,7 @@ struct b2r2_node {
  * @file_physical_start: Physical address of file start
  * @file_virtual_start: Virtual address of file start
  * @file_len: File len
+ * @nsec_cache_sync: Time spent on cache maintenance for the buffer
  *
  */
 struct b2r2_resolved_buf {
@@ -109,6 +110,7 @@ struct b2r2_resolved_buf {
 	u32                   file_physical_start;
 	u32                   file_virtual_start;
 	u32                   file_len;
+	s32                   nsec_cache_sync;
 };
 
 
@@ -297,6 +299,11 @@ struct b2r2_node_split_job {
  * @src_mask_resolved: Calculated info about the source mask buffer
  * @dst_resolved: Calculated info about the destination buffer
  * @profile: True if the blit shall be profiled, false otherwise
+ * @batch_next: Next request in the batch, the whole batch is executed by the
+ *              job of its first request
+ * @batch_count: Number of requests in the batch, set in the first request only
+ * @in_fence: Fence the job waits for, or NULL
+ * @out_fence: Fence signaled when the job is done, or NULL
  */
 struct b2r2_blt_request {
 	struct b2r2_blt_instance   *instance;
@@ -324,9 +331,18 @@ struct b2r2_blt_request {
 	bool profile;
 
 	s32 nsec_active_in_cpu;
+	s32 nsec_cache_sync;
 
 	u32 start_time_nsec;
 	s32 total_time_nsec;
+
+	/* Batching */
+	struct b2r2_blt_request *batch_next;
+	u32 batch_count;
+
+	/* Fences, set in the first request of a batch only */
+	struct b2r2_fence *in_fence;
+	struct b2r2_fence *out_fence;
 };
 
 /* FIXME: The functions below should be removed when we are
@@ -114,9 +114,10 @@ static void print_blt(const struct b2r2_blt_req * const request, const struct b2
 			tmp_str,
 			get_blt_mpix_per_second(request, blt_profiling_info));
 	else
-		printk(KERN_ALERT "%s, CPU: %10i, B2R2: %10i, Tot: %10i ns\n",
+		printk(KERN_ALERT "%s, CPU: %10i, Cache: %10i, B2R2: %10i, Tot: %10i ns\n",
 			tmp_str,
 			blt_profiling_info->nsec_active_in_cpu,
+			blt_profiling_info->nsec_cache_sync,
 			blt_profiling_info->nsec_active_in_b2r2,
 			blt_profiling_info->total_time_nsec);
 }
@@ -230,6 +231,19 @@ static void blt_done(const struct b2r2_blt_req * const request, const s32 reques
 		return;
 
 	/* Processors */
+	if (blt_profiling_info->n_blts > 1) {
+		/* Only the first blit of a batch is known, print the frame */
+		if (print_blts_on)
+			printk(KERN_ALERT "Batch of %2i blits, CPU: %10i, "
+				"Cache: %10i, B2R2: %10i, Tot: %10i ns\n",
+				blt_profiling_info->n_blts,
+				blt_profiling_info->nsec_active_in_cpu,
+				blt_profiling_info->nsec_cache_sync,
+				blt_profiling_info->nsec_active_in_b2r2,
+				blt_profiling_info->total_time_nsec);
+		return;
+	}
+
 	if (print_blts_on)
 		print_blt(request, blt_profiling_info);
 
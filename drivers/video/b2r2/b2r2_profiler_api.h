@@ -24,11 +24,17 @@
  * @nsec_active_in_b2r2: The number of nanoseconds the job was active in B2R2. This
  *                       is an approximate value, check out the code for more info.
  * @total_time_nsec: The total time the job took in nano seconds. Includes ideling.
+ * @n_blts: The number of blits the times cover, more than one for a batch in
+ *          which case the request is the first blit of the batch.
+ * @nsec_cache_sync: The number of nanoseconds spent on cache maintenance for
+ *                   the buffers. Included in nsec_active_in_cpu.
  */
 struct b2r2_blt_profiling_info {
 	s32 nsec_active_in_cpu;
 	s32 nsec_active_in_b2r2;
 	s32 total_time_nsec;
+	s32 n_blts;
+	s32 nsec_cache_sync;
 };
 
 /**
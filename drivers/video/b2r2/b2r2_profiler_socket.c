@@ -97,6 +97,9 @@ void b2r2_call_profiler_blt_done(const struct b2r2_blt_request * const request)
 	blt_profiling_info.nsec_active_in_cpu = request->nsec_active_in_cpu;
 	blt_profiling_info.nsec_active_in_b2r2 = request->job.nsec_active_in_hw;
 	blt_profiling_info.total_time_nsec = request->total_time_nsec;
+	blt_profiling_info.n_blts = request->batch_count ?
+						request->batch_count : 1;
+	blt_profiling_info.nsec_cache_sync = request->nsec_cache_sync;
 
 	b2r2_profiler->blt_done(&request->user_req, request->request_id, &blt_profiling_info);
 
@@ -19,12 +19,15 @@
 #include <linux/seq_file.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
 
 #include "mcde_debugfs.h"
 
 #define MAX_NUM_OVERLAYS 2
 #define MAX_NUM_CHANNELS 4
 #define DEFAULT_DMESG_FPS_LOG_INTERVAL 100
+#define MAX_NUM_FRAMES 32
 
 struct fps_info {
 	u32 enable_dmesg;
@@ -35,6 +38,25 @@ struct fps_info {
 	u32 fpks;
 };
 
+struct frame_times {
+	u32 seq;
+	ktime_t queued;
+	ktime_t triggered;
+	ktime_t completed;
+};
+
+/* Last frames of the channel update queue, written from irq context */
+struct frame_log {
+	spinlock_t lock;
+	u32 next;
+	u32 frames_done;
+	u32 frames_dropped;
+	u32 last_dropped_seq;
+	s64 total_latency_us;
+	s64 max_latency_us;
+	struct frame_times frames[MAX_NUM_FRAMES];
+};
+
 struct overlay_info {
 	u8 id;
 	struct dentry *dentry;
@@ -46,6 +68,7 @@ struct channel_info {
 	struct dentry *dentry;
 	struct mcde_chnl_state *chnl;
 	struct fps_info fps;
+	struct frame_log frame_log;
 	struct overlay_info overlays[MAX_NUM_OVERLAYS];
 };
 
@@ -101,6 +124,53 @@ static const struct file_operations mcde_dump_chnl_fops = {
 	.owner = THIS_MODULE,
 };
 
+static int mcde_frames_print(struct seq_file *s, void *p)
+{
+	struct frame_log *log = s->private;
+	unsigned long flags;
+	u32 i;
+
+	spin_lock_irqsave(&log->lock, flags);
+	seq_printf(s, "Frames done: %u, dropped: %u (last seq %u)\n",
+			log->frames_done, log->frames_dropped,
+			log->last_dropped_seq);
+	if (log->frames_done)
+		seq_printf(s, "Queued to done avg/max: %lld/%lld us\n",
+			div_s64(log->total_latency_us, log->frames_done),
+			log->max_latency_us);
+	seq_printf(s, "%10s %14s %10s %10s\n", "seq", "queued_us",
+						"trig_us", "done_us");
+
+	/* Oldest first, times relative to when the frame was queued */
+	for (i = 0; i < MAX_NUM_FRAMES; i++) {
+		struct frame_times *f =
+			&log->frames[(log->next + i) % MAX_NUM_FRAMES];
+
+		if (f->seq == 0)
+			continue;
+		seq_printf(s, "%10u %14lld %10lld %10lld\n", f->seq,
+			ktime_to_us(f->queued),
+			ktime_us_delta(f->triggered, f->queued),
+			ktime_us_delta(f->completed, f->queued));
+	}
+	spin_unlock_irqrestore(&log->lock, flags);
+
+	return 0;
+}
+
+static int mcde_frames_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mcde_frames_print, inode->i_private);
+}
+
+static const struct file_operations mcde_frames_fops = {
+	.open = mcde_frames_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+	.owner = THIS_MODULE,
+};
+
 /* Requires: lhs > rhs */
 static inline u32 timespec_ms_diff(struct timespec lhs, struct timespec rhs)
 {
@@ -203,6 +273,9 @@ int mcde_debugfs_channel_create(u8 chnl_id, struct mcde_chnl_state *chnl)
 	create_fps_files(ci->dentry, &ci->fps);
 	debugfs_create_file("dump_chnl", S_IRUGO, ci->dentry,
 						chnl, &mcde_dump_chnl_fops);
+	spin_lock_init(&ci->frame_log.lock);
+	debugfs_create_file("frames", S_IRUGO, ci->dentry,
+					&ci->frame_log, &mcde_frames_fops);
 	ci->fps.interval_ms = DEFAULT_DMESG_FPS_LOG_INTERVAL;
 	ci->id = chnl_id;
 	ci->chnl = chnl;
@@ -257,3 +330,46 @@ void mcde_debugfs_overlay_update(u8 chnl_id, u8 ovly_id)
 	update_ovly_fps(ci, oi);
 }
 
+
+void mcde_debugfs_channel_frame_done(u8 chnl_id, u32 seq, ktime_t queued,
+					ktime_t triggered, ktime_t completed)
+{
+	struct channel_info *ci = find_chnl(chnl_id);
+	struct frame_log *log;
+	struct frame_times *f;
+	unsigned long flags;
+	s64 latency_us;
+
+	if (!ci || !ci->chnl)
+		return;
+
+	log = &ci->frame_log;
+	latency_us = ktime_us_delta(completed, queued);
+
+	spin_lock_irqsave(&log->lock, flags);
+	f = &log->frames[log->next];
+	f->seq = seq;
+	f->queued = queued;
+	f->triggered = triggered;
+	f->completed = completed;
+	log->next = (log->next + 1) % MAX_NUM_FRAMES;
+	log->frames_done++;
+	log->total_latency_us += latency_us;
+	if (latency_us > log->max_latency_us)
+		log->max_latency_us = latency_us;
+	spin_unlock_irqrestore(&log->lock, flags);
+}
+
+void mcde_debugfs_channel_frame_dropped(u8 chnl_id, u32 seq)
+{
+	struct channel_info *ci = find_chnl(chnl_id);
+	unsigned long flags;
+
+	if (!ci || !ci->chnl)
+		return;
+
+	spin_lock_irqsave(&ci->frame_log.lock, flags);
+	ci->frame_log.frames_dropped++;
+	ci->frame_log.last_dropped_seq = seq;
+	spin_unlock_irqrestore(&ci->frame_log.lock, flags);
+}
@@ -12,6 +12,7 @@
 #ifndef __MCDE_DEBUGFS__H__
 #define __MCDE_DEBUGFS__H__
 
+#include <linux/ktime.h>
 #include <video/mcde.h>
 
 int mcde_debugfs_create(struct device *dev);
@@ -21,6 +22,9 @@ int mcde_debugfs_overlay_create(u8 chnl_id, u8 ovly_id,
 
 void mcde_debugfs_channel_update(u8 chnl_id);
 void mcde_debugfs_overlay_update(u8 chnl_id, u8 ovly_id);
+void mcde_debugfs_channel_frame_done(u8 chnl_id, u32 seq, ktime_t queued,
+					ktime_t triggered, ktime_t completed);
+void mcde_debugfs_channel_frame_dropped(u8 chnl_id, u32 seq);
 
 #endif /* __MCDE_DEBUGFS__H__ */
 
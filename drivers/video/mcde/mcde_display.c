@@ -329,16 +329,62 @@ static int mcde_display_invalidate_area_default(
 	return 0;
 }
 
+static int mcde_display_try_update_area_default(
+					struct mcde_display_device *ddev,
+					struct mcde_rectangle *area)
+{
+	u16 x_align = max_t(u16, ddev->update_area_x_align, 1);
+	u16 y_align = max_t(u16, ddev->update_area_y_align, 1);
+	u16 x1, y1;
+
+	/*
+	 * Only command mode DSI displays keep their own frame memory, and the
+	 * column/page window is only valid in the native orientation.
+	 */
+	if (ddev->port->type != MCDE_PORTTYPE_DSI ||
+			ddev->port->update_auto_trig ||
+			ddev->video_mode.interlaced ||
+			ddev->rotation != MCDE_DISPLAY_ROT_0 ||
+			!ddev->prepare_for_update)
+		return -EINVAL;
+
+	if (area->w == 0 || area->h == 0 ||
+			area->x >= ddev->video_mode.xres ||
+			area->y >= ddev->video_mode.yres)
+		return -EINVAL;
+
+	/* Packed 18 bpp sends four pixels in nine bytes */
+	if (ddev->port->pixel_format == MCDE_PORTPIXFMT_DSI_18BPP_PACKED)
+		x_align = max_t(u16, x_align, 4);
+
+	x1 = min_t(u32, roundup(area->x + area->w, x_align),
+						ddev->video_mode.xres);
+	y1 = min_t(u32, roundup(area->y + area->h, y_align),
+						ddev->video_mode.yres);
+	area->x -= area->x % x_align;
+	area->y -= area->y % y_align;
+	area->w = x1 - area->x;
+	area->h = y1 - area->y;
+
+	return 0;
+}
+
 static int mcde_display_update_default(struct mcde_display_device *ddev,
 							bool tripple_buffer)
 {
 	int ret = 0;
 
-	/* TODO: Dirty */
 	if (ddev->prepare_for_update) {
-		/* TODO: Send dirty rectangle */
-		ret = ddev->prepare_for_update(ddev, 0, 0,
-			ddev->native_x_res, ddev->native_y_res);
+		struct mcde_rectangle *area = &ddev->update_area;
+
+		if (ddev->rotation == MCDE_DISPLAY_ROT_0 &&
+				(area->w < ddev->video_mode.xres ||
+				area->h < ddev->video_mode.yres))
+			ret = ddev->prepare_for_update(ddev, area->x, area->y,
+							area->w, area->h);
+		else
+			ret = ddev->prepare_for_update(ddev, 0, 0,
+				ddev->native_x_res, ddev->native_y_res);
 		if (ret < 0) {
 			dev_warn(&ddev->dev,
 				"%s:Failed to prepare for update\n", __func__);
@@ -424,9 +470,12 @@ void mcde_display_init_device(struct mcde_display_device *ddev)
 				mcde_display_get_synchronized_update_default;
 	ddev->apply_config = mcde_display_apply_config_default;
 	ddev->invalidate_area = mcde_display_invalidate_area_default;
+	ddev->try_update_area = mcde_display_try_update_area_default;
 	ddev->update = mcde_display_update_default;
 	ddev->prepare_for_update = mcde_display_prepare_for_update_default;
 	ddev->on_first_update = mcde_display_on_first_update_default;
+	ddev->update_area_x_align = 2;
+	ddev->update_area_y_align = 1;
 
 	mutex_init(&ddev->display_lock);
 }
@@ -290,6 +290,52 @@ update_failed:
 }
 EXPORT_SYMBOL(mcde_dss_update_overlay);
 
+int mcde_dss_update_overlay_area(struct mcde_overlay *ovly,
+						struct mcde_rectangle *area)
+{
+	struct mcde_display_device *ddev = ovly->ddev;
+	struct mcde_rectangle update_area;
+	int ret;
+
+	dev_vdbg(&ddev->dev, "Overlay area update, chnl=%d\n", ddev->chnl_id);
+
+	if (!ovly->state || !ddev->update || !ddev->invalidate_area)
+		return -EINVAL;
+
+	/* Nothing visible changed */
+	if (area->w == 0 || area->h == 0 ||
+			area->x >= ovly->info.w || area->y >= ovly->info.h)
+		return 0;
+
+	/* Overlay to display coordinates */
+	update_area.x = ovly->info.dst_x + area->x;
+	update_area.y = ovly->info.dst_y + area->y;
+	update_area.w = min_t(u16, area->w, ovly->info.w - area->x);
+	update_area.h = min_t(u16, area->h, ovly->info.h - area->y);
+
+	mutex_lock(&ddev->display_lock);
+	/* Do not perform an update if power mode is off */
+	if (ddev->get_power_mode(ddev) == MCDE_DISPLAY_PM_OFF) {
+		ret = 0;
+		goto power_mode_off;
+	}
+
+	/* Displays that can not be partially updated get a full update */
+	if (ddev->try_update_area &&
+			ddev->try_update_area(ddev, &update_area) == 0)
+		ddev->update_area = update_area;
+
+	ret = ddev->update(ddev, false);
+
+	/* Next update is a full update unless told otherwise */
+	(void) ddev->invalidate_area(ddev, NULL);
+
+power_mode_off:
+	mutex_unlock(&ddev->display_lock);
+	return ret;
+}
+EXPORT_SYMBOL(mcde_dss_update_overlay_area);
+
 void mcde_dss_get_overlay_info(struct mcde_overlay *ovly,
 				struct mcde_overlay_info *info) {
 	if (info)
@@ -18,6 +18,7 @@
 
 #include <linux/hwmem.h>
 #include <linux/io.h>
+#include <linux/uaccess.h>
 
 #include <linux/console.h>
 
@@ -629,6 +630,38 @@ static void mcde_fb_rotate(struct fb_info *fbi, int rotate)
 	dev_vdbg(fbi->dev, "%s\n", __func__);
 }
 
+static int update_dirty_rect(struct fb_info *fbi,
+					struct mcde_fb_dirty_rect __user *argp)
+{
+	struct mcde_fb *mfb = to_mcde_fb(fbi);
+	struct mcde_fb_dirty_rect rect;
+	struct mcde_rectangle area;
+	int i;
+	int ret = 0;
+
+	if (copy_from_user(&rect, argp, sizeof(rect)))
+		return -EFAULT;
+
+	if (fb_to_display(fbi)->fictive)
+		return 0;
+
+	/* Clip against the visible part of the frame buffer */
+	if (rect.x >= fbi->var.xres || rect.y >= fbi->var.yres)
+		return 0;
+	area.x = rect.x;
+	area.y = rect.y;
+	area.w = min_t(u32, rect.w, fbi->var.xres - rect.x);
+	area.h = min_t(u32, rect.h, fbi->var.yres - rect.y);
+
+	for (i = 0; i < mfb->num_ovlys; i++) {
+		ret = mcde_dss_update_overlay_area(mfb->ovlys[i], &area);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
 static int mcde_fb_ioctl(struct fb_info *fbi, unsigned int cmd,
 							 unsigned long arg)
 {
@@ -636,6 +669,9 @@ static int mcde_fb_ioctl(struct fb_info *fbi, unsigned int cmd,
 
 	if (cmd == MCDE_GET_BUFFER_NAME_IOC)
 		return mfb->alloc_name;
+	else if (cmd == MCDE_FB_UPDATE_DIRTY_RECT_IOC)
+		return update_dirty_rect(fbi,
+				(struct mcde_fb_dirty_rect __user *)arg);
 
 	return -EINVAL;
 }
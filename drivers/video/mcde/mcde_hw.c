@@ -24,6 +24,8 @@
 #include <linux/slab.h>
 #include <linux/jiffies.h>
 #include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
 
 #include <mach/prcmu-db8500.h>
 
@@ -77,6 +79,7 @@ static void dsi_te_poll_set_timer(struct mcde_chnl_state *chnl,
 		unsigned int timeout);
 static void dsi_te_timer_function(unsigned long value);
 static int wait_for_vcmp(struct mcde_chnl_state *chnl);
+static void flush_frame(struct mcde_chnl_state *chnl);
 static void probe_hw(void);
 static void wait_for_flow_disabled(struct mcde_chnl_state *chnl);
 
@@ -276,6 +279,8 @@ struct chnl_regs {
 	u8   rotdir;
 	u32  rotbuf1;
 	u32  rotbuf2;
+	/* Only x, y, ppl, lpf of a command mode display is transferred */
+	bool partial_update;
 
 	/* Blending */
 	u8 blend_ctrl;
@@ -346,6 +351,16 @@ struct oled_regs {
 	u16 off_blue;
 };
 
+/* Overlay buffers of a frame in the channel update queue */
+struct chnl_frame {
+	u32 seq;
+	u32 baseaddress0[2];
+	u32 baseaddress1[2];
+	bool dirty_buf[2];
+	ktime_t queued;
+	ktime_t triggered;
+};
+
 struct mcde_chnl_state {
 	bool enabled;
 	bool reserved;
@@ -402,6 +417,18 @@ struct mcde_chnl_state {
 
 	bool formatter_updated;
 	bool esram_is_enabled;
+
+	/*
+	 * Update queue of a running auto triggered channel. A frame that only
+	 * changes overlay buffers is latched by the VCMP irq, a frame still
+	 * pending when the next one is queued is dropped.
+	 */
+	spinlock_t frame_lock;
+	struct chnl_frame frame_pending;
+	struct chnl_frame frame_latched;
+	bool frame_is_pending;
+	bool frame_is_latched;
+	u32 frame_seq;
 };
 
 static struct mcde_chnl_state *channels;
@@ -1141,11 +1168,48 @@ static inline void mcde_handle_vsync(struct mcde_chnl_state *chnl)
 		}
 }
 
+static void write_frame_buf(struct mcde_ovly_state *ovly,
+					struct chnl_frame *frame, int i)
+{
+	if (!ovly || !frame->dirty_buf[i])
+		return;
+
+	mcde_wreg(MCDE_EXTSRC0A0 + ovly->idx * MCDE_EXTSRC0A0_GROUPOFFSET,
+		frame->baseaddress0[i]);
+	mcde_wreg(MCDE_EXTSRC0A1 + ovly->idx * MCDE_EXTSRC0A1_GROUPOFFSET,
+		frame->baseaddress1[i]);
+}
+
+static void latch_frame(struct mcde_chnl_state *chnl)
+{
+	ktime_t now = ktime_get();
+
+	spin_lock(&chnl->frame_lock);
+	/* The latched frame was sent during the frame that just completed */
+	if (chnl->frame_is_latched) {
+		mcde_debugfs_channel_frame_done(chnl->id,
+			chnl->frame_latched.seq, chnl->frame_latched.queued,
+			chnl->frame_latched.triggered, now);
+		chnl->frame_is_latched = false;
+	}
+	/* Buffer addresses are shadowed, they are used from the next frame */
+	if (chnl->frame_is_pending) {
+		write_frame_buf(chnl->ovly0, &chnl->frame_pending, 0);
+		write_frame_buf(chnl->ovly1, &chnl->frame_pending, 1);
+		chnl->frame_pending.triggered = now;
+		chnl->frame_latched = chnl->frame_pending;
+		chnl->frame_is_latched = true;
+		chnl->frame_is_pending = false;
+	}
+	spin_unlock(&chnl->frame_lock);
+}
+
 static inline void mcde_handle_vcmp(struct mcde_chnl_state *chnl)
 {
 	if (!chnl->vcmp_per_field ||
 			(chnl->vcmp_per_field && chnl->even_vcmp)) {
 		atomic_inc(&chnl->vcmp_cnt);
+		latch_frame(chnl);
 		if (chnl->state == CHNLSTATE_STOPPING)
 			set_channel_state_atomic(chnl, CHNLSTATE_STOPPED);
 		else
@@ -1804,6 +1868,16 @@ static void update_overlay_registers(u8 idx, struct ovly_regs *regs,
 	u8  nr_of_bufs = 1;
 	u32 sel_mod = MCDE_EXTSRC0CR_SEL_MOD_SOFTWARE_SEL;
 
+	/*
+	 * A command mode display may be updated partially, only fetch the
+	 * part of the overlay that is inside the update area.
+	 */
+	if (port->type == MCDE_PORTTYPE_DSI && !port->update_auto_trig &&
+					rotation == MCDE_DISPLAY_ROT_0) {
+		ppl = min_t(u32, ppl, update_w);
+		lpf = min_t(u32, lpf, update_h);
+	}
+
 	if (rotation == MCDE_DISPLAY_ROT_180_CCW) {
 		ljinc = -ljinc;
 		tmrgn += stride * (regs->lpf - 1) / 8;
@@ -1976,6 +2050,8 @@ static void stop_channel(struct mcde_chnl_state *chnl)
 	if (chnl->state != CHNLSTATE_RUNNING)
 		return;
 
+	flush_frame(chnl);
+
 	if (chnl->port.update_auto_trig &&
 			chnl->port.sync_src == MCDE_SYNCSRC_OFF &&
 			chnl->port.type == MCDE_PORTTYPE_DSI)
@@ -2308,6 +2384,10 @@ void update_channel_registers(enum mcde_chnl chnl_id, struct chnl_regs *regs,
 
 		screen_ppl = video_mode->xres;
 		screen_lpf = video_mode->yres;
+		if (regs->partial_update) {
+			screen_ppl = regs->ppl;
+			screen_lpf = regs->lpf;
+		}
 
 		pkt_div = get_pkt_div(screen_ppl, port, fifo);
 
@@ -3058,10 +3138,115 @@ static void chnl_update_overlay(struct mcde_chnl_state *chnl,
 	}
 }
 
+static void unstore_frame_buf(struct mcde_ovly_state *ovly,
+					struct chnl_frame *frame, int i)
+{
+	if (!ovly || !frame->dirty_buf[i])
+		return;
+
+	/* regs still hold this address unless a newer one replaced it */
+	ovly->regs.dirty_buf = true;
+	frame->dirty_buf[i] = false;
+}
+
+/*
+ * Drops a queued frame that register writes are about to supersede. Its
+ * buffer addresses go back to the overlay registers so that the next
+ * register update programs them.
+ */
+static void flush_frame(struct mcde_chnl_state *chnl)
+{
+	unsigned long flags;
+	bool dropped = false;
+
+	spin_lock_irqsave(&chnl->frame_lock, flags);
+	if (chnl->frame_is_pending) {
+		mcde_debugfs_channel_frame_dropped(chnl->id,
+						chnl->frame_pending.seq);
+		unstore_frame_buf(chnl->ovly0, &chnl->frame_pending, 0);
+		unstore_frame_buf(chnl->ovly1, &chnl->frame_pending, 1);
+		chnl->frame_is_pending = false;
+		dropped = true;
+	}
+	spin_unlock_irqrestore(&chnl->frame_lock, flags);
+
+	/* Clients waiting in queue_frame() for the frame to latch */
+	if (dropped)
+		wake_up_all(&chnl->vcmp_waitq);
+}
+
+static bool can_queue_frame(struct mcde_chnl_state *chnl)
+{
+	struct mcde_ovly_state *ovly0 = chnl->ovly0;
+	struct mcde_ovly_state *ovly1 = chnl->ovly1;
+
+	if (!chnl->port.update_auto_trig || chnl->state != CHNLSTATE_RUNNING ||
+							chnl->regs.dirty)
+		return false;
+
+	/* Only new buffers can be latched without stopping the channel */
+	if ((ovly0 && ovly0->regs.dirty) || (ovly1 && ovly1->regs.dirty))
+		return false;
+
+	return (ovly0 && ovly0->regs.dirty_buf) ||
+					(ovly1 && ovly1->regs.dirty_buf);
+}
+
+static void store_frame_buf(struct mcde_chnl_state *chnl,
+		struct mcde_ovly_state *ovly, struct chnl_frame *frame, int i)
+{
+	if (!ovly || !ovly->regs.dirty_buf)
+		return;
+
+	frame->dirty_buf[i] = true;
+	frame->baseaddress0[i] = ovly->regs.baseaddress0;
+	frame->baseaddress1[i] = ovly->regs.baseaddress1;
+	ovly->regs.dirty_buf = false;
+	mcde_debugfs_overlay_update(chnl->id, i);
+}
+
+static void queue_frame(struct mcde_chnl_state *chnl, bool tripple_buffer)
+{
+	struct chnl_frame *frame = &chnl->frame_pending;
+	unsigned long flags;
+
+	/*
+	 * A triple buffered client renders to the buffer that was displayed
+	 * before the pending one, so that must be latched before a new frame
+	 * is accepted. When the display keeps up nothing is pending.
+	 */
+	if (tripple_buffer)
+		wait_event_timeout(chnl->vcmp_waitq, !chnl->frame_is_pending,
+					msecs_to_jiffies(CHNL_TIMEOUT));
+
+	spin_lock_irqsave(&chnl->frame_lock, flags);
+	/* Buffers of a dropped frame not replaced by this one are kept */
+	if (chnl->frame_is_pending) {
+		mcde_debugfs_channel_frame_dropped(chnl->id, frame->seq);
+	} else {
+		frame->dirty_buf[0] = false;
+		frame->dirty_buf[1] = false;
+	}
+	frame->seq = ++chnl->frame_seq;
+	store_frame_buf(chnl, chnl->ovly0, frame, 0);
+	store_frame_buf(chnl, chnl->ovly1, frame, 1);
+	frame->queued = ktime_get();
+	chnl->frame_is_pending = true;
+	spin_unlock_irqrestore(&chnl->frame_lock, flags);
+
+	/* A double buffered client renders to the buffer displayed now */
+	if (!tripple_buffer)
+		wait_event_timeout(chnl->vcmp_waitq, !chnl->frame_is_pending,
+					msecs_to_jiffies(CHNL_TIMEOUT));
+}
+
 static int _mcde_chnl_update(struct mcde_chnl_state *chnl,
 					struct mcde_rectangle *update_area,
 					bool tripple_buffer)
 {
+	u16 x, y, ppl, lpf;
+	bool partial_update;
+
 	dev_vdbg(&mcde_dev->dev, "%s\n", __func__);
 
 	/* TODO: lock & make wait->trig async */
@@ -3070,23 +3255,57 @@ static int _mcde_chnl_update(struct mcde_chnl_state *chnl,
 		return -EINVAL;
 	}
 
-	if (chnl->port.update_auto_trig && tripple_buffer)
-		wait_for_vcmp(chnl);
-
-	chnl->regs.x   = update_area->x;
-	chnl->regs.y   = update_area->y;
+	x   = update_area->x;
+	y   = update_area->y;
 	/* TODO Crop against video_mode.xres and video_mode.yres */
-	chnl->regs.ppl = update_area->w;
-	chnl->regs.lpf = update_area->h;
+	ppl = update_area->w;
+	lpf = update_area->h;
 	if (chnl->port.type == MCDE_PORTTYPE_DPI &&
 						chnl->port.phy.dpi.tv_mode) {
 		/* subtract border */
-		chnl->regs.ppl -= chnl->tv_regs.dho + chnl->tv_regs.alw;
+		ppl -= chnl->tv_regs.dho + chnl->tv_regs.alw;
 		/* subtract double borders, ie. for both fields */
-		chnl->regs.lpf -= 2 * (chnl->tv_regs.dvo + chnl->tv_regs.bsl);
+		lpf -= 2 * (chnl->tv_regs.dvo + chnl->tv_regs.bsl);
 	} else if (chnl->port.type == MCDE_PORTTYPE_DSI &&
 			chnl->vmode.interlaced)
-		chnl->regs.lpf /= 2;
+		lpf /= 2;
+
+	partial_update = chnl->port.type == MCDE_PORTTYPE_DSI &&
+		!chnl->port.update_auto_trig && !chnl->vmode.interlaced &&
+		chnl->rotation == MCDE_DISPLAY_ROT_0 &&
+		(x != 0 || y != 0 || ppl < chnl->vmode.xres ||
+						lpf < chnl->vmode.yres);
+
+	/*
+	 * The formatter frame size and the overlay fetch window follow the
+	 * update area, so they must be rewritten when it changes.
+	 */
+	if (x != chnl->regs.x || y != chnl->regs.y ||
+			ppl != chnl->regs.ppl || lpf != chnl->regs.lpf ||
+			partial_update != chnl->regs.partial_update) {
+		chnl->regs.x = x;
+		chnl->regs.y = y;
+		chnl->regs.ppl = ppl;
+		chnl->regs.lpf = lpf;
+		chnl->regs.partial_update = partial_update;
+		if (!chnl->port.update_auto_trig) {
+			chnl->regs.dirty = true;
+			if (chnl->ovly0)
+				chnl->ovly0->regs.dirty = true;
+			if (chnl->ovly1)
+				chnl->ovly1->regs.dirty = true;
+		}
+	}
+
+	if (can_queue_frame(chnl)) {
+		queue_frame(chnl, tripple_buffer);
+		mcde_debugfs_channel_update(chnl->id);
+		return 0;
+	}
+	flush_frame(chnl);
+
+	if (chnl->port.update_auto_trig && tripple_buffer)
+		wait_for_vcmp(chnl);
 
 	chnl_update_overlay(chnl, chnl->ovly0);
 	chnl_update_overlay(chnl, chnl->ovly1);
@@ -3889,6 +4108,7 @@ static void probe_hw(void)
 
 		init_waitqueue_head(&channels[i].state_waitq);
 		init_waitqueue_head(&channels[i].vcmp_waitq);
+		spin_lock_init(&channels[i].frame_lock);
 		init_timer(&channels[i].auto_sync_timer);
 		channels[i].auto_sync_timer.function =
 					watchdog_auto_sync_timer_function;
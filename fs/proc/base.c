@@ -324,6 +324,21 @@ static int proc_pid_wchan(struct task_struct *task, char *buffer)
 }
 #endif /* CONFIG_KALLSYMS */
 
+#ifdef CONFIG_ASHMEM
+/*
+ * Provides /proc/PID/ashmem_purged: how often and how many pages of
+ * unpinned ashmem created by this process were purged.
+ */
+static int proc_pid_ashmem_purged(struct seq_file *m, struct pid_namespace *ns,
+				  struct pid *pid, struct task_struct *task)
+{
+	seq_printf(m, "%lu %lu\n",
+		   atomic_long_read(&task->signal->ashmem_purges),
+		   atomic_long_read(&task->signal->ashmem_purged_pages));
+	return 0;
+}
+#endif /* CONFIG_ASHMEM */
+
 #ifdef CONFIG_STACKTRACE
 
 #define MAX_STACK_TRACE_DEPTH	64
@@ -1049,6 +1064,7 @@ static ssize_t oom_adjust_write(struct file *file, const char __user *buf,
 	task->signal->oom_adj = oom_adjust;
 
 	unlock_task_sighand(task, &flags);
+	oom_adj_changed(task);
 	put_task_struct(task);
 
 	return count;
@@ -2648,6 +2664,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 #ifdef CONFIG_SCHEDSTATS
 	INF("schedstat",  S_IRUGO, proc_pid_schedstat),
 #endif
+#ifdef CONFIG_ASHMEM
+	ONE("ashmem_purged", S_IRUGO, proc_pid_ashmem_purged),
+#endif
 #ifdef CONFIG_LATENCYTOP
 	REG("latency",  S_IRUGO, proc_lstats_operations),
 #endif
@@ -164,6 +164,38 @@ struct hwmem_set_domain_request {
 	struct hwmem_region_us region;
 };
 
+/**
+ * @brief Set domain request data for several regions.
+ */
+struct hwmem_set_domain_regions_request {
+	/**
+	 * @brief [in] Identifier of buffer to be prepared. If 0 is specified
+	 * the buffer associated with the current file instance will be used.
+	 */
+	__s32 id;
+	/**
+	 * @brief [in] Flags specifying access mode of the operation.
+	 *
+	 * For details, @see struct hwmem_set_domain_request.
+	 */
+	__u32 access; /* enum hwmem_access */
+	/**
+	 * @brief [in] Number of regions in <regions>, at most
+	 * HWMEM_MAX_DOMAIN_REGIONS. If 0 is specified the entire buffer will
+	 * be prepared.
+	 */
+	__u32 num_regions;
+	/**
+	 * @brief [in] The regions of bytes to be prepared.
+	 *
+	 * Only the blocks of each region are synchronized, not the gaps
+	 * between them. For details, @see struct hwmem_region.
+	 */
+	struct hwmem_region_us *regions;
+};
+
+#define HWMEM_MAX_DOMAIN_REGIONS 64
+
 /**
  * @brief Pin request data.
  */
@@ -359,6 +391,16 @@ struct hwmem_get_info_request {
  */
 #define HWMEM_IMPORT_FD_IOC _IO('W', 12)
 
+/**
+ * @brief Prepares several regions of the buffer for CPU access.
+ *
+ * Input is a pointer to a hwmem_set_domain_regions_request struct.
+ *
+ * @return Zero on success, or a negative error code.
+ */
+#define HWMEM_SET_CPU_DOMAIN_REGIONS_IOC _IOW('W', 13, \
+				struct hwmem_set_domain_regions_request)
+
 #ifdef __KERNEL__
 
 /* Kernel API */
@@ -466,6 +508,26 @@ void hwmem_release(struct hwmem_alloc *alloc);
 int hwmem_set_domain(struct hwmem_alloc *alloc, enum hwmem_access access,
 		enum hwmem_domain domain, struct hwmem_region *region);
 
+/**
+ * @brief Set the buffer domain and prepare several regions of it for access.
+ *
+ * Unlike hwmem_set_domain with the bounding region, the gaps between the
+ * blocks of each region are not synchronized.
+ *
+ * @param alloc Buffer to be prepared.
+ * @param access Flags defining memory access mode of the call.
+ * @param domain Value specifying the memory domain.
+ * @param regions Array of structures defining the minimum areas of the buffer
+ * to be prepared.
+ * @param num_regions Number of regions in <regions>. If 0 the entire buffer
+ * is prepared.
+ *
+ * @return Zero on success, or a negative error code.
+ */
+int hwmem_set_domain_regions(struct hwmem_alloc *alloc,
+		enum hwmem_access access, enum hwmem_domain domain,
+		struct hwmem_region *regions, size_t num_regions);
+
 /**
  * @brief Pins the buffer.
  *
@@ -14,10 +14,13 @@
 
 /* forward declaration */
 struct shrm_dev;
+struct sk_buff;
 
 typedef void (*rx_cb)(void *data, unsigned int length);
 typedef void (*received_msg_handler)(unsigned char l2_header,
 			void *msg_ptr, unsigned int length,
 			struct shrm_dev *shrm);
+typedef void (*received_skb_handler)(struct sk_buff *skb,
+			struct shrm_dev *shrm);
 
 #endif
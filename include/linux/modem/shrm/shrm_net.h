@@ -8,6 +8,9 @@
 #ifndef __SHRM_NET_H
 #define __SHRM_NET_H
 
+#include <linux/interrupt.h>
+#include <linux/skbuff.h>
+
 #define SHRM_HLEN 1
 #define PHONET_ALEN 1
 
@@ -15,6 +18,8 @@
 #define PN_DEV_HOST	0x00
 #define PN_LINK_ADDR	0x26
 #define PN_TX_QUEUE_LEN	100
+#define SHRM_TX_BATCH		16
+#define SHRM_TX_QUEUE_MAX	(4 * SHRM_TX_BATCH)
 
 #define RESOURCE_ID_INDEX	3
 #define SRC_OBJ_INDEX		7
@@ -26,14 +31,19 @@
  * struct shrm_net_iface_priv - shrm net interface device information
  * @shrm_device:	pointer to the shrm device information structure
  * @iface_num:		flag used to indicate the up/down of netdev
+ * @tx_queue:		ISI messages waiting to be written to the FIFO
+ * @tx_tasklet:		writes @tx_queue to the FIFO in batches
  */
 struct shrm_net_iface_priv {
 	struct shrm_dev *shrm_device;
 	unsigned int iface_num;
+	struct sk_buff_head tx_queue;
+	struct tasklet_struct tx_tasklet;
 };
 
 int shrm_register_netdev(struct shrm_dev *shrm_dev_data);
 int shrm_net_receive(struct net_device *dev);
+int shrm_net_receive_skb(struct net_device *dev, struct sk_buff *skb);
 int shrm_suspend_netdev(struct net_device *dev);
 int shrm_resume_netdev(struct net_device *dev);
 int shrm_stop_netdev(struct net_device *dev);
@@ -13,6 +13,7 @@
 #include <linux/io.h>
 #include <linux/ioport.h>
 #include <linux/interrupt.h>
+#include <linux/uio.h>
 #include <linux/modem/shrm/shrm.h>
 
 #define GOP_OUTPUT_REGISTER_BASE (0x0)
@@ -103,12 +104,17 @@ struct fifo_read_params{
 int shrm_protocol_init(struct shrm_dev *shrm,
 			received_msg_handler common_rx_handler,
 			received_msg_handler audio_rx_handler);
+void shrm_protocol_set_skb_handler(received_skb_handler handler);
 void shrm_protocol_deinit(struct shrm_dev *shrm);
 void shm_fifo_init(struct shrm_dev *shrm);
 int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
 				u8 l2header, void *addr, u32 length);
+int shm_write_msgv_to_fifo(struct shrm_dev *shrm, u8 channel,
+		u8 l2header, struct kvec *vec, int count, bool *was_empty);
 int shm_write_msg(struct shrm_dev *shrm,
 			u8 l2_header, void *addr, u32 length);
+int shm_write_msgv(struct shrm_dev *shrm, u8 l2_header,
+			struct kvec *vec, int count);
 
 u8 is_the_only_one_unread_message(struct shrm_dev *shrm,
 						u8 channel, u32 length);
@@ -118,7 +124,8 @@ u8 read_one_l2msg_audio(struct shrm_dev *shrm,
 			u8 *p_l2_msg, u32 *p_len);
 u8 read_one_l2msg_common(struct shrm_dev *shrm,
 				u8 *p_l2_msg, u32 *p_len);
-void receive_messages_common(struct shrm_dev *shrm);
+u8 peek_one_l2msg_common(struct shrm_dev *shrm, u32 *p_len);
+int receive_messages_common(struct shrm_dev *shrm, int budget);
 void receive_messages_audio(struct shrm_dev *shrm);
 
 void update_ac_common_local_rptr(struct shrm_dev *shrm);
@@ -626,6 +626,12 @@ struct signal_struct {
 #endif
 
 	int oom_adj;	/* OOM kill score adjustment (bit shift) */
+
+#ifdef CONFIG_ASHMEM
+	/* purges of unpinned ashmem in areas this process created */
+	atomic_long_t ashmem_purges;
+	atomic_long_t ashmem_purged_pages;
+#endif
 };
 
 /* Context switch must be unlocked if interrupts are to be enabled */
@@ -1217,6 +1223,9 @@ struct task_struct {
 
 	struct list_head tasks;
 	struct plist_node pushable_tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head oom_adj_node;	/* lowmemorykiller oom_adj bucket */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #if defined(SPLIT_RSS_COUNTING)
@@ -1682,6 +1691,9 @@ extern void thread_group_times(struct task_struct *p, cputime_t *ut, cputime_t *
 
 extern int task_free_register(struct notifier_block *n);
 extern int task_free_unregister(struct notifier_block *n);
+extern int oom_adj_register(struct notifier_block *n);
+extern int oom_adj_unregister(struct notifier_block *n);
+extern void oom_adj_changed(struct task_struct *tsk);
 
 /*
  * Per process flags
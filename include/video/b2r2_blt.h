@@ -542,6 +542,59 @@ struct b2r2_blt_report {
 	__u32 usec_elapsed;
 };
 
+/**
+ * struct b2r2_blt_batch - A list of blit requests executed as one job
+ *
+ * The requests are executed in order. Only one completion, and one report if
+ * B2R2_BLT_FLAG_REPORT_WHEN_DONE is set, is generated for the whole batch.
+ *
+ * @flags: B2R2_BLT_FLAG_ASYNCH and B2R2_BLT_FLAG_REPORT_WHEN_DONE, the same
+ *         flags of the requests are ignored
+ * @prio: Priority of the batch, see struct b2r2_blt_req
+ * @report1: Data 1 to report back when the batch is done
+ * @report2: Data 2 to report back when the batch is done
+ * @count: Number of requests, at most B2R2_BLT_MAX_BATCH
+ * @reqs: The requests
+ */
+struct b2r2_blt_batch {
+	__u32                     flags;
+	__s32                     prio;
+	__u32                     report1;
+	__u32                     report2;
+	__u32                     count;
+	struct b2r2_blt_req       *reqs;
+};
+
+#define B2R2_BLT_MAX_BATCH 32
+
+/**
+ * struct b2r2_blt_fenced_req - A blit request with fences
+ *
+ * @req: The request
+ * @in_fence: File descriptor of a fence the blit shall wait for, or -1
+ * @out_fence: Returns the file descriptor of a fence that is signaled
+ *             when the blit is done
+ */
+struct b2r2_blt_fenced_req {
+	struct b2r2_blt_req       req;
+	__s32                     in_fence;
+	__s32                     out_fence;
+};
+
+/**
+ * struct b2r2_blt_fenced_batch - A batch of blit requests with fences
+ *
+ * @batch: The batch
+ * @in_fence: File descriptor of a fence the batch shall wait for, or -1
+ * @out_fence: Returns the file descriptor of a fence that is signaled
+ *             when the batch is done
+ */
+struct b2r2_blt_fenced_batch {
+	struct b2r2_blt_batch     batch;
+	__s32                     in_fence;
+	__s32                     out_fence;
+};
+
 /**
  * B2R2 BLT driver is used in the following way:
  *
@@ -621,4 +674,53 @@ struct b2r2_blt_report {
 #define B2R2_BLT_QUERY_CAP_IOC  _IOWR(B2R2_BLT_IOC_MAGIC, 3, \
 				  struct b2r2_blt_query_cap)
 
+/**
+ * The B2R2_BLT_BATCH_IOC ioctl adds a batch of blit requests to B2R2.
+ *
+ * The node lists of the requests are chained and executed as one job, which
+ * saves the per job interrupt and synchronization of issuing them one by
+ * one. Nothing is queued if any request would need the generic path, or
+ * uses B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION or B2R2_BLT_FLAG_DRY_RUN; such
+ * batches fail with -ENOSYS and must be issued with B2R2_BLT_IOC instead.
+ *
+ * Supplied parameter shall be a pointer to a struct b2r2_blt_batch.
+ *
+ * Returns a request id for the whole batch if >= 0, else a negative error
+ * code. The request id can be waited for using B2R2_BLT_SYNC_IOC.
+ */
+#define B2R2_BLT_BATCH_IOC  _IOW(B2R2_BLT_IOC_MAGIC, 4, struct b2r2_blt_batch)
+
+/**
+ * The B2R2_BLT_FENCED_IOC ioctl adds a blit request that is ordered by
+ * fences instead of by the report list.
+ *
+ * The blit is not started before in_fence is signaled, and is canceled if
+ * in_fence is signaled with an error. The returned out_fence is signaled
+ * when the blit is done, with an error if it was canceled. A fence file
+ * descriptor can be polled (POLLIN when signaled), passed to another
+ * process, or handed as in_fence to B2R2 or to another driver. Close it when
+ * done with it.
+ *
+ * Requests that would need the generic path fail with -ENOSYS and must be
+ * issued with B2R2_BLT_IOC instead.
+ *
+ * Supplied parameter shall be a pointer to a struct b2r2_blt_fenced_req.
+ *
+ * Returns a request id if >= 0, else a negative error code.
+ */
+#define B2R2_BLT_FENCED_IOC  _IOWR(B2R2_BLT_IOC_MAGIC, 5, \
+				   struct b2r2_blt_fenced_req)
+
+/**
+ * The B2R2_BLT_FENCED_BATCH_IOC ioctl is B2R2_BLT_BATCH_IOC with fences,
+ * see B2R2_BLT_FENCED_IOC.
+ *
+ * Supplied parameter shall be a pointer to a struct b2r2_blt_fenced_batch.
+ *
+ * Returns a request id for the whole batch if >= 0, else a negative error
+ * code.
+ */
+#define B2R2_BLT_FENCED_BATCH_IOC  _IOWR(B2R2_BLT_IOC_MAGIC, 6, \
+				   struct b2r2_blt_fenced_batch)
+
 #endif /* #ifdef _LINUX_VIDEO_B2R2_BLT_H */
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ *
+ * ST-Ericsson B2R2 fences
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#ifndef _LINUX_VIDEO_B2R2_FENCE_H
+#define _LINUX_VIDEO_B2R2_FENCE_H
+
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+/**
+ * struct b2r2_fence - Completion object that is signaled exactly once
+ *
+ * A fence can be handed to user space as a file descriptor, which can be
+ * polled, passed to another process and turned back into the same fence by
+ * any driver through b2r2_fence_fdget().
+ *
+ * @ref: Reference count
+ * @lock: Protects the members below
+ * @signaled: True once the fence has been signaled
+ * @status: 0 if the work completed, else a negative error code
+ * @wait: Waiters for the fence
+ * @callbacks: Callbacks to call when the fence is signaled
+ */
+struct b2r2_fence {
+	struct kref ref;
+
+	spinlock_t lock;
+	bool signaled;
+	int status;
+	wait_queue_head_t wait;
+	struct list_head callbacks;
+};
+
+struct b2r2_fence_cb;
+typedef void (*b2r2_fence_func_t)(struct b2r2_fence *fence,
+		struct b2r2_fence_cb *cb);
+
+/**
+ * struct b2r2_fence_cb - A callback registered on a fence
+ *
+ * @list: Entry in the fence's callback list
+ * @func: Called when the fence is signaled, possibly from atomic context
+ */
+struct b2r2_fence_cb {
+	struct list_head list;
+	b2r2_fence_func_t func;
+};
+
+/**
+ * b2r2_fence_create() - Creates an unsignaled fence with one reference
+ *
+ * Returns the fence or NULL if out of memory
+ */
+struct b2r2_fence *b2r2_fence_create(void);
+
+/**
+ * b2r2_fence_get() - Adds a reference to a fence
+ */
+struct b2r2_fence *b2r2_fence_get(struct b2r2_fence *fence);
+
+/**
+ * b2r2_fence_put() - Drops a reference to a fence
+ */
+void b2r2_fence_put(struct b2r2_fence *fence);
+
+/**
+ * b2r2_fence_signal() - Signals a fence, does nothing if already signaled
+ *
+ * @fence: The fence
+ * @status: 0 if the work completed, else a negative error code
+ *
+ * Can be called from atomic context.
+ */
+void b2r2_fence_signal(struct b2r2_fence *fence, int status);
+
+/**
+ * b2r2_fence_status() - Returns 1 if unsignaled, else the status the fence
+ *                       was signaled with
+ */
+int b2r2_fence_status(struct b2r2_fence *fence);
+
+/**
+ * b2r2_fence_wait() - Waits for a fence to be signaled
+ *
+ * @fence: The fence
+ * @timeout: Timeout in jiffies, MAX_SCHEDULE_TIMEOUT for none
+ *
+ * Returns the status of the fence, -ETIME on timeout or -ERESTARTSYS if
+ * interrupted
+ */
+int b2r2_fence_wait(struct b2r2_fence *fence, long timeout);
+
+/**
+ * b2r2_fence_add_callback() - Registers a callback on a fence
+ *
+ * @fence: The fence
+ * @cb: The callback, must stay valid until called or removed
+ * @func: Function to call
+ *
+ * Returns 0 if registered, or -EALREADY if the fence is already signaled in
+ * which case func is not called
+ */
+int b2r2_fence_add_callback(struct b2r2_fence *fence,
+		struct b2r2_fence_cb *cb, b2r2_fence_func_t func);
+
+/**
+ * b2r2_fence_remove_callback() - Unregisters a callback
+ *
+ * Returns true if the callback was removed before it was called
+ */
+bool b2r2_fence_remove_callback(struct b2r2_fence *fence,
+		struct b2r2_fence_cb *cb);
+
+/**
+ * b2r2_fence_install_fd() - Returns a new file descriptor for a fence
+ *
+ * The file holds a reference of its own.
+ *
+ * Returns the file descriptor or a negative error code
+ */
+int b2r2_fence_install_fd(struct b2r2_fence *fence);
+
+/**
+ * b2r2_fence_fdget() - Returns the fence of a file descriptor with an added
+ *                      reference, or an ERR_PTR
+ */
+struct b2r2_fence *b2r2_fence_fdget(int fd);
+
+#endif /* _LINUX_VIDEO_B2R2_FENCE_H */
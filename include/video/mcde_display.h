@@ -59,6 +59,9 @@ struct mcde_display_device {
 	bool synchronized_update;
 	struct mcde_video_mode video_mode;
 	int update_flags;
+	/* Partial update area alignment in pixels */
+	u16 update_area_x_align;
+	u16 update_area_y_align;
 	bool deep_standby_as_power_off;
 	bool stay_alive;
 	int check_transparency;
@@ -101,6 +104,8 @@ struct mcde_display_device {
 	int (*apply_config)(struct mcde_display_device *dev);
 	int (*invalidate_area)(struct mcde_display_device *dev,
 						struct mcde_rectangle *area);
+	int (*try_update_area)(struct mcde_display_device *dev,
+						struct mcde_rectangle *area);
 	int (*update)(struct mcde_display_device *dev, bool tripple_buffer);
 	int (*prepare_for_update)(struct mcde_display_device *dev,
 		u16 x, u16 y, u16 w, u16 h);
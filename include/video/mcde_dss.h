@@ -33,6 +33,8 @@ int mcde_dss_apply_overlay(struct mcde_overlay *ovl,
 void mcde_dss_get_overlay_info(struct mcde_overlay *ovly,
 				struct mcde_overlay_info *info);
 int mcde_dss_update_overlay(struct mcde_overlay *ovl, bool tripple_buffer);
+int mcde_dss_update_overlay_area(struct mcde_overlay *ovl,
+						struct mcde_rectangle *area);
 
 void mcde_dss_get_native_resolution(struct mcde_display_device *ddev,
 	u16 *x_res, u16 *y_res);
@@ -27,7 +27,20 @@
 #endif
 #endif
 
+/*
+ * Rectangle of the visible frame buffer that has changed since the last
+ * update. Command mode DSI displays will only transfer this area, other
+ * displays do a full update.
+ */
+struct mcde_fb_dirty_rect {
+	uint16_t x;
+	uint16_t y;
+	uint16_t w;
+	uint16_t h;
+};
+
 #define MCDE_GET_BUFFER_NAME_IOC _IO('M', 1)
+#define MCDE_FB_UPDATE_DIRTY_RECT_IOC _IOW('M', 2, struct mcde_fb_dirty_rect)
 
 #ifdef __KERNEL__
 #define to_mcde_fb(x) ((struct mcde_fb *)(x)->par)
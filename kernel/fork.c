@@ -149,6 +149,7 @@ static struct kmem_cache *mm_cachep;
 
 /* Notifier list called when a task struct is freed */
 static ATOMIC_NOTIFIER_HEAD(task_free_notifier);
+static ATOMIC_NOTIFIER_HEAD(oom_adj_notifier);
 
 static void account_kernel_stack(struct thread_info *ti, int account)
 {
@@ -192,6 +193,28 @@ int task_free_unregister(struct notifier_block *n)
 }
 EXPORT_SYMBOL(task_free_unregister);
 
+int oom_adj_register(struct notifier_block *n)
+{
+	return atomic_notifier_chain_register(&oom_adj_notifier, n);
+}
+EXPORT_SYMBOL(oom_adj_register);
+
+int oom_adj_unregister(struct notifier_block *n)
+{
+	return atomic_notifier_chain_unregister(&oom_adj_notifier, n);
+}
+EXPORT_SYMBOL(oom_adj_unregister);
+
+/*
+ * Called when the oom_adj of tsk's thread group may have changed, or when
+ * tsk has just become a thread group leader. The caller holds a reference
+ * on tsk.
+ */
+void oom_adj_changed(struct task_struct *tsk)
+{
+	atomic_notifier_call_chain(&oom_adj_notifier, 0, tsk);
+}
+
 void __put_task_struct(struct task_struct *tsk)
 {
 	WARN_ON(!tsk->exit_state);
@@ -1233,6 +1256,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	 */
 	p->group_leader = p;
 	INIT_LIST_HEAD(&p->thread_group);
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	INIT_LIST_HEAD(&p->oom_adj_node);
+#endif
 
 	/* Now that the task is set up, run cgroup callbacks if
 	 * necessary. We need to run them before the task is visible
@@ -1301,6 +1327,8 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	spin_unlock(&current->sighand->siglock);
 	write_unlock_irq(&tasklist_lock);
 	proc_fork_connector(p);
+	if (thread_group_leader(p))
+		oom_adj_changed(p);
 	cgroup_post_fork(p);
 	perf_event_fork(p);
 	return p;